@@ -2,7 +2,6 @@
 //#define MONITOR_BUFFERS
 //#define NO_RECURSIVE_RULES
 //#define NO_OR_RULES
-//#define NO_ALL_VAR_QUERIES
 //#define PRINT_FREE_MEM
 
 #include "HazeProlog.h"
@@ -63,7 +62,7 @@ void doPrologWork()
   //FixVariableFlags(&query); // no need to call if you are manualy set variable flags!
   prolog.SetRuleFactDefinitions(&rule1, &fact1);
   
-  int8 resultCount = 0;
+  rcount resultCount = 0;
   Fact results[MAX_MATCHING_FACTS];
   
   if (prolog.SolveQuery(&query, &resultCount, results))
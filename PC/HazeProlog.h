@@ -7,18 +7,42 @@ Syntax limitations:
 	(#) fact definition can only have constants. no variables!
 	(#) max 2 terms within fact
 	(#) max 2 facts within body of rule
+	(#) use ClauseSolver for facts with more terms or rules with more goals. (ClauseBuilder converts Fact and Rule chains)
 
 Optimization notes:
 	(#) define NO_RECURSIVE_RULES if you don't have rules with their body containing their own name. 
-		it will remove "readLock" of Rule struct and allow you to define static const rules!
-	(#) define NO_ALL_VAR_QUERIES if you don't have queries with two variables.
+		it will remove rule lock checks of rule lookups.
 	(#) define NO_OR_RULES if you don't have rules with OR operator.
+	(#) define INTERNED_SYMBOLS if all facts, rules and queries are interned with SymbolTable.
+		name comparison becomes a pointer compare instead of strcmp.
+	(#) pass a FactIndex to SetRuleFactDefinitions if you have large fact lists.
+		fact lookups will only visit facts of the matching predicate/term bucket.
+	(#) pass a RuleIndex to SetRuleFactDefinitions if you have many rules.
+		rule lookups will only visit rules of the query predicate.
+		call RuleIndex::SetTerm1Storage if many rules have constant first terms. (queries with bound first term skip other constants)
+	(#) AND rules use a hash join on the shared variable if there is no FactIndex and the query arena has room.
+		define NO_HASH_JOIN to always solve second fact for each result of the first fact.
+	(#) pass PredicateStatistics to SetPredicateStatistics to run the more selective AND goal first.
+	(#) pass a ColumnarFactStore to SetFactSource if you have large tables which are scanned. (less memory per fact)
+	(#) pass a DynamicFactStore to SetFactSource if facts are asserted and retracted at runtime.
+	(#) use DatalogEvaluator to compute facts of recursive rules bottom-up into a DynamicFactStore. (AddFact and RemoveFact update them)
+	(#) compile clauses with ClauseCompiler and run them on ClauseMachine. (no name comparisons of variables and predicates)
+	(#) pass QueryCache to SetQueryCache if you repeat the same queries. (dropped when knowledge base changes)
+	(#) pass AnswerTable to SetAnswerTable to memoize goals. recursive rules are solved to a fixpoint
+		instead of being pruned by rule locks. (answers of each goal become unique)
+	(#) facts and rules are never written by queries. pass a QuerySession to VisitSolutions of each thread
+		to query the same HazeProlog from many threads.
+	(#) define ENABLE_ROM_TABLES to compile fact declarations into sorted constexpr tables. (C++14, PROGMEM on AVR)
+	(#) define ENABLE_KB_IMAGE to compile knowledge bases into memory mapped image files. (PC only)
+	(#) define ENABLE_PARALLEL_RULES to solve alternative rules and OR branches of a query on a QueryTaskPool. (PC only, C++11)
+	(#) define ENABLE_BATCH_QUERIES to solve arrays of queries on a thread pool with BatchQuerySolver. (PC only, C++11)
 */
 
 #ifndef HAZE_PROLOG_H_
 #define HAZE_PROLOG_H_
 
 #include <string.h> // for strcmp
+#include <stddef.h> // for size_t
 
 #ifndef Arduino_h
 #include <stdio.h> // for printf
@@ -28,22 +52,45 @@ Optimization notes:
 #include <MemoryFree.h> // for AVR free mem
 #endif
 
+#ifndef Arduino_h
+#include <stdlib.h> // for realloc
+#endif
+
+#ifdef ENABLE_PARALLEL_RULES
+#ifdef Arduino_h
+#error "parallel rules require a PC build"
+#endif
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// alternative rules which are given to the pool at once. (more rules are solved in groups of this size)
+#ifndef MAX_PARALLEL_BRANCHES
+#define MAX_PARALLEL_BRANCHES 8
+#endif
+#endif
+
 #ifdef Arduino_h
 #define PRINT(TXT) Serial.print(TXT)
+#define PRINT_NUMBER(NUM) Serial.print(NUM)
 #else
 #define PRINT(TXT) printf(TXT)
+#define PRINT_NUMBER(NUM) printf("%d", (int)(NUM))
 #endif
 
-// change following two values according to your rules/facts definitions.
-// consider stack size of your system when changing these values!
-// (you can use MONITOR_BUFFERS definition to calculate minimum values.)
+// change following value according to your rules/facts definitions.
+// it is the default result buffer size of SolveQuery. consider stack size of your system when changing this value!
+// (you can use MONITOR_BUFFERS definition to calculate minimum value.)
 #define MAX_MATCHING_FACTS 5
-#define MAX_MATCHING_RULES 5
 
 // define MONITOR_BUFFERS if you want to display buffer usages.
-// check buffer usage for each of your query. then you can set minimum values for MAX_MATCHING_FACTS and MAX_MATCHING_RULES.
+// check buffer usage for each of your query. then you can set minimum value for MAX_MATCHING_FACTS.
 #ifdef MONITOR_BUFFERS
-#define PRINT_BUFFER_USAGE(USAGE,MAX) PRINT("buffer: "); PRINT((int)USAGE); PRINT(" / "); PRINT((int)MAX); PRINT("\n");
+#define PRINT_BUFFER_USAGE(USAGE,MAX) PRINT("buffer: "); PRINT_NUMBER(USAGE); PRINT(" / "); PRINT_NUMBER(MAX); PRINT("\n");
 #else
 #define PRINT_BUFFER_USAGE(USAGE,MAX) 
 #endif
@@ -52,6 +99,24 @@ Optimization notes:
 #define int8 char
 #endif
 
+// result counter type. (int8 on embedded systems)
+#ifndef rcount
+#ifdef Arduino_h
+#define rcount int8
+#else
+#define rcount int
+#endif
+#endif
+
+// symbol ids of SymbolTable. (0 is reserved for "no symbol")
+#ifndef symbolid
+#ifdef Arduino_h
+#define symbolid unsigned short
+#else
+#define symbolid unsigned int
+#endif
+#endif
+
 #ifndef NO_INLINE
 #ifdef __GNUG__ // g++
 #define NO_INLINE __attribute__((noinline))
@@ -60,6 +125,17 @@ Optimization notes:
 #endif
 #endif
 
+// vector instructions of ColumnarFactStore scans. (define NO_SIMD_SCAN to use the scalar scan)
+#if (!defined(Arduino_h)) && (!defined(NO_SIMD_SCAN))
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SIMD_SCAN_SSE2
+#endif
+#endif
+
 struct Fact
 {
 	int8 termCount;
@@ -81,648 +157,7522 @@ struct Rule
 	Fact fact2;
 
 	const Rule *nextRule;
-
-#ifndef NO_RECURSIVE_RULES // for ROM-able rules
-	mutable bool readLock;
-#endif
 };
 
-class HazeProlog
+// maps each predicate/term name to a compact id and a canonical name pointer.
+// interned facts and rules point to canonical names, so two names are equal only if their pointers are equal.
+// storage is supplied by the caller. (static arrays on embedded systems)
+class SymbolTable
 {
 protected:
-	const Rule *firstRule;
-	const Fact *firstFact;
+	const char **names; // canonical name of each id
+	symbolid *slots; // open addressing hash table of ids
+	unsigned int capacity; // power of two
+	symbolid symbolCount;
 
 public:
 
-	void SetRuleFactDefinitions(const Rule *firstRule, const Fact *firstFact)
-	{
-		this->firstFact = firstFact;
-		this->firstRule = firstRule;
-	}
-
-	static bool StringCompare(const char *str1, const char* str2)
+	// names and slots must have room for "capacity" items. capacity must be a power of two.
+	// table can hold up to 3/4 of capacity symbols.
+	void SetStorage(const char **names, symbolid *slots, unsigned int capacity)
 	{
-		return (::strcmp(str1, str2) == 0); // replace this line according to your system!
-	}
+		this->names = names;
+		this->slots = slots;
+		this->capacity = capacity;
+		this->symbolCount = 0;
 
-	static bool IsCapitalLetter(const char x)
-	{
-		return ( (x >= 'A') && (x <= 'Z') );
+		for (unsigned int i = 0; i < capacity; ++i)
+			slots[i] = 0;
 	}
 
-	static bool IsVariable(const char *text)
+	// FNV-1a
+	static unsigned int HashString(const char *text)
 	{
-		return HazeProlog::IsCapitalLetter(text[0]);
-	}
+		unsigned int hash = 2166136261u;
 
-	static void FixVariableFlags(Fact *fact)
-	{
-		fact->isTerm1Var = HazeProlog::IsVariable(fact->term1Name);
+		while (*text)
+		{
+			hash ^= (unsigned char)(*text);
+			hash *= 16777619u;
+			++text;
+		}
 
-		if (fact->termCount == 2)
-			fact->isTerm2Var = HazeProlog::IsVariable(fact->term2Name);
+		return hash;
 	}
 
-	static void CopyFact(Fact *output, const Fact *input)
+	// hash of a name. (hash of pointer value if names are interned)
+	static unsigned int HashName(const char *name)
 	{
-		*output = *input;
-		/*output->termCount = input->termCount;
-		output->predicateName = input->predicateName;
-		output->isTerm1Var = input->isTerm1Var;
-		output->term1Name = input->term1Name;
-		output->isTerm2Var = input->isTerm2Var;
-		output->term2Name = input->term2Name;
-		output->nextFact = input->nextFact;*/
+#ifdef INTERNED_SYMBOLS
+		size_t value = (size_t)name;
+		return (unsigned int)(value ^ (value >> 16)) * 2654435761u;
+#else
+		return SymbolTable::HashString(name);
+#endif
 	}
 
-	static void CopyRule(const Rule *input, Rule *output)
+	static bool IsSameName(const char *name1, const char *name2)
 	{
-		*output = *input;
-		/*CopyFact(&output->head, &input->head);
-		output->factCountInBody = input->factCountInBody;
-		CopyFact(&output->fact1, &input->fact1);
-		output->op1IsAnd = input->op1IsAnd;
-		CopyFact(&output->fact2, &input->fact2);
-		output->nextRule = input->nextRule;*/
+#ifdef INTERNED_SYMBOLS
+		return (name1 == name2);
+#else
+		return (::strcmp(name1, name2) == 0);
+#endif
 	}
 
-	static char GetVariableCountOfQuery(const Fact *query)
+	// returns 0 if name is not in the table.
+	symbolid Find(const char *name) const
 	{
-		int8 varCount = 0;
+		unsigned int mask = capacity - 1;
+		unsigned int slot = SymbolTable::HashString(name) & mask;
 
-		if (query->isTerm1Var)
-			++varCount;
+		while (slots[slot])
+		{
+			if (::strcmp(names[slots[slot]], name) == 0)
+				return slots[slot];
 
-		if ((query->termCount == 2) && (query->isTerm2Var))
-			++varCount;
+			slot = (slot + 1) & mask;
+		}
 
-		return varCount;
+		return 0;
 	}
 
-	// assume: termCount & predicateName matches
-	// fact can contain variables if it is from rule head.
-	static bool IsFactMatch(const Fact *query, const Fact *fact)
+	// returns 0 if the table is full.
+	symbolid Intern(const char *name)
 	{
-		if (query->termCount == 1)
+		unsigned int mask = capacity - 1;
+		unsigned int slot = SymbolTable::HashString(name) & mask;
+
+		while (slots[slot])
 		{
-			return query->isTerm1Var ? true : (fact->isTerm1Var ? true : HazeProlog::StringCompare(query->term1Name, fact->term1Name));
+			if (::strcmp(names[slots[slot]], name) == 0)
+				return slots[slot];
+
+			slot = (slot + 1) & mask;
 		}
-		else if (query->termCount == 2)
-		{
-			if (fact->isTerm1Var && fact->isTerm2Var) // both terms are variables in "fact"
-				return true;
 
-			if (query->isTerm1Var && query->isTerm2Var) // both terms are variables in "query"
-			{
-				if (HazeProlog::StringCompare(query->term1Name, query->term2Name)) // pred(X , X)
-					return HazeProlog::StringCompare(fact->term1Name, fact->term2Name);
-				else // pred(X , Y)
-					return !HazeProlog::StringCompare(fact->term1Name, fact->term2Name);
-			}
-			else if (query->isTerm1Var && (!query->isTerm2Var)) // term2 is constant in query
-			{
-				return fact->isTerm2Var ? true : HazeProlog::StringCompare(query->term2Name, fact->term2Name);
-			}
-			else if ((!query->isTerm1Var) && query->isTerm2Var) // term1 is constant in query
-			{
-				return fact->isTerm1Var ? true : HazeProlog::StringCompare(query->term1Name, fact->term1Name);
-			}
-			else // both constant in query
-			{
-				char varCount = HazeProlog::GetVariableCountOfQuery(fact);
+		if ((unsigned int)(symbolCount + 1) > ((capacity >> 1) + (capacity >> 2))) // keep load factor under 3/4
+			return 0;
 
-				if (varCount == 0) // fact has no variables
-				{
-					return HazeProlog::StringCompare(query->term1Name, fact->term1Name) && HazeProlog::StringCompare(query->term2Name, fact->term2Name);
-				}
-				else if (varCount == 1) // fact has one variable
-				{
-					if (fact->isTerm1Var)
-						return HazeProlog::StringCompare(query->term2Name, fact->term2Name);
-					else
-						return HazeProlog::StringCompare(query->term1Name, fact->term1Name);
-				}
-			}
-		}
+		++symbolCount;
+		names[symbolCount] = name;
+		slots[slot] = symbolCount;
 
-		return false;
+		return symbolCount;
 	}
 
-	bool FindMatchingFactsFromFactList(const Fact *query, int8 *factCount, const Fact **result)
+	const char* GetName(symbolid id) const
 	{
-		const Fact *nextFact = firstFact;
-		*factCount = 0;
-
-		while (nextFact)
-		{
-			if ((nextFact->termCount == query->termCount)
-				&& HazeProlog::StringCompare(nextFact->predicateName, query->predicateName)
-				&& HazeProlog::IsFactMatch(query, nextFact))
-			{
-				result[*factCount] = nextFact;
-				++(*factCount);
-			}
-			nextFact = nextFact->nextFact;
-		}
+		return names[id];
+	}
 
-		return ((*factCount) != 0);
+	symbolid GetSymbolCount() const
+	{
+		return symbolCount;
 	}
 
-	void FindMatchingRulesFromRulesList(const Fact *query, int8 *ruleCount, const Rule **result)
+	// replace names of the fact with canonical names. (variables are interned too)
+	bool InternFact(Fact *fact)
 	{
-		const Rule *nextRule = firstRule;
-		*ruleCount = 0;
+		symbolid predicate = this->Intern(fact->predicateName);
+		symbolid term1 = this->Intern(fact->term1Name);
+		symbolid term2 = (fact->termCount == 2) ? this->Intern(fact->term2Name) : 0; // term2 of one-term facts is not used
 
-		while (nextRule)
-		{
-#ifndef NO_RECURSIVE_RULES
-			if ((!nextRule->readLock)
-				&& (nextRule->head.termCount == query->termCount)
-				&& HazeProlog::StringCompare(nextRule->head.predicateName, query->predicateName)
-				&& HazeProlog::IsFactMatch(query, &nextRule->head))
-#else  
-			if ( (nextRule->head.termCount == query->termCount)
-				&& HazeProlog::StringCompare(nextRule->head.predicateName, query->predicateName)
-				&& HazeProlog::IsFactMatch(query, &nextRule->head))
-#endif
-			{
-				result[*ruleCount] = nextRule;
-				++(*ruleCount);
-			}
-			nextRule = nextRule->nextRule;
-		}
+		if ((!predicate) || (!term1) || ((fact->termCount == 2) && (!term2)))
+			return false;
+
+		fact->predicateName = names[predicate];
+		fact->term1Name = names[term1];
+
+		if (fact->termCount == 2)
+			fact->term2Name = names[term2];
+
+		return true;
 	}
 
-	static void ReplaceVariablesInRule(const Fact *query, const Rule *input, Rule *output)
+	// replace names of the query with canonical names. query names are not added to the table, so they can be temporary.
+	// returns false if a name is not in the table. (such names are not changed, and a variable of both terms shares one name)
+	bool InternQuery(Fact *query) const
 	{
-		output->head.term1Name = query->term1Name;
-		output->head.isTerm1Var = query->isTerm1Var;
+		const char **names[3] = { &query->predicateName, &query->term1Name, &query->term2Name };
+		bool found = true;
 
-		if (query->termCount == 2)
+		for (int i = 0; i < ((query->termCount == 2) ? 3 : 2); ++i)
 		{
-			output->head.term2Name = query->term2Name;
-			output->head.isTerm2Var = query->isTerm2Var;
-		}
+			symbolid id = this->Find(*names[i]);
 
-		if (input->head.isTerm1Var && input->fact1.isTerm1Var && HazeProlog::StringCompare(input->head.term1Name, input->fact1.term1Name))
-		{
-			output->fact1.term1Name = output->head.term1Name;
-			output->fact1.isTerm1Var = output->head.isTerm1Var;
+			if (id)
+				*names[i] = this->names[id];
+			else
+				found = false;
 		}
 
-		if (input->head.isTerm1Var && (input->fact1.termCount == 2) && input->fact1.isTerm2Var && HazeProlog::StringCompare(input->head.term1Name, input->fact1.term2Name))
-		{
-			output->fact1.term2Name = output->head.term1Name;
-			output->fact1.isTerm2Var = output->head.isTerm1Var;
-		}
+		if ((query->termCount == 2) && query->isTerm1Var && query->isTerm2Var && (::strcmp(query->term1Name, query->term2Name) == 0)) // pred(X, X)
+			query->term2Name = query->term1Name;
 
-		if (input->factCountInBody == 2)
-		{
-			if (input->head.isTerm1Var && input->fact2.isTerm1Var && HazeProlog::StringCompare(input->head.term1Name, input->fact2.term1Name))
-			{
-				output->fact2.term1Name = output->head.term1Name;
-				output->fact2.isTerm1Var = output->head.isTerm1Var;
-			}
+		return found;
+	}
 
-			if (input->head.isTerm1Var && (input->fact2.termCount == 2) && input->fact2.isTerm2Var && HazeProlog::StringCompare(input->head.term1Name, input->fact2.term2Name))
-			{
-				output->fact2.term2Name = output->head.term1Name;
-				output->fact2.isTerm2Var = output->head.isTerm1Var;
-			}
-		}
+	// copy fact chain into output array with canonical names. output facts are linked in same order.
+	bool InternFacts(const Fact *firstFact, Fact *output, int maxFacts, int *factCount)
+	{
+		*factCount = 0;
 
-		if (query->termCount == 2)
+		while (firstFact)
 		{
-			if (input->head.isTerm2Var && input->fact1.isTerm1Var && HazeProlog::StringCompare(input->head.term2Name, input->fact1.term1Name))
-			{
-				output->fact1.term1Name = output->head.term2Name;
-				output->fact1.isTerm1Var = output->head.isTerm2Var;
-			}
+			if (*factCount == maxFacts)
+				return false;
 
-			if (input->head.isTerm2Var && (input->fact1.termCount == 2) && input->fact1.isTerm2Var && HazeProlog::StringCompare(input->head.term2Name, input->fact1.term2Name))
-			{
-				output->fact1.term2Name = output->head.term2Name;
-				output->fact1.isTerm2Var = output->head.isTerm2Var;
-			}
+			output[*factCount] = *firstFact;
+			output[*factCount].nextFact = 0;
 
-			if (input->factCountInBody == 2)
-			{
-				if (input->head.isTerm2Var && input->fact2.isTerm1Var && HazeProlog::StringCompare(input->head.term2Name, input->fact2.term1Name))
-				{
-					output->fact2.term1Name = output->head.term2Name;
-					output->fact2.isTerm1Var = output->head.isTerm2Var;
-				}
+			if (!this->InternFact(&output[*factCount]))
+				return false;
 
-				if (input->head.isTerm2Var && (input->fact2.termCount == 2) && input->fact2.isTerm2Var && HazeProlog::StringCompare(input->head.term2Name, input->fact2.term2Name))
-				{
-					output->fact2.term2Name = output->head.term2Name;
-					output->fact2.isTerm2Var = output->head.isTerm2Var;
-				}
-			}
+			if (*factCount)
+				output[(*factCount) - 1].nextFact = &output[*factCount];
+
+			++(*factCount);
+			firstFact = firstFact->nextFact;
 		}
+
+		return true;
 	}
 
-	// assume: intput list does not contain vars
-	// if query has one var then first term of output is the result
-	// if query has two vars or no vars then output is same as input
-	static void PutResultsAccordingToQuery(const Fact *query, const Fact **inputList, int8 inputListSize, Fact *outputList, int8 *outputListCurrentIndex)
+	// copy rule chain into output array with canonical names. output rules are linked in same order.
+	bool InternRules(const Rule *firstRule, Rule *output, int maxRules, int *ruleCount)
 	{
-		int8 varCount = HazeProlog::GetVariableCountOfQuery(query);
+		*ruleCount = 0;
 
-		for (int8 i = 0; i < inputListSize; ++i)
+		while (firstRule)
 		{
-			HazeProlog::CopyFact(&outputList[*outputListCurrentIndex], inputList[i]);
+			if (*ruleCount == maxRules)
+				return false;
 
-			if (varCount == 1)
-			{
-				if (!query->isTerm1Var) // assign term2 into term1	 
-				{
-					outputList[*outputListCurrentIndex].term1Name = outputList[*outputListCurrentIndex].term2Name;
-					outputList[*outputListCurrentIndex].isTerm1Var = false;
-				}
-			}
+			Rule *rule = &output[*ruleCount];
+			*rule = *firstRule;
+			rule->nextRule = 0;
+
+			if ((!this->InternFact(&rule->head)) || (!this->InternFact(&rule->fact1)) || (!this->InternFact(&rule->fact2)))
+				return false;
+
+			if (*ruleCount)
+				output[(*ruleCount) - 1].nextRule = rule;
 
-			++(*outputListCurrentIndex);
+			++(*ruleCount);
+			firstRule = firstRule->nextRule;
 		}
+
+		return true;
 	}
+};
 
-	NO_INLINE bool SolveFactQuery(const Fact *query, int8 *resultCount, Fact *results)
-	{
-#ifdef PRINT_FREE_MEM
-		PRINT("SolveFactQuery Free Mem: ");
-		PRINT(freeMemory());
-		PRINT("\n");
-#endif
+struct FactIndexEntry
+{
+	const Fact *fact;
+	int next[3]; // next entry of each key chain. (-1 = end of chain)
+};
 
-		int8 matchingFactCount;
-		const Fact *matchingFacts[MAX_MATCHING_FACTS];
-		bool hasResults = this->FindMatchingFactsFromFactList(query, &matchingFactCount, matchingFacts);
+// hash index over a fact chain. keyed by (predicate, termCount), (predicate, term1) and (predicate, term2).
+// each chain keeps the order of the fact chain. buckets can be shared by different keys, so matches must be re-checked.
+class FactIndex
+{
+protected:
+	FactIndexEntry *entries;
+	int maxEntries;
+	int entryCount;
+	int *buckets; // 3 * bucketCount chain heads
+	unsigned int bucketCount; // power of two
 
-		PRINT_BUFFER_USAGE(matchingFactCount, MAX_MATCHING_FACTS);
+public:
 
-		if (hasResults)
-			HazeProlog::PutResultsAccordingToQuery(query, matchingFacts, matchingFactCount, results, resultCount);
+	enum { KEY_PREDICATE = 0, KEY_TERM1 = 1, KEY_TERM2 = 2 };
 
-		return hasResults;
+	// entries must have room for all facts. buckets must have room for (3 * bucketCount) items.
+	// bucketCount must be a power of two. (use a value close to fact count)
+	void SetStorage(FactIndexEntry *entries, int maxEntries, int *buckets, unsigned int bucketCount)
+	{
+		this->entries = entries;
+		this->maxEntries = maxEntries;
+		this->entryCount = 0;
+		this->buckets = buckets;
+		this->bucketCount = bucketCount;
 	}
 
-	NO_INLINE void OptFunc1(bool *hasResults2, Fact *queringFact, Rule *queringRule, Fact *fact1Results, int8 *resultCount, Fact *results, int8 j)
+	static unsigned int GetKeyHash(int key, const Fact *fact)
 	{
-		Fact fact2Results[MAX_MATCHING_FACTS];
-		int8 resultCountForFact2 = 0;
+		unsigned int hash = SymbolTable::HashName(fact->predicateName) + (unsigned int)fact->termCount;
 
-		(*hasResults2) |= this->SolveQuery(queringFact, &resultCountForFact2, fact2Results);
+		if (key == KEY_TERM1)
+			hash = (hash ^ 0x9e3779b9u) * 31u + SymbolTable::HashName(fact->term1Name);
+		else if (key == KEY_TERM2)
+			hash = (hash ^ 0x7f4a7c15u) * 31u + SymbolTable::HashName(fact->term2Name);
 
-		PRINT_BUFFER_USAGE(resultCountForFact2, MAX_MATCHING_FACTS);
+		return hash ^ (hash >> 15);
+	}
 
-		for (int8 k = 0; k < resultCountForFact2; ++k) // re-arrange results
-		{
-			if (HazeProlog::StringCompare(queringRule->head.term1Name, queringRule->fact1.term1Name)) // rule(X,Y) = fact1(X) , fact2(?,?)
-			{
-				results[(*resultCount)].term1Name = fact1Results[j].term1Name;
+	// returns false if there is not enough entries for the fact chain.
+	bool Build(const Fact *firstFact)
+	{
+		entryCount = 0;
 
-				if (HazeProlog::StringCompare(queringRule->head.term1Name, queringRule->fact2.term1Name)) // rule(X,Y) = fact1(X) , fact2(X,Y)				
-					results[(*resultCount)].term2Name = fact2Results[k].term2Name;
-				else // rule(X,Y) = fact1(X) , fact2(Y,X)
-					results[(*resultCount)].term2Name = fact2Results[k].term1Name;
-			}
-			else // rule(Y,X) = fact1(X) , fact2(?,?)
-			{
-				results[(*resultCount)].term2Name = fact1Results[j].term1Name;
+		for (unsigned int i = 0; i < (3 * bucketCount); ++i)
+			buckets[i] = -1;
 
-				if (HazeProlog::StringCompare(queringRule->head.term1Name, queringRule->fact2.term1Name)) // rule(Y,X) = fact1(X) , fact2(X,Y)				
-					results[(*resultCount)].term1Name = fact2Results[k].term2Name;
-				else // rule(Y,X) = fact1(X) , fact2(Y,X)
-					results[(*resultCount)].term1Name = fact2Results[k].term1Name;
-			}
-			++(*resultCount);
-		}
-	}
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			if (entryCount == maxEntries)
+				return false;
 
-	NO_INLINE void OptFunc2(bool *hasResults2, Fact *queringFact, Rule *queringRule, Fact *fact1Results, int8 *resultCount, Fact *results, int8 j)
-	{
-		Fact fact2Results[MAX_MATCHING_FACTS];
-		int8 resultCountForFact2 = 0;
-		(*hasResults2) |= this->SolveQuery(queringFact, &resultCountForFact2, fact2Results);
+			entries[entryCount].fact = fact;
+			++entryCount;
+		}
 
-		PRINT_BUFFER_USAGE(resultCountForFact2, MAX_MATCHING_FACTS);
+		unsigned int mask = bucketCount - 1;
 
-		for (int8 k = 0; k < resultCountForFact2; ++k) // re-arrange results
+		for (int i = entryCount - 1; i >= 0; --i) // insert backwards to keep fact order in each chain
 		{
-			if (HazeProlog::StringCompare(queringRule->head.term1Name, queringRule->fact1.term1Name)) // rule(X,Y) = fact1(X, ?) , fact2(?,?)
-			{
-				results[(*resultCount)].term1Name = fact1Results[j].term1Name;
+			const Fact *fact = entries[i].fact;
 
-				if (HazeProlog::StringCompare(queringRule->head.term2Name, queringRule->fact2.term1Name)) // rule(X,Y) = fact1(X, ?) , fact2(Y,?)				
-					results[(*resultCount)].term2Name = fact2Results[k].term1Name;
-				else // rule(X,Y) = fact1(X, ?) , fact2(?,Y)		
-					results[(*resultCount)].term2Name = fact2Results[k].term2Name;
-			}
-			else if (HazeProlog::StringCompare(queringRule->head.term1Name, queringRule->fact1.term2Name)) // rule(X,Y) = fact1(?, X) , fact2(?,?)
-			{
-				results[(*resultCount)].term1Name = fact1Results[j].term2Name;
+			int *head = &buckets[KEY_PREDICATE * bucketCount + (FactIndex::GetKeyHash(KEY_PREDICATE, fact) & mask)];
+			entries[i].next[KEY_PREDICATE] = *head;
+			*head = i;
 
-				if (HazeProlog::StringCompare(queringRule->head.term2Name, queringRule->fact2.term1Name)) // rule(X,Y) = fact1(?, X) , fact2(Y,?)				
-					results[(*resultCount)].term2Name = fact2Results[k].term1Name;
-				else // rule(X,Y) = fact1(?, X) , fact2(?,Y)		
-					results[(*resultCount)].term2Name = fact2Results[k].term2Name;
-			}
-			else if (HazeProlog::StringCompare(queringRule->head.term1Name, queringRule->fact2.term1Name)) // rule(X,Y) = fact1(?, ?) , fact2(X,?)
-			{
-				results[(*resultCount)].term1Name = fact2Results[k].term1Name;
+			head = &buckets[KEY_TERM1 * bucketCount + (FactIndex::GetKeyHash(KEY_TERM1, fact) & mask)];
+			entries[i].next[KEY_TERM1] = *head;
+			*head = i;
 
-				if (HazeProlog::StringCompare(queringRule->head.term2Name, queringRule->fact1.term1Name)) // rule(X,Y) = fact1(Y, ?) , fact2(X,?)				
-					results[(*resultCount)].term2Name = fact1Results[j].term1Name;
-				else  // rule(X,Y) = fact1(?, Y) , fact2(X,?)			
-					results[(*resultCount)].term2Name = fact1Results[j].term2Name;
-			}
-			else  // rule(X,Y) = fact1(?, ?) , fact2(?,X)
+			entries[i].next[KEY_TERM2] = -1;
+			if (fact->termCount == 2)
 			{
-				results[(*resultCount)].term1Name = fact2Results[k].term2Name;
-
-				if (HazeProlog::StringCompare(queringRule->head.term2Name, queringRule->fact1.term1Name)) // rule(X,Y) = fact1(Y, ?) , fact2(?,X)				
-					results[(*resultCount)].term2Name = fact1Results[j].term1Name;
-				else  // rule(X,Y) = fact1(?, Y) , fact2(?,X)			
-					results[(*resultCount)].term2Name = fact1Results[j].term2Name;
+				head = &buckets[KEY_TERM2 * bucketCount + (FactIndex::GetKeyHash(KEY_TERM2, fact) & mask)];
+				entries[i].next[KEY_TERM2] = *head;
+				*head = i;
 			}
-			++(*resultCount);
 		}
+
+		return true;
 	}
 
-	NO_INLINE bool SolveRuleQuery(const Fact *query, int8 *resultCount, Fact *results)
+	// picks the most selective key for the query. returns first entry of its chain or -1.
+	int GetFirstEntry(const Fact *query, int *key) const
 	{
-#ifdef PRINT_FREE_MEM
-		PRINT("SolveRuleQuery Free Mem: ");
-		PRINT(freeMemory());
-		PRINT("\n");
-#endif
+		if (!query->isTerm1Var)
+			*key = KEY_TERM1;
+		else if ((query->termCount == 2) && (!query->isTerm2Var))
+			*key = KEY_TERM2;
+		else
+			*key = KEY_PREDICATE;
 
-		int8 matchingRulesCount;
-		const Rule *matchingRules[MAX_MATCHING_RULES];
-		this->FindMatchingRulesFromRulesList(query, &matchingRulesCount, matchingRules);
-
-		PRINT_BUFFER_USAGE(matchingRulesCount, MAX_MATCHING_RULES);
+		return buckets[(*key) * bucketCount + (FactIndex::GetKeyHash(*key, query) & (bucketCount - 1))];
+	}
 
-		if (matchingRulesCount)
+	int GetNextEntry(int entry, int key) const
+	{
+		return entries[entry].next[key];
+	}
+
+	const Fact* GetFact(int entry) const
+	{
+		return entries[entry].fact;
+	}
+};
+
+struct RuleIndexEntry
+{
+	const Rule *rule;
+	unsigned int term1Hash; // hashes of head terms. (used to skip rules before IsFactMatch)
+	unsigned int term2Hash;
+	int next; // next entry of the predicate chain. (-1 = end of chain)
+	int nextTerm1; // next entry of the same constant term1, or of variable term1 of the predicate. (-1 = end of chain)
+};
+
+// rule list partitioned by (predicate, termCount) of rule head. each chain keeps the order of the rule chain.
+// with SetTerm1Storage, rules are also chained by their constant term1, so a query with bound term1 visits
+// only the rules of that constant and the rules with variable term1. (rule3 likes(john , X) is not visited by likes(tom , X))
+class RuleIndex
+{
+protected:
+	RuleIndexEntry *entries;
+	int maxEntries;
+	int entryCount;
+	int *buckets;
+	unsigned int bucketCount; // power of two
+	int *term1Buckets; // constant term1 chains, followed by variable term1 chains
+	unsigned int term1BucketCount; // power of two
+
+	int* GetTerm1Head(const Fact *fact, bool isVariable) const
+	{
+		if (isVariable)
+			return &term1Buckets[term1BucketCount + (FactIndex::GetKeyHash(FactIndex::KEY_PREDICATE, fact) & (term1BucketCount - 1))];
+
+		return &term1Buckets[FactIndex::GetKeyHash(FactIndex::KEY_TERM1, fact) & (term1BucketCount - 1)];
+	}
+
+public:
+
+	// entries must have room for all rules. bucketCount must be a power of two. (use a value close to predicate count)
+	void SetStorage(RuleIndexEntry *entries, int maxEntries, int *buckets, unsigned int bucketCount)
+	{
+		this->entries = entries;
+		this->maxEntries = maxEntries;
+		this->entryCount = 0;
+		this->buckets = buckets;
+		this->bucketCount = bucketCount;
+		this->term1Buckets = 0;
+		this->term1BucketCount = 0;
+	}
+
+	// optional. call after SetStorage. buckets must have room for (2 * bucketCount) items.
+	// bucketCount must be a power of two. (use a value close to rule count)
+	void SetTerm1Storage(int *buckets, unsigned int bucketCount)
+	{
+		this->term1Buckets = buckets;
+		this->term1BucketCount = bucketCount;
+	}
+
+	// returns false if there is not enough entries for the rule chain.
+	bool Build(const Rule *firstRule)
+	{
+		entryCount = 0;
+
+		for (unsigned int i = 0; i < bucketCount; ++i)
+			buckets[i] = -1;
+
+		for (const Rule *rule = firstRule; rule; rule = rule->nextRule)
+		{
+			if (entryCount == maxEntries)
+				return false;
+
+			entries[entryCount].rule = rule;
+			entries[entryCount].term1Hash = SymbolTable::HashName(rule->head.term1Name);
+			entries[entryCount].term2Hash = (rule->head.termCount == 2) ? SymbolTable::HashName(rule->head.term2Name) : 0;
+			++entryCount;
+		}
+
+		for (int i = entryCount - 1; i >= 0; --i) // insert backwards to keep rule order in each chain
+		{
+			int *head = &buckets[FactIndex::GetKeyHash(FactIndex::KEY_PREDICATE, &entries[i].rule->head) & (bucketCount - 1)];
+			entries[i].next = *head;
+			*head = i;
+		}
+
+		if (term1Buckets)
+		{
+			for (unsigned int i = 0; i < (2 * term1BucketCount); ++i)
+				term1Buckets[i] = -1;
+
+			for (int i = entryCount - 1; i >= 0; --i)
+			{
+				int *head = this->GetTerm1Head(&entries[i].rule->head, entries[i].rule->head.isTerm1Var);
+				entries[i].nextTerm1 = *head;
+				*head = i;
+			}
+		}
+
+		return true;
+	}
+
+	bool HasTerm1Chains() const
+	{
+		return (term1Buckets != 0);
+	}
+
+	// returns first entry of the rules with the constant term1 of the query. (variableEntry is first rule with variable term1)
+	int GetFirstTerm1Entry(const Fact *query, int *variableEntry) const
+	{
+		*variableEntry = *this->GetTerm1Head(query, true);
+		return *this->GetTerm1Head(query, false);
+	}
+
+	int GetFirstEntry(const Fact *query) const
+	{
+		return buckets[FactIndex::GetKeyHash(FactIndex::KEY_PREDICATE, query) & (bucketCount - 1)];
+	}
+
+	const RuleIndexEntry* GetEntry(int entry) const
+	{
+		return &entries[entry];
+	}
+};
+
+struct PredicateStats
+{
+	const char *predicateName; // 0 if slot is empty
+	int8 termCount;
+	int factCount;
+	int distinctCount[2]; // distinct values of term1 and term2
+	int equalTermCount; // facts whose term1 and term2 are equal
+};
+
+// fact counts and distinct argument values of each (predicate, termCount). used by the rule body planner.
+// pass to HazeProlog::SetPredicateStatistics after the fact list is loaded.
+class PredicateStatistics
+{
+protected:
+	PredicateStats *entries; // open addressing table
+	unsigned int capacity; // power of two
+
+	static unsigned int GetPredicateHash(const char *predicateName, int8 termCount)
+	{
+		return SymbolTable::HashName(predicateName) + (unsigned int)termCount * 0x9e3779b9u;
+	}
+
+	PredicateStats* FindEntry(const char *predicateName, int8 termCount, bool insert)
+	{
+		unsigned int mask = capacity - 1;
+		unsigned int slot = PredicateStatistics::GetPredicateHash(predicateName, termCount) & mask;
+
+		for (unsigned int i = 0; i < capacity; ++i, slot = (slot + 1) & mask)
+		{
+			PredicateStats *entry = &entries[slot];
+
+			if (!entry->predicateName)
+			{
+				if (!insert)
+					return 0;
+
+				entry->predicateName = predicateName;
+				entry->termCount = termCount;
+				entry->factCount = 0;
+				entry->distinctCount[0] = 0;
+				entry->distinctCount[1] = 0;
+				entry->equalTermCount = 0;
+				return entry;
+			}
+
+			if ((entry->termCount == termCount) && SymbolTable::IsSameName(entry->predicateName, predicateName))
+				return entry;
+		}
+
+		return 0;
+	}
+
+public:
+
+	PredicateStatistics()
+	{
+		entries = 0;
+		capacity = 0;
+	}
+
+	// capacity must be a power of two larger than predicate count.
+	void SetStorage(PredicateStats *entries, unsigned int capacity)
+	{
+		this->entries = entries;
+		this->capacity = capacity;
+	}
+
+	// scratch is used to count distinct values. scratchCount must be a power of two larger than (2 * fact count).
+	// returns false if there is not enough storage.
+	bool Build(const Fact *firstFact, unsigned int *scratch, unsigned int scratchCount)
+	{
+		for (unsigned int i = 0; i < capacity; ++i)
+			entries[i].predicateName = 0;
+
+		for (unsigned int i = 0; i < scratchCount; ++i)
+			scratch[i] = 0;
+
+		unsigned int scratchUsed = 0;
+
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			PredicateStats *entry = this->FindEntry(fact->predicateName, fact->termCount, true);
+			if (!entry)
+				return false;
+
+			++entry->factCount;
+
+			if ((fact->termCount == 2) && SymbolTable::IsSameName(fact->term1Name, fact->term2Name))
+				++entry->equalTermCount;
+
+			for (int term = 0; term < fact->termCount; ++term)
+			{
+				// (entry, term, value) hash. (equal hashes of different values are counted once)
+				unsigned int hash = SymbolTable::HashName(term ? fact->term2Name : fact->term1Name);
+				hash = (hash ^ ((unsigned int)(entry - entries) * 2654435761u)) + (unsigned int)term * 0x85ebca6bu;
+				hash = hash ? hash : 1; // 0 marks empty slot
+
+				unsigned int mask = scratchCount - 1;
+				unsigned int slot = hash & mask;
+
+				while (scratch[slot] && (scratch[slot] != hash))
+					slot = (slot + 1) & mask;
+
+				if (scratch[slot] == 0)
+				{
+					if (++scratchUsed == scratchCount)
+						return false;
+
+					scratch[slot] = hash;
+					++entry->distinctCount[term];
+				}
+			}
+		}
+
+		return true;
+	}
+
+	const PredicateStats* Find(const char *predicateName, int8 termCount) const
+	{
+		return ((PredicateStatistics*)this)->FindEntry(predicateName, termCount, false);
+	}
+
+	// estimated number of facts which match the goal. returns 0 if there are no facts of the goal.
+	unsigned int EstimateMatches(const Fact *goal) const
+	{
+		const PredicateStats *entry = this->Find(goal->predicateName, goal->termCount);
+		if (!entry)
+			return 0;
+
+		unsigned int matches = (unsigned int)entry->factCount;
+
+		if (!goal->isTerm1Var)
+			matches /= (unsigned int)entry->distinctCount[0];
+
+		if ((goal->termCount == 2) && (!goal->isTerm2Var))
+			matches /= (unsigned int)entry->distinctCount[1];
+
+		return matches ? matches : 1;
+	}
+};
+
+// called for each solution of a query. return false to stop the search.
+typedef bool (*SolutionVisitor)(const Fact *solution, void *userData);
+
+enum SolveStatus
+{
+	SOLVE_NO_RESULTS = 0,
+	SOLVE_OK,
+	SOLVE_BUFFER_EXHAUSTED, // result buffer became full. (it contains the first solutions)
+	SOLVE_OUT_OF_MEMORY // query arena became full. (increase QUERY_ARENA_SIZE or arena storage)
+};
+
+// default size of the query arena which is used when HazeProlog has no arena. (allocated on stack for each query)
+#ifndef QUERY_ARENA_SIZE
+#ifdef Arduino_h
+#define QUERY_ARENA_SIZE 256
+#else
+#define QUERY_ARENA_SIZE 4096
+#endif
+#endif
+
+struct ArenaMark
+{
+	void *block;
+	size_t used;
+	size_t totalUsed;
+};
+
+// bump allocator for per-query scratch state. (rule copies, bindings, temporary facts)
+// memory is released in LIFO order with Mark/Release or all at once with Reset.
+// on PC builds the arena grows with additional blocks when the storage is full. blocks are kept for next queries.
+class QueryArena
+{
+protected:
+	struct ArenaBlock
+	{
+		ArenaBlock *next;
+		char *data;
+		size_t capacity;
+	};
+
+	ArenaBlock firstBlock;
+	ArenaBlock *currentBlock;
+	size_t used; // used bytes of current block
+	size_t totalUsed;
+	size_t peakUsage;
+
+public:
+
+	QueryArena()
+	{
+		firstBlock.next = 0;
+		this->SetStorage(0, 0);
+	}
+
+	QueryArena(void *buffer, size_t size)
+	{
+		firstBlock.next = 0;
+		this->SetStorage(buffer, size);
+	}
+
+#ifndef Arduino_h
+	~QueryArena()
+	{
+		this->FreeBlocks();
+	}
+
+	void FreeBlocks()
+	{
+		ArenaBlock *block = firstBlock.next;
+
+		while (block)
+		{
+			ArenaBlock *next = block->next;
+			::free(block);
+			block = next;
+		}
+
+		firstBlock.next = 0;
+	}
+#endif
+
+	void SetStorage(void *buffer, size_t size)
+	{
+#ifndef Arduino_h
+		this->FreeBlocks();
+#endif
+		firstBlock.next = 0;
+		firstBlock.data = (char*)buffer;
+		firstBlock.capacity = size;
+		currentBlock = &firstBlock;
+		used = 0;
+		totalUsed = 0;
+		peakUsage = 0;
+	}
+
+	// returns 0 if there is not enough memory.
+	void* Allocate(size_t size)
+	{
+		size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+		if ((currentBlock->capacity - used) < size)
+		{
+			ArenaBlock *block = currentBlock->next;
+
+			if ((!block) || (block->capacity < size))
+			{
+#ifdef Arduino_h
+				return 0;
+#else
+				size_t capacity = (currentBlock->capacity > size) ? (currentBlock->capacity * 2) : (size * 2);
+
+				if (capacity < QUERY_ARENA_SIZE)
+					capacity = QUERY_ARENA_SIZE;
+
+				block = (ArenaBlock*)::malloc(sizeof(ArenaBlock) + capacity);
+				if (!block)
+					return 0;
+
+				block->data = (char*)(block + 1);
+				block->capacity = capacity;
+				block->next = currentBlock->next;
+				currentBlock->next = block;
+#endif
+			}
+
+			currentBlock = block;
+			used = 0;
+		}
+
+		void *memory = currentBlock->data + used;
+		used += size;
+		totalUsed += size;
+
+		if (totalUsed > peakUsage)
+			peakUsage = totalUsed;
+
+		return memory;
+	}
+
+	ArenaMark Mark() const
+	{
+		ArenaMark mark;
+		mark.block = currentBlock;
+		mark.used = used;
+		mark.totalUsed = totalUsed;
+		return mark;
+	}
+
+	// frees everything allocated after the mark.
+	void Release(const ArenaMark &mark)
+	{
+		currentBlock = (ArenaBlock*)mark.block;
+		used = mark.used;
+		totalUsed = mark.totalUsed;
+	}
+
+	// frees everything. O(1)
+	void Reset()
+	{
+		currentBlock = &firstBlock;
+		used = 0;
+		totalUsed = 0;
+	}
+
+	// maximum bytes used since SetStorage.
+	size_t GetPeakUsage() const
+	{
+		return peakUsage;
+	}
+
+private:
+	QueryArena(const QueryArena&);
+	QueryArena& operator=(const QueryArena&);
+};
+
+#ifndef Arduino_h
+
+// growable result buffer for PC builds. memory is kept when cleared, so reusing it for next queries does not allocate.
+// results are allocated from a QueryArena if SetQueryArena is called, otherwise from the heap.
+class ResultVector
+{
+protected:
+	Fact *results;
+	rcount resultCount;
+	rcount capacity;
+	QueryArena *arena; // 0 if results are allocated with realloc
+
+public:
+
+	ResultVector()
+	{
+		results = 0;
+		resultCount = 0;
+		capacity = 0;
+		arena = 0;
+	}
+
+	~ResultVector()
+	{
+		if (!arena)
+			::free(results);
+	}
+
+	// results are removed. when the buffer grows, previous buffer stays in the arena until the arena is released or reset.
+	// (do not pass the arena of HazeProlog, its query memory is released after each query)
+	void SetQueryArena(QueryArena *arena)
+	{
+		if (!this->arena)
+			::free(results);
+
+		this->arena = arena;
+		results = 0;
+		resultCount = 0;
+		capacity = 0;
+	}
+
+	// returns false if memory allocation fails.
+	bool Add(const Fact *result)
+	{
+		if (resultCount == capacity)
+		{
+			rcount newCapacity = capacity ? (capacity * 2) : 16;
+			Fact *newResults;
+
+			if (arena)
+			{
+				newResults = (Fact*)arena->Allocate(sizeof(Fact) * newCapacity);
+
+				if (newResults && results)
+					::memcpy(newResults, results, sizeof(Fact) * resultCount);
+			}
+			else
+			{
+				newResults = (Fact*)::realloc(results, sizeof(Fact) * newCapacity);
+			}
+
+			if (!newResults)
+				return false;
+
+			results = newResults;
+			capacity = newCapacity;
+		}
+
+		results[resultCount] = *result;
+		++resultCount;
+
+		return true;
+	}
+
+	void Clear()
+	{
+		resultCount = 0;
+	}
+
+	rcount GetCount() const
+	{
+		return resultCount;
+	}
+
+	const Fact* GetResult(rcount index) const
+	{
+		return &results[index];
+	}
+
+private:
+	ResultVector(const ResultVector&);
+	ResultVector& operator=(const ResultVector&);
+};
+
+#endif
+
+// called for each fact which matches a query. return false to stop the search.
+typedef bool (*FactVisitor)(const Fact *fact, void *userData);
+
+// fact storage which is not a Fact chain. (precompiled images, columnar tables, dynamic facts, ...)
+class FactSource
+{
+public:
+	virtual ~FactSource() {}
+
+	// calls visitor for each fact which matches the query. (same rules as HazeProlog::IsFactMatch)
+	// returns false if visitor stopped the search.
+	virtual bool VisitMatchingFacts(const Fact *query, FactVisitor visitor, void *userData) const = 0;
+
+	// changes when facts of the source are changed. (cached query results are dropped)
+	virtual unsigned int GetVersion() const
+	{
+		return 0;
+	}
+};
+
+struct AnswerTableEntry
+{
+	Fact goal; // goal variant. (variable names are only used for the variable pattern)
+	int firstAnswer; // answers in the order they were found
+	int lastAnswer;
+	int answerCount;
+	int8 state;
+	bool isPending; // in pending list
+
+	// evaluation state
+	int depth; // position in evaluation stack
+	int leaderDepth; // lowest evaluating goal which this goal consumed answers from
+	int leaderEntry;
+	int parent; // evaluating goal which called this goal
+	int pendingMark; // head of pending list when evaluation started
+	int nextPending;
+
+	int next; // next entry of the bucket
+};
+
+struct TableAnswer
+{
+	Fact answer;
+	int entry;
+	int nextAnswer; // next answer of the goal
+	int next; // next answer of the bucket
+};
+
+// answers of solved goals (tabling). pass to HazeProlog::SetAnswerTable.
+// goals are keyed by predicate, bound terms and variable pattern. a complete goal is answered from the table.
+// a goal which calls itself (directly or through other goals) reads the answers found so far,
+// and the first goal of such a cycle is solved again until no new answers are found.
+// answers of a goal are unique. names of goals and answers must outlive the table.
+class AnswerTable
+{
+protected:
+	AnswerTableEntry *entries;
+	int maxEntries;
+	int entryCount;
+	TableAnswer *answers;
+	int maxAnswers;
+	int answerCount;
+	int *buckets; // 2 * bucketCount chain heads. (goals, answers)
+	unsigned int bucketCount; // power of two
+	bool persistent;
+
+	int currentEntry; // goal which is being evaluated
+	int depth;
+	int pendingEntry; // goals which wait for their leader to complete
+	unsigned int recursionCount;
+	int queryDepth; // queries which are started from visitors of other queries
+
+	// a result of a goal with N variables holds their values in its first N terms. other terms depend on the
+	// rule or fact which gave the result, so they are not compared.
+	static int8 GetValueCount(const Fact *goal)
+	{
+		return (int8)((goal->isTerm1Var ? 1 : 0) + (((goal->termCount == 2) && goal->isTerm2Var) ? 1 : 0));
+	}
+
+	static unsigned int GetAnswerHash(int entry, const Fact *answer, int8 valueCount)
+	{
+		unsigned int hash = (unsigned int)entry * 2654435761u;
+
+		if (valueCount >= 1)
+			hash ^= SymbolTable::HashName(answer->term1Name);
+
+		if (valueCount == 2)
+			hash = (hash * 16777619u) ^ SymbolTable::HashName(answer->term2Name);
+
+		return hash;
+	}
+
+	unsigned int GetAnswerHash(const TableAnswer *answer) const
+	{
+		return AnswerTable::GetAnswerHash(answer->entry, &answer->answer, AnswerTable::GetValueCount(&entries[answer->entry].goal));
+	}
+
+public:
+
+	enum { GOAL_NEW = 0, GOAL_EVALUATING, GOAL_INCOMPLETE, GOAL_PENDING, GOAL_COMPLETE };
+
+	// (also used by QueryCache)
+	static unsigned int GetGoalHash(const Fact *goal)
+	{
+		unsigned int hash = SymbolTable::HashName(goal->predicateName) + (unsigned int)goal->termCount;
+
+		if (goal->isTerm1Var)
+			hash = hash * 31u + 1u;
+		else
+			hash = (hash ^ SymbolTable::HashName(goal->term1Name)) * 16777619u;
+
+		if (goal->termCount == 2)
+		{
+			if (!goal->isTerm2Var)
+				hash = (hash ^ SymbolTable::HashName(goal->term2Name)) * 2654435761u;
+			else if (goal->isTerm1Var && SymbolTable::IsSameName(goal->term1Name, goal->term2Name)) // pred(X , X)
+				hash = hash * 31u + 2u;
+			else
+				hash = hash * 31u + 3u;
+		}
+
+		return hash;
+	}
+
+	static bool IsSameGoal(const Fact *goal1, const Fact *goal2)
+	{
+		if ((goal1->termCount != goal2->termCount) || (goal1->isTerm1Var != goal2->isTerm1Var)
+			|| (!SymbolTable::IsSameName(goal1->predicateName, goal2->predicateName)))
+			return false;
+
+		if ((!goal1->isTerm1Var) && (!SymbolTable::IsSameName(goal1->term1Name, goal2->term1Name)))
+			return false;
+
+		if (goal1->termCount != 2)
+			return true;
+
+		if (goal1->isTerm2Var != goal2->isTerm2Var)
+			return false;
+
+		if (!goal1->isTerm2Var)
+			return SymbolTable::IsSameName(goal1->term2Name, goal2->term2Name);
+
+		if (goal1->isTerm1Var) // variable pattern
+			return SymbolTable::IsSameName(goal1->term1Name, goal1->term2Name) == SymbolTable::IsSameName(goal2->term1Name, goal2->term2Name);
+
+		return true;
+	}
+
+
+	AnswerTable()
+	{
+		entries = 0;
+		answers = 0;
+		buckets = 0;
+		maxEntries = 0;
+		maxAnswers = 0;
+		bucketCount = 0;
+		persistent = false;
+
+		entryCount = 0;
+		answerCount = 0;
+		currentEntry = -1;
+		depth = 0;
+		pendingEntry = -1;
+		recursionCount = 0;
+		queryDepth = 0;
+	}
+
+	// buckets must have room for (2 * bucketCount) items. bucketCount must be a power of two.
+	void SetStorage(AnswerTableEntry *entries, int maxEntries, TableAnswer *answers, int maxAnswers, int *buckets, unsigned int bucketCount)
+	{
+		this->entries = entries;
+		this->maxEntries = maxEntries;
+		this->answers = answers;
+		this->maxAnswers = maxAnswers;
+		this->buckets = buckets;
+		this->bucketCount = bucketCount;
+
+		for (unsigned int i = 0; i < (2 * bucketCount); ++i)
+			buckets[i] = -1;
+
+		entryCount = 0;
+		answerCount = 0;
+		queryDepth = 0;
+		this->Clear();
+	}
+
+	// keep answers for next queries. (call Clear when facts or rules are changed)
+	void SetPersistent(bool persistent)
+	{
+		this->persistent = persistent;
+	}
+
+	// O(used entries). (only used buckets are cleared, nothing to clear before SetStorage)
+	void Clear()
+	{
+		if ((!entries) || (!buckets))
+			return;
+
+		for (int i = 0; i < entryCount; ++i)
+			buckets[AnswerTable::GetGoalHash(&entries[i].goal) & (bucketCount - 1)] = -1;
+
+		for (int i = 0; i < answerCount; ++i)
+			buckets[bucketCount + (this->GetAnswerHash(&answers[i]) & (bucketCount - 1))] = -1;
+
+		entryCount = 0;
+		answerCount = 0;
+
+		currentEntry = -1;
+		depth = 0;
+		pendingEntry = -1;
+		recursionCount = 0;
+	}
+
+	// called at start of each query. (a query of a visitor uses the goals of the outer query, so only the outermost query starts again)
+	void BeginQuery()
+	{
+		if (queryDepth++ != 0)
+			return;
+
+		if (!persistent)
+		{
+			this->Clear();
+			return;
+		}
+
+		// goals of a stopped query are not complete
+		for (; pendingEntry != -1; pendingEntry = entries[pendingEntry].nextPending)
+		{
+			entries[pendingEntry].state = GOAL_INCOMPLETE;
+			entries[pendingEntry].isPending = false;
+		}
+
+		currentEntry = -1;
+		depth = 0;
+	}
+
+	// called at end of each query.
+	void EndQuery()
+	{
+		--queryDepth;
+	}
+
+	// returns -1 if table is full.
+	int FindGoal(const Fact *goal)
+	{
+		int *head = &buckets[AnswerTable::GetGoalHash(goal) & (bucketCount - 1)];
+
+		for (int entry = *head; entry != -1; entry = entries[entry].next)
+		{
+			if (AnswerTable::IsSameGoal(&entries[entry].goal, goal))
+				return entry;
+		}
+
+		if (entryCount == maxEntries)
+			return -1;
+
+		AnswerTableEntry *newEntry = &entries[entryCount];
+		newEntry->goal = *goal;
+		newEntry->goal.nextFact = 0;
+		newEntry->firstAnswer = -1;
+		newEntry->lastAnswer = -1;
+		newEntry->answerCount = 0;
+		newEntry->state = GOAL_NEW;
+		newEntry->isPending = false;
+		newEntry->next = *head;
+		*head = entryCount;
+
+		return entryCount++;
+	}
+
+	const AnswerTableEntry* GetEntry(int entry) const
+	{
+		return &entries[entry];
+	}
+
+	const TableAnswer* GetAnswer(int answer) const
+	{
+		return &answers[answer];
+	}
+
+	// returns 1 if answer is added, 0 if goal already has the answer or -1 if table is full.
+	// (answers are compared by the values of goal variables)
+	int AddAnswer(int entry, const Fact *answer)
+	{
+		int8 valueCount = AnswerTable::GetValueCount(&entries[entry].goal);
+		int *head = &buckets[bucketCount + (AnswerTable::GetAnswerHash(entry, answer, valueCount) & (bucketCount - 1))];
+
+		for (int index = *head; index != -1; index = answers[index].next)
+		{
+			const Fact *other = &answers[index].answer;
+
+			if ((answers[index].entry == entry)
+				&& ((valueCount < 1) || SymbolTable::IsSameName(other->term1Name, answer->term1Name))
+				&& ((valueCount < 2) || SymbolTable::IsSameName(other->term2Name, answer->term2Name)))
+				return 0;
+		}
+
+		if (answerCount == maxAnswers)
+			return -1;
+
+		TableAnswer *newAnswer = &answers[answerCount];
+		newAnswer->answer = *answer;
+		newAnswer->answer.nextFact = 0;
+		newAnswer->entry = entry;
+		newAnswer->nextAnswer = -1;
+		newAnswer->next = *head;
+		*head = answerCount;
+
+		AnswerTableEntry *goal = &entries[entry];
+		if (goal->lastAnswer == -1)
+			goal->firstAnswer = answerCount;
+		else
+			answers[goal->lastAnswer].nextAnswer = answerCount;
+
+		goal->lastAnswer = answerCount;
+		++goal->answerCount;
+		++answerCount;
+
+		return 1;
+	}
+
+	int GetAnswerCount() const
+	{
+		return answerCount;
+	}
+
+	unsigned int GetRecursionCount() const
+	{
+		return recursionCount;
+	}
+
+	void EnterGoal(int entry)
+	{
+		AnswerTableEntry *goal = &entries[entry];
+		goal->state = GOAL_EVALUATING;
+		goal->depth = ++depth;
+		goal->leaderDepth = goal->depth;
+		goal->leaderEntry = entry;
+		goal->parent = currentEntry;
+		goal->pendingMark = pendingEntry;
+		currentEntry = entry;
+	}
+
+	// goal is called while it is being evaluated or while it waits for its leader. caller depends on it.
+	void OnRecursiveCall(int entry)
+	{
+		++recursionCount;
+
+		int leader = entry;
+		while (entries[leader].state == GOAL_PENDING) // its leader is still being evaluated
+			leader = entries[leader].leaderEntry;
+
+		if (entries[leader].state != GOAL_EVALUATING)
+			return;
+
+		AnswerTableEntry *caller = &entries[currentEntry];
+		if (entries[leader].depth < caller->leaderDepth)
+		{
+			caller->leaderDepth = entries[leader].depth;
+			caller->leaderEntry = leader;
+		}
+	}
+
+	// goals which wait for the leader are solved again in next pass of the leader. (once in each pass)
+	// they leave the pending list, so a goal which is solved again under another leader is added after the mark of that leader.
+	void BeginNextPass(int entry)
+	{
+		for (; (pendingEntry != -1) && (pendingEntry != entries[entry].pendingMark); pendingEntry = entries[pendingEntry].nextPending)
+		{
+			entries[pendingEntry].state = GOAL_INCOMPLETE;
+			entries[pendingEntry].isPending = false;
+		}
+	}
+
+	// goal does not depend on a goal which is still being evaluated. (solve again if new answers were found)
+	bool IsLeader(int entry) const
+	{
+		return (entries[entry].leaderDepth >= entries[entry].depth);
+	}
+
+	void LeaveGoal(int entry, bool stopped)
+	{
+		AnswerTableEntry *goal = &entries[entry];
+		currentEntry = goal->parent;
+		--depth;
+
+		if (stopped)
+		{
+			goal->state = GOAL_INCOMPLETE;
+			return;
+		}
+
+		if (goal->leaderDepth >= goal->depth) // complete with the goals which depend on it
+		{
+			goal->state = GOAL_COMPLETE;
+
+			for (; (pendingEntry != -1) && (pendingEntry != goal->pendingMark); pendingEntry = entries[pendingEntry].nextPending)
+			{
+				entries[pendingEntry].state = GOAL_COMPLETE;
+				entries[pendingEntry].isPending = false;
+			}
+
+			return;
+		}
+
+		goal->state = GOAL_PENDING;
+
+		if (!goal->isPending)
+		{
+			goal->isPending = true;
+			goal->nextPending = pendingEntry;
+			pendingEntry = entry;
+		}
+
+		if ((currentEntry != -1) && (goal->leaderDepth < entries[currentEntry].leaderDepth))
+		{
+			entries[currentEntry].leaderDepth = goal->leaderDepth;
+			entries[currentEntry].leaderEntry = goal->leaderEntry;
+		}
+	}
+};
+
+struct QueryCacheEntry
+{
+	Fact query; // normalized query. (names are copied unless INTERNED_SYMBOLS is defined)
+	int firstResult;
+	int resultCount;
+	bool hasResults;
+	int next; // next entry of the bucket
+};
+
+// results of top level queries in solution order. pass to HazeProlog::SetQueryCache.
+// queries are keyed by predicate, bound terms and variable pattern. cached results are dropped when
+// HazeProlog knowledge base changes. (SetRuleFactDefinitions, SetFactSource, InvalidateResults, FactSource version...)
+// cache is cleared when it becomes full. use hit/miss/eviction counts to size the storage.
+class QueryCache
+{
+protected:
+	QueryCacheEntry *entries;
+	int maxEntries;
+	int entryCount;
+	Fact *results;
+	int maxResults;
+	int resultCount;
+	int *buckets;
+	unsigned int bucketCount; // power of two
+	char *names;
+	int nameCapacity;
+	int nameSize;
+
+	unsigned int generation; // HazeProlog generation of cached results
+	unsigned int sourceVersion; // FactSource version of cached results
+	bool hasGeneration;
+
+	// query which is being solved
+	bool isPending;
+	int pendingCount;
+	bool pendingFailed;
+
+	unsigned long hitCount;
+	unsigned long missCount;
+	unsigned long evictionCount;
+
+	const char* CopyName(const char *name)
+	{
+#ifdef INTERNED_SYMBOLS
+		return name; // canonical names outlive queries
+#else
+		int size = (int)::strlen(name) + 1;
+
+		if ((nameSize + size) > nameCapacity)
+			return 0;
+
+		char *copy = names + nameSize;
+		::memcpy(copy, name, size);
+		nameSize += size;
+
+		return copy;
+#endif
+	}
+
+	static void RebaseName(const char **name, const Fact *query, const Fact *cachedQuery)
+	{
+		if (*name == query->predicateName)
+			*name = cachedQuery->predicateName;
+		else if (*name == query->term1Name)
+			*name = cachedQuery->term1Name;
+		else if ((query->termCount == 2) && (*name == query->term2Name))
+			*name = cachedQuery->term2Name;
+	}
+
+public:
+
+	QueryCache()
+	{
+		entries = 0;
+		maxEntries = 0;
+		results = 0;
+		maxResults = 0;
+		buckets = 0;
+		bucketCount = 0;
+		names = 0;
+		nameCapacity = 0;
+		entryCount = 0;
+		resultCount = 0;
+		nameSize = 0;
+		hasGeneration = false;
+		isPending = false;
+		pendingCount = 0;
+		pendingFailed = false;
+		this->ResetCounters();
+	}
+
+	// bucketCount must be a power of two. names stores query names. (not used if INTERNED_SYMBOLS is defined)
+	void SetStorage(QueryCacheEntry *entries, int maxEntries, Fact *results, int maxResults, int *buckets, unsigned int bucketCount,
+		char *names, int nameCapacity)
+	{
+		this->entries = entries;
+		this->maxEntries = maxEntries;
+		this->results = results;
+		this->maxResults = maxResults;
+		this->buckets = buckets;
+		this->bucketCount = bucketCount;
+		this->names = names;
+		this->nameCapacity = nameCapacity;
+		this->Clear();
+	}
+
+	void Clear()
+	{
+		entryCount = 0;
+		resultCount = 0;
+		nameSize = 0;
+
+		for (unsigned int i = 0; i < bucketCount; ++i)
+			buckets[i] = -1;
+	}
+
+	// drops results of an older knowledge base.
+	void SetGeneration(unsigned int generation, unsigned int sourceVersion)
+	{
+		if (hasGeneration && (this->generation == generation) && (this->sourceVersion == sourceVersion))
+			return;
+
+		this->Clear();
+		this->generation = generation;
+		this->sourceVersion = sourceVersion;
+		hasGeneration = true;
+	}
+
+	// returns -1 if query is not cached. counts a hit or a miss.
+	int Find(const Fact *query)
+	{
+		for (int entry = buckets[AnswerTable::GetGoalHash(query) & (bucketCount - 1)]; entry != -1; entry = entries[entry].next)
+		{
+			if (AnswerTable::IsSameGoal(&entries[entry].query, query))
+			{
+				++hitCount;
+				return entry;
+			}
+		}
+
+		++missCount;
+		return -1;
+	}
+
+	const QueryCacheEntry* GetEntry(int entry) const
+	{
+		return &entries[entry];
+	}
+
+	const Fact* GetResult(int result) const
+	{
+		return &results[result];
+	}
+
+	// results of a new query are added after BeginInsert.
+	// returns false if results of another query are being added or replayed. (queries of visitors are not cached)
+	bool BeginInsert()
+	{
+		if (isPending)
+			return false;
+
+		isPending = true;
+		pendingCount = 0;
+		pendingFailed = false;
+		return true;
+	}
+
+	// returns false if cache has no room for the result.
+	bool AddResult(const Fact *result)
+	{
+		if (pendingFailed || ((resultCount + pendingCount) == maxResults))
+		{
+			pendingFailed = true;
+			return false;
+		}
+
+		Fact *copy = &results[resultCount + pendingCount];
+		*copy = *result;
+		copy->nextFact = 0;
+		++pendingCount;
+
+		return true;
+	}
+
+	// keeps the results added after BeginInsert. cache is cleared if it is full, so next queries have room.
+	void EndInsert(const Fact *query, bool hasResults)
+	{
+		isPending = false;
+		QueryCacheEntry *entry = (entryCount < maxEntries) ? &entries[entryCount] : 0;
+
+		if (entry && (!pendingFailed))
+		{
+			int savedNameSize = nameSize;
+
+			entry->query = *query;
+			entry->query.nextFact = 0;
+			entry->query.predicateName = this->CopyName(query->predicateName);
+			entry->query.term1Name = this->CopyName(query->term1Name);
+			entry->query.term2Name = (query->termCount == 2) ? this->CopyName(query->term2Name) : ""; // term2 of one-term queries is not used
+
+			if (entry->query.predicateName && entry->query.term1Name && entry->query.term2Name)
+			{
+				for (int i = resultCount; i < (resultCount + pendingCount); ++i) // results can point to names of query
+				{
+					this->RebaseName(&results[i].predicateName, query, &entry->query);
+					this->RebaseName(&results[i].term1Name, query, &entry->query);
+					this->RebaseName(&results[i].term2Name, query, &entry->query);
+				}
+
+				int *head = &buckets[AnswerTable::GetGoalHash(query) & (bucketCount - 1)];
+
+				entry->firstResult = resultCount;
+				entry->resultCount = pendingCount;
+				entry->hasResults = hasResults;
+				entry->next = *head;
+				*head = entryCount;
+
+				++entryCount;
+				resultCount += pendingCount;
+				pendingCount = 0;
+				return;
+			}
+
+			nameSize = savedNameSize;
+		}
+
+		pendingCount = 0;
+
+		if (entryCount != 0) // make room
+		{
+			this->Clear();
+			++evictionCount;
+		}
+	}
+
+	void CancelInsert()
+	{
+		isPending = false;
+		pendingCount = 0;
+	}
+
+	unsigned long GetHitCount() const
+	{
+		return hitCount;
+	}
+
+	unsigned long GetMissCount() const
+	{
+		return missCount;
+	}
+
+	// number of times the cache was cleared because it was full.
+	unsigned long GetEvictionCount() const
+	{
+		return evictionCount;
+	}
+
+	int GetEntryCount() const
+	{
+		return entryCount;
+	}
+
+	int GetResultCount() const
+	{
+		return resultCount;
+	}
+
+	void ResetCounters()
+	{
+		hitCount = 0;
+		missCount = 0;
+		evictionCount = 0;
+	}
+};
+
+// per-query state of the solver.
+#ifdef ENABLE_PARALLEL_RULES
+
+typedef void (*QueryTaskFunction)(void *userData, QueryArena *arena);
+
+struct QueryTask
+{
+	QueryTaskFunction function;
+	void *userData;
+	bool isDone;
+};
+
+// threads which solve branches of a query in parallel. pass to HazeProlog::SetParallelRules.
+// a task is only given to an idle thread, otherwise the caller solves it. (nested tasks cannot wait for each other)
+// each thread has its own query arena which is reset after each task.
+class QueryTaskPool
+{
+protected:
+	struct Worker
+	{
+		std::thread thread;
+		std::vector<void*> buffer; // aligned storage
+		QueryArena arena;
+		QueryTask *task; // 0 if idle
+	};
+
+	std::vector<Worker*> workers;
+	std::vector<Worker*> idleWorkers;
+	std::mutex mutex;
+	std::condition_variable taskCondition;
+	std::condition_variable doneCondition;
+	bool stopping;
+	unsigned long startCount;
+
+	void ThreadMain(Worker *worker)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		for (;;)
+		{
+			taskCondition.wait(lock, [&] { return stopping || worker->task; });
+
+			if (stopping)
+				return;
+
+			QueryTask *task = worker->task;
+
+			lock.unlock();
+			task->function(task->userData, &worker->arena);
+			worker->arena.Reset();
+			lock.lock();
+
+			task->isDone = true;
+			worker->task = 0;
+			idleWorkers.push_back(worker);
+			doneCondition.notify_all();
+		}
+	}
+
+public:
+
+	QueryTaskPool()
+	{
+		stopping = false;
+		startCount = 0;
+	}
+
+	~QueryTaskPool()
+	{
+		this->Stop();
+	}
+
+	// arenaSize is the query arena size of each thread. returns false if threads cannot be created.
+	bool Start(int threadCount, size_t arenaSize)
+	{
+		this->Stop();
+
+		try
+		{
+			for (int i = 0; i < threadCount; ++i)
+			{
+				Worker *worker = new Worker;
+				worker->buffer.resize((arenaSize + sizeof(void*) - 1) / sizeof(void*));
+				worker->arena.SetStorage(&worker->buffer[0], worker->buffer.size() * sizeof(void*));
+				worker->task = 0;
+				workers.push_back(worker);
+
+				worker->thread = std::thread(&QueryTaskPool::ThreadMain, this, worker);
+				idleWorkers.push_back(worker);
+			}
+		}
+		catch (const std::system_error&)
+		{
+			this->Stop();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		taskCondition.notify_all();
+
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			if (workers[i]->thread.joinable())
+				workers[i]->thread.join();
+
+			delete workers[i];
+		}
+
+		workers.clear();
+		idleWorkers.clear();
+		stopping = false;
+	}
+
+	// starts the task on an idle thread. returns false if all threads are busy.
+	bool TryStart(QueryTask *task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (idleWorkers.empty())
+			return false;
+
+		Worker *worker = idleWorkers.back();
+		idleWorkers.pop_back();
+
+		task->isDone = false;
+		worker->task = task;
+		++startCount;
+		taskCondition.notify_all();
+
+		return true;
+	}
+
+	void Wait(QueryTask *task)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [&] { return task->isDone; });
+	}
+
+	// number of tasks which were given to pool threads. (use to tune minParallelCost)
+	unsigned long GetStartCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return startCount;
+	}
+
+private:
+	QueryTaskPool(const QueryTaskPool&);
+	QueryTaskPool& operator=(const QueryTaskPool&);
+};
+
+#endif
+
+// mutable state of the queries of one thread. pass to HazeProlog::VisitSolutions.
+// a HazeProlog can be queried from many threads at the same time if each thread has its own session.
+struct QuerySession
+{
+	QueryArena *arena; // 0 to use a QUERY_ARENA_SIZE buffer on stack
+	AnswerTable *answerTable; // 0 if goals are not tabled
+	QueryCache *queryCache; // 0 if results are not cached
+};
+
+#ifndef NO_RECURSIVE_RULES
+// rule whose body is being solved by a query. a locked rule does not match goals of its own body.
+struct RuleLock
+{
+	const Rule *rule;
+	bool isLocked; // released while the caller uses a result of the rule
+	const RuleLock *next; // lock of the outer rule
+};
+#endif
+
+struct QueryContext
+{
+	bool stopped; // visitor requested to stop the search
+	bool outOfMemory; // query arena became full
+	QueryArena *arena;
+	AnswerTable *table; // 0 if goals are not tabled
+#ifndef NO_RECURSIVE_RULES
+	const RuleLock *lockedRules; // innermost first. (rules stay immutable, so they can be shared between threads)
+#endif
+};
+
+// position of a fact search. (fact list node or FactIndex entry)
+struct FactCursor
+{
+	const Fact *nextFact;
+	int nextEntry;
+	int key;
+};
+
+// position of a rule search. (rule list node or RuleIndex entry)
+struct RuleCursor
+{
+	const Rule *nextRule;
+	int nextEntry;
+	int nextVariableEntry; // rules with variable term1. (-1 if term1 chains are not used)
+	bool useTerm1Chains;
+	bool term1Bound;
+	bool term2Bound;
+	unsigned int term1Hash;
+	unsigned int term2Hash;
+#ifndef NO_RECURSIVE_RULES
+	const RuleLock *lockedRules;
+#endif
+};
+
+class HazeProlog
+{
+protected:
+	// state of a rule being solved. (allocated from query arena)
+	struct JoinEntry
+	{
+		const Fact *fact;
+		int next; // next entry of the bucket. (-1 = end of chain)
+	};
+
+	struct RuleFrame
+	{
+		const HazeProlog *prolog;
+		const Rule *matchingRule;
+		Rule queringRule;
+		SolutionVisitor visitor;
+		void *userData;
+		QueryContext *context;
+#ifndef NO_RECURSIVE_RULES
+		RuleLock lock;
+#endif
+
+		// AND rule state
+		bool isFact2Result; // fact2 results are passed as rule results
+		bool hasResults2;
+		const Fact *fact1Result;
+		Fact queringFact;
+		Fact joinResult;
+
+		// hash table of fact2 facts on the variable which is bound by fact1 results. (0 if fact2 is solved for each fact1 result)
+		JoinEntry *joinEntries;
+		int *joinBuckets;
+		unsigned int joinBucketMask;
+		int8 joinColumn; // 1 or 2
+		bool isJoinDeferred; // table is built when fact1 gives its first result
+	};
+
+	struct FactFrame
+	{
+		const Fact *query;
+		SolutionVisitor visitor;
+		void *userData;
+		QueryContext *context;
+		Fact *result;
+		bool hasResults;
+	};
+
+#ifdef ENABLE_PARALLEL_RULES
+	// alternative rule or OR goal which can be solved by a QueryTaskPool thread.
+	struct BranchTask
+	{
+		const HazeProlog *prolog;
+		const Fact *query;
+		const Rule *rule; // 0 if query is solved as a goal
+#ifndef NO_RECURSIVE_RULES
+		const RuleLock *lockedRules; // copy of the caller locks
+#endif
+		std::atomic<bool> *cancelled;
+		QueryTask task;
+		bool isStarted; // given to a pool thread
+
+		// results of the pool thread
+		ResultVector results;
+		bool found;
+		bool outOfMemory;
+	};
+#endif
+
+	struct TableFrame
+	{
+		SolutionVisitor visitor;
+		void *userData;
+		QueryContext *context;
+		int entry;
+	};
+
+	struct UserFrame
+	{
+		SolutionVisitor visitor;
+		void *userData;
+		QueryCache *cache; // 0 if results are not cached
+		QueryContext context;
+	};
+
+	struct ResultCollector
+	{
+		rcount *resultCount;
+		Fact *results;
+		rcount maxResults;
+		bool exhausted;
+	};
+
+#ifndef Arduino_h
+	struct ResultVectorCollector
+	{
+		ResultVector *results;
+		bool exhausted;
+	};
+#endif
+
+
+	const Rule *firstRule;
+	const Fact *firstFact;
+	const FactIndex *factIndex;
+	const RuleIndex *ruleIndex;
+	QueryArena *queryArena;
+	const FactSource *factSource;
+	const PredicateStatistics *statistics;
+	AnswerTable *answerTable;
+	QueryCache *queryCache;
+#ifdef ENABLE_PARALLEL_RULES
+	QueryTaskPool *taskPool;
+	unsigned int minParallelCost;
+	unsigned int factCount; // facts of the fact list. (branch cost without statistics)
+#endif
+	unsigned int generation; // changed with the knowledge base. (invalidates QueryCache)
+#if defined(ENABLE_SERIAL_PARSER) && defined(INTERNED_SYMBOLS)
+	const SymbolTable *symbols; // interns names of serial queries
+#endif
+
+public:
+
+	HazeProlog()
+	{
+		firstRule = 0;
+		firstFact = 0;
+		factIndex = 0;
+		ruleIndex = 0;
+		queryArena = 0;
+		factSource = 0;
+		statistics = 0;
+		answerTable = 0;
+		queryCache = 0;
+#ifdef ENABLE_PARALLEL_RULES
+		taskPool = 0;
+		minParallelCost = 0;
+		factCount = 0;
+#endif
+		generation = 0;
+#if defined(ENABLE_SERIAL_PARSER) && defined(INTERNED_SYMBOLS)
+		symbols = 0;
+#endif
+	}
+
+	void SetRuleFactDefinitions(const Rule *firstRule, const Fact *firstFact)
+	{
+		this->firstFact = firstFact;
+		this->firstRule = firstRule;
+		this->factIndex = 0;
+		this->ruleIndex = 0;
+		++generation;
+
+#ifdef ENABLE_PARALLEL_RULES
+		factCount = 0;
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+			++factCount;
+#endif
+	}
+
+	// builds factIndex from the fact chain. fact lookups will use the index.
+	bool SetRuleFactDefinitions(const Rule *firstRule, const Fact *firstFact, FactIndex *factIndex)
+	{
+		return this->SetRuleFactDefinitions(firstRule, firstFact, factIndex, 0);
+	}
+
+	// builds given indexes from the fact/rule chains. (pass 0 to skip an index)
+	bool SetRuleFactDefinitions(const Rule *firstRule, const Fact *firstFact, FactIndex *factIndex, RuleIndex *ruleIndex)
+	{
+		this->SetRuleFactDefinitions(firstRule, firstFact);
+
+		if (factIndex)
+		{
+			if (!factIndex->Build(firstFact))
+				return false;
+
+			this->factIndex = factIndex;
+		}
+
+		if (ruleIndex)
+		{
+			if (!ruleIndex->Build(firstRule))
+				return false;
+
+			this->ruleIndex = ruleIndex;
+		}
+
+		return true;
+	}
+
+	static bool StringCompare(const char *str1, const char* str2)
+	{
+#ifdef INTERNED_SYMBOLS
+		return (str1 == str2); // names are canonical pointers of SymbolTable
+#else
+		return (::strcmp(str1, str2) == 0); // replace this line according to your system!
+#endif
+	}
+
+	static bool IsCapitalLetter(const char x)
+	{
+		return ( (x >= 'A') && (x <= 'Z') );
+	}
+
+	static bool IsVariable(const char *text)
+	{
+		return HazeProlog::IsCapitalLetter(text[0]);
+	}
+
+	static void FixVariableFlags(Fact *fact)
+	{
+		fact->isTerm1Var = HazeProlog::IsVariable(fact->term1Name);
+
+		if (fact->termCount == 2)
+			fact->isTerm2Var = HazeProlog::IsVariable(fact->term2Name);
+	}
+
+	static void CopyFact(Fact *output, const Fact *input)
+	{
+		*output = *input;
+		/*output->termCount = input->termCount;
+		output->predicateName = input->predicateName;
+		output->isTerm1Var = input->isTerm1Var;
+		output->term1Name = input->term1Name;
+		output->isTerm2Var = input->isTerm2Var;
+		output->term2Name = input->term2Name;
+		output->nextFact = input->nextFact;*/
+	}
+
+	static void CopyRule(const Rule *input, Rule *output)
+	{
+		*output = *input;
+		/*CopyFact(&output->head, &input->head);
+		output->factCountInBody = input->factCountInBody;
+		CopyFact(&output->fact1, &input->fact1);
+		output->op1IsAnd = input->op1IsAnd;
+		CopyFact(&output->fact2, &input->fact2);
+		output->nextRule = input->nextRule;*/
+	}
+
+	static char GetVariableCountOfQuery(const Fact *query)
+	{
+		int8 varCount = 0;
+
+		if (query->isTerm1Var)
+			++varCount;
+
+		if ((query->termCount == 2) && (query->isTerm2Var))
+			++varCount;
+
+		return varCount;
+	}
+
+	// assume: termCount & predicateName matches
+	// fact can contain variables if it is from rule head.
+	static bool IsFactMatch(const Fact *query, const Fact *fact)
+	{
+		if (query->termCount == 1)
+		{
+			return query->isTerm1Var ? true : (fact->isTerm1Var ? true : HazeProlog::StringCompare(query->term1Name, fact->term1Name));
+		}
+		else if (query->termCount == 2)
+		{
+			if (fact->isTerm1Var && fact->isTerm2Var) // both terms are variables in "fact"
+				return true;
+
+			if (query->isTerm1Var && query->isTerm2Var) // both terms are variables in "query"
+			{
+				if (HazeProlog::StringCompare(query->term1Name, query->term2Name)) // pred(X , X)
+					return HazeProlog::StringCompare(fact->term1Name, fact->term2Name);
+				else // pred(X , Y)
+					return !HazeProlog::StringCompare(fact->term1Name, fact->term2Name);
+			}
+			else if (query->isTerm1Var && (!query->isTerm2Var)) // term2 is constant in query
+			{
+				return fact->isTerm2Var ? true : HazeProlog::StringCompare(query->term2Name, fact->term2Name);
+			}
+			else if ((!query->isTerm1Var) && query->isTerm2Var) // term1 is constant in query
+			{
+				return fact->isTerm1Var ? true : HazeProlog::StringCompare(query->term1Name, fact->term1Name);
+			}
+			else // both constant in query
+			{
+				char varCount = HazeProlog::GetVariableCountOfQuery(fact);
+
+				if (varCount == 0) // fact has no variables
+				{
+					return HazeProlog::StringCompare(query->term1Name, fact->term1Name) && HazeProlog::StringCompare(query->term2Name, fact->term2Name);
+				}
+				else if (varCount == 1) // fact has one variable
+				{
+					if (fact->isTerm1Var)
+						return HazeProlog::StringCompare(query->term2Name, fact->term2Name);
+					else
+						return HazeProlog::StringCompare(query->term1Name, fact->term1Name);
+				}
+			}
+		}
+
+		return false;
+	}
+
+	static bool IsMatchingFact(const Fact *query, const Fact *fact)
+	{
+		return ((fact->termCount == query->termCount)
+			&& HazeProlog::StringCompare(fact->predicateName, query->predicateName)
+			&& HazeProlog::IsFactMatch(query, fact));
+	}
+
+	const Fact* FindFirstMatchingFact(const Fact *query, FactCursor *cursor) const
+	{
+		cursor->nextFact = firstFact;
+		cursor->nextEntry = -1;
+		cursor->key = FactIndex::KEY_PREDICATE;
+
+		if (factIndex) // visit only the facts of the query bucket
+			cursor->nextEntry = factIndex->GetFirstEntry(query, &cursor->key);
+
+		return this->FindNextMatchingFact(query, cursor);
+	}
+
+	const Fact* FindNextMatchingFact(const Fact *query, FactCursor *cursor) const
+	{
+		if (factIndex)
+		{
+			while (cursor->nextEntry != -1)
+			{
+				const Fact *fact = factIndex->GetFact(cursor->nextEntry);
+				cursor->nextEntry = factIndex->GetNextEntry(cursor->nextEntry, cursor->key);
+
+				if (HazeProlog::IsMatchingFact(query, fact))
+					return fact;
+			}
+
+			return 0;
+		}
+
+		while (cursor->nextFact)
+		{
+			const Fact *fact = cursor->nextFact;
+			cursor->nextFact = fact->nextFact;
+
+			if (HazeProlog::IsMatchingFact(query, fact))
+				return fact;
+		}
+
+		return 0;
+	}
+
+#ifndef NO_RECURSIVE_RULES
+	static bool IsRuleLocked(const RuleLock *lockedRules, const Rule *rule)
+	{
+		for (const RuleLock *lock = lockedRules; lock; lock = lock->next)
+		{
+			if ((lock->rule == rule) && lock->isLocked)
+				return true;
+		}
+
+		return false;
+	}
+#endif
+
+	static bool IsRuleMatch(const Fact *query, const Rule *rule, const RuleCursor *cursor)
+	{
+#ifndef NO_RECURSIVE_RULES
+		return ((rule->head.termCount == query->termCount)
+			&& HazeProlog::StringCompare(rule->head.predicateName, query->predicateName)
+			&& HazeProlog::IsFactMatch(query, &rule->head)
+			&& (!HazeProlog::IsRuleLocked(cursor->lockedRules, rule)));
+#else  
+		(void)cursor;
+		return ((rule->head.termCount == query->termCount)
+			&& HazeProlog::StringCompare(rule->head.predicateName, query->predicateName)
+			&& HazeProlog::IsFactMatch(query, &rule->head));
+#endif
+	}
+
+	const Rule* FindFirstMatchingRule(const Fact *query, RuleCursor *cursor, const QueryContext *context) const
+	{
+#ifndef NO_RECURSIVE_RULES
+		cursor->lockedRules = context->lockedRules;
+#else
+		(void)context;
+#endif
+		cursor->nextRule = firstRule;
+		cursor->nextEntry = -1;
+		cursor->term1Bound = !query->isTerm1Var;
+		cursor->term2Bound = (query->termCount == 2) && (!query->isTerm2Var);
+		cursor->term1Hash = 0;
+		cursor->term2Hash = 0;
+
+		cursor->nextVariableEntry = -1;
+		cursor->useTerm1Chains = false;
+
+		if (ruleIndex) // visit only the rules of the query predicate
+		{
+			cursor->useTerm1Chains = cursor->term1Bound && ruleIndex->HasTerm1Chains();
+			cursor->nextEntry = cursor->useTerm1Chains ? ruleIndex->GetFirstTerm1Entry(query, &cursor->nextVariableEntry) : ruleIndex->GetFirstEntry(query);
+			cursor->term1Hash = cursor->term1Bound ? SymbolTable::HashName(query->term1Name) : 0;
+			cursor->term2Hash = cursor->term2Bound ? SymbolTable::HashName(query->term2Name) : 0;
+		}
+
+		return this->FindNextMatchingRule(query, cursor);
+	}
+
+	// merges the chain of the query constant with the chain of variable term1 heads. (entries are in rule order)
+	const Rule* FindNextTerm1Rule(const Fact *query, RuleCursor *cursor) const
+	{
+		while ((cursor->nextEntry != -1) || (cursor->nextVariableEntry != -1))
+		{
+			bool isConstant = (cursor->nextVariableEntry == -1) || ((cursor->nextEntry != -1) && (cursor->nextEntry < cursor->nextVariableEntry));
+			int *position = isConstant ? &cursor->nextEntry : &cursor->nextVariableEntry;
+
+			const RuleIndexEntry *indexEntry = ruleIndex->GetEntry(*position);
+			const Rule *rule = indexEntry->rule;
+			*position = indexEntry->nextTerm1;
+
+			// (chains are shared by different keys)
+			if (isConstant && (indexEntry->term1Hash != cursor->term1Hash))
+				continue;
+
+			if (cursor->term2Bound && (!rule->head.isTerm2Var) && (indexEntry->term2Hash != cursor->term2Hash))
+				continue;
+
+			if (HazeProlog::IsRuleMatch(query, rule, cursor))
+				return rule;
+		}
+
+		return 0;
+	}
+
+	// rules are checked when they are reached, so lock state of each rule is read after previous rule released its lock.
+	const Rule* FindNextMatchingRule(const Fact *query, RuleCursor *cursor) const
+	{
+		if (ruleIndex && cursor->useTerm1Chains)
+			return this->FindNextTerm1Rule(query, cursor);
+
+		if (ruleIndex)
+		{
+			while (cursor->nextEntry != -1)
+			{
+				const RuleIndexEntry *indexEntry = ruleIndex->GetEntry(cursor->nextEntry);
+				const Rule *rule = indexEntry->rule;
+				cursor->nextEntry = indexEntry->next;
+
+				// constant head terms which cannot be equal to query terms
+				if (cursor->term1Bound && (!rule->head.isTerm1Var) && (indexEntry->term1Hash != cursor->term1Hash))
+					continue;
+
+				if (cursor->term2Bound && (!rule->head.isTerm2Var) && (indexEntry->term2Hash != cursor->term2Hash))
+					continue;
+
+				if (HazeProlog::IsRuleMatch(query, rule, cursor))
+					return rule;
+			}
+
+			return 0;
+		}
+
+		while (cursor->nextRule)
+		{
+			const Rule *rule = cursor->nextRule;
+			cursor->nextRule = rule->nextRule;
+
+			if (HazeProlog::IsRuleMatch(query, rule, cursor))
+				return rule;
+		}
+
+		return 0;
+	}
+
+	static void ReplaceVariablesInRule(const Fact *query, const Rule *input, Rule *output)
+	{
+		output->head.term1Name = query->term1Name;
+		output->head.isTerm1Var = query->isTerm1Var;
+
+		if (query->termCount == 2)
+		{
+			output->head.term2Name = query->term2Name;
+			output->head.isTerm2Var = query->isTerm2Var;
+		}
+
+		if (input->head.isTerm1Var && input->fact1.isTerm1Var && HazeProlog::StringCompare(input->head.term1Name, input->fact1.term1Name))
+		{
+			output->fact1.term1Name = output->head.term1Name;
+			output->fact1.isTerm1Var = output->head.isTerm1Var;
+		}
+
+		if (input->head.isTerm1Var && (input->fact1.termCount == 2) && input->fact1.isTerm2Var && HazeProlog::StringCompare(input->head.term1Name, input->fact1.term2Name))
+		{
+			output->fact1.term2Name = output->head.term1Name;
+			output->fact1.isTerm2Var = output->head.isTerm1Var;
+		}
+
+		if (input->factCountInBody == 2)
+		{
+			if (input->head.isTerm1Var && input->fact2.isTerm1Var && HazeProlog::StringCompare(input->head.term1Name, input->fact2.term1Name))
+			{
+				output->fact2.term1Name = output->head.term1Name;
+				output->fact2.isTerm1Var = output->head.isTerm1Var;
+			}
+
+			if (input->head.isTerm1Var && (input->fact2.termCount == 2) && input->fact2.isTerm2Var && HazeProlog::StringCompare(input->head.term1Name, input->fact2.term2Name))
+			{
+				output->fact2.term2Name = output->head.term1Name;
+				output->fact2.isTerm2Var = output->head.isTerm1Var;
+			}
+		}
+
+		if (query->termCount == 2)
+		{
+			if (input->head.isTerm2Var && input->fact1.isTerm1Var && HazeProlog::StringCompare(input->head.term2Name, input->fact1.term1Name))
+			{
+				output->fact1.term1Name = output->head.term2Name;
+				output->fact1.isTerm1Var = output->head.isTerm2Var;
+			}
+
+			if (input->head.isTerm2Var && (input->fact1.termCount == 2) && input->fact1.isTerm2Var && HazeProlog::StringCompare(input->head.term2Name, input->fact1.term2Name))
+			{
+				output->fact1.term2Name = output->head.term2Name;
+				output->fact1.isTerm2Var = output->head.isTerm2Var;
+			}
+
+			if (input->factCountInBody == 2)
+			{
+				if (input->head.isTerm2Var && input->fact2.isTerm1Var && HazeProlog::StringCompare(input->head.term2Name, input->fact2.term1Name))
+				{
+					output->fact2.term1Name = output->head.term2Name;
+					output->fact2.isTerm1Var = output->head.isTerm2Var;
+				}
+
+				if (input->head.isTerm2Var && (input->fact2.termCount == 2) && input->fact2.isTerm2Var && HazeProlog::StringCompare(input->head.term2Name, input->fact2.term2Name))
+				{
+					output->fact2.term2Name = output->head.term2Name;
+					output->fact2.isTerm2Var = output->head.isTerm2Var;
+				}
+			}
+		}
+	}
+
+	// assume: fact does not contain vars
+	// if query has one var then first term of output is the result
+	// if query has two vars or no vars then output is same as fact
+	static void PutResultAccordingToQuery(const Fact *query, const Fact *fact, Fact *output)
+	{
+		HazeProlog::CopyFact(output, fact);
+
+		if (HazeProlog::GetVariableCountOfQuery(query) == 1)
+		{
+			if (!query->isTerm1Var) // assign term2 into term1	 
+			{
+				output->term1Name = output->term2Name;
+				output->isTerm1Var = false;
+			}
+		}
+	}
+
+	// passes a matching fact to the caller in result layout of the query
+	static bool MatchingFactVisitor(const Fact *fact, void *userData)
+	{
+		FactFrame *frame = (FactFrame*)userData;
+
+		if (!frame->result)
+		{
+			frame->result = (Fact*)HazeProlog::AllocateScratch(frame->context, sizeof(Fact));
+			if (!frame->result)
+				return false;
+		}
+
+		frame->hasResults = true;
+		HazeProlog::PutResultAccordingToQuery(frame->query, fact, frame->result);
+
+		return frame->visitor(frame->result, frame->userData);
+	}
+
+	NO_INLINE bool SolveFactQuery(const Fact *query, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+#ifdef PRINT_FREE_MEM
+		PRINT("SolveFactQuery Free Mem: ");
+		PRINT(freeMemory());
+		PRINT("\n");
+#endif
+
+		FactFrame frame;
+		frame.query = query;
+		frame.visitor = visitor;
+		frame.userData = userData;
+		frame.context = context;
+		frame.result = 0;
+		frame.hasResults = false;
+
+		FactCursor cursor;
+		ArenaMark mark = context->arena->Mark();
+		bool keepSearching = true;
+
+		for (const Fact *fact = this->FindFirstMatchingFact(query, &cursor); fact; fact = this->FindNextMatchingFact(query, &cursor))
+		{
+			keepSearching = HazeProlog::MatchingFactVisitor(fact, &frame);
+
+			if (!keepSearching)
+				break;
+		}
+
+		if (keepSearching && factSource) // facts which are not in the fact list
+			factSource->VisitMatchingFacts(query, HazeProlog::MatchingFactVisitor, &frame);
+
+		context->arena->Release(mark);
+
+		return frame.hasResults;
+	}
+
+	// value of a variable of goal in a result of goal. returns 0 if goal does not have the variable.
+	// (values of goal variables are the first terms of its results)
+	static const char* GetVariableValue(const Fact *goal, const Fact *result, const char *variableName)
+	{
+		if (goal->isTerm1Var && HazeProlog::StringCompare(goal->term1Name, variableName))
+			return result->term1Name;
+
+		if ((goal->termCount == 2) && goal->isTerm2Var && HazeProlog::StringCompare(goal->term2Name, variableName))
+			return goal->isTerm1Var ? result->term2Name : result->term1Name;
+
+		return 0;
+	}
+
+	// value of a head variable of AND rule. fact1 result binds the variables of fact1, fact2 result binds the rest.
+	static const char* GetJoinValue(const RuleFrame *frame, const Fact *fact2Result, const char *variableName)
+	{
+		const char *value = HazeProlog::GetVariableValue(&frame->queringRule.fact1, frame->fact1Result, variableName);
+		return value ? value : HazeProlog::GetVariableValue(&frame->queringFact, fact2Result, variableName);
+	}
+
+	// passes rule results to the caller. rule lock is released while the caller uses the result,
+	// so rule is only locked while its own body is being solved.
+	static bool RuleResultVisitor(const Fact *result, void *userData)
+	{
+		RuleFrame *frame = (RuleFrame*)userData;
+
+#ifndef NO_RECURSIVE_RULES
+		bool isLocked = frame->lock.isLocked;
+		frame->lock.isLocked = false;
+#endif
+
+		bool keepSearching = frame->visitor(result, frame->userData);
+
+#ifndef NO_RECURSIVE_RULES
+		frame->lock.isLocked = isLocked;
+#endif
+
+		return keepSearching;
+	}
+
+	// puts AND rule result in result layout of the head. Ex: "query(X,Y)" and we have "rule(X,Y) = fact1(Y) , fact2(X,Y)"
+	// (a head variable which is not in the body keeps its name)
+	static bool JoinResultVisitor(const Fact *fact2Result, void *userData)
+	{
+		RuleFrame *frame = (RuleFrame*)userData;
+		const Fact *head = &frame->queringRule.head;
+		Fact *result = &frame->joinResult;
+
+		HazeProlog::CopyFact(result, head);
+
+		const char *value1 = head->isTerm1Var ? HazeProlog::GetJoinValue(frame, fact2Result, head->term1Name) : 0;
+		const char *value2 = ((head->termCount == 2) && head->isTerm2Var) ? HazeProlog::GetJoinValue(frame, fact2Result, head->term2Name) : 0;
+
+		if (value1)
+		{
+			result->term1Name = value1;
+			result->isTerm1Var = false;
+		}
+
+		if (value2)
+		{
+			result->term2Name = value2;
+			result->isTerm2Var = false;
+
+			if (!head->isTerm1Var) // rule(a,Y) gives its single value as first term
+				result->term1Name = value2;
+		}
+
+		return HazeProlog::RuleResultVisitor(result, frame);
+	}
+
+	// true if a rule has the predicate and term count of the goal. (head terms and rule locks are not checked)
+	bool HasPredicateRules(const Fact *goal) const
+	{
+		if (ruleIndex)
+		{
+			for (int entry = ruleIndex->GetFirstEntry(goal); entry != -1; entry = ruleIndex->GetEntry(entry)->next)
+			{
+				const Fact *head = &ruleIndex->GetEntry(entry)->rule->head;
+
+				if ((head->termCount == goal->termCount) && HazeProlog::StringCompare(head->predicateName, goal->predicateName))
+					return true;
+			}
+
+			return false;
+		}
+
+		for (const Rule *rule = firstRule; rule; rule = rule->nextRule)
+		{
+			if ((rule->head.termCount == goal->termCount) && HazeProlog::StringCompare(rule->head.predicateName, goal->predicateName))
+				return true;
+		}
+
+		return false;
+	}
+
+	// decides if fact2 of AND rule is joined with a hash table. (see BuildHashJoin)
+	// not used with FactIndex or FactSource (fact2 lookups are already indexed) or if fact2 has rules.
+	// table is built when fact1 gives its first result, so a fact1 without results costs no scan.
+	// (built before fact1 is solved if fact1 has rules. their frames can be released between results)
+	void PlanHashJoin(RuleFrame *frame) const
+	{
+		frame->joinEntries = 0;
+		frame->isJoinDeferred = false;
+
+#ifndef NO_HASH_JOIN
+		const Fact *fact2 = &frame->queringRule.fact2;
+
+		if (factIndex || factSource)
+			return;
+
+		if (this->HasPredicateRules(fact2)) // rule results depend on the bound value
+			return;
+
+		bool fact1HasRules = this->HasPredicateRules(&frame->queringRule.fact1);
+
+		// a single fact1 result needs a single scan. (building the table costs the same)
+		if (statistics && (!fact1HasRules) && (statistics->EstimateMatches(&frame->queringRule.fact1) < 2))
+			return;
+
+		// find the column which will be bound by fact1 results
+		Fact fact1Result;
+		fact1Result.term1Name = "";
+		fact1Result.term2Name = "";
+		HazeProlog::BindFact2(&frame->queringRule.fact1, &fact1Result, fact2, &frame->queringFact);
+
+		if (fact2->isTerm1Var && (!frame->queringFact.isTerm1Var))
+			frame->joinColumn = 1;
+		else if ((fact2->termCount == 2) && fact2->isTerm2Var && (!frame->queringFact.isTerm2Var))
+			frame->joinColumn = 2;
+		else
+			return;
+
+		if (fact1HasRules)
+			this->BuildHashJoin(frame);
+		else
+			frame->isJoinDeferred = true;
+#endif
+	}
+
+	// materializes fact2 of AND rule into a hash table on the column which is bound by fact1 results,
+	// so fact list is scanned once instead of once for each fact1 result.
+	// returns false if fact2 must be solved for each fact1 result.
+	bool BuildHashJoin(RuleFrame *frame) const
+	{
+		frame->joinEntries = 0;
+
+#ifndef NO_HASH_JOIN
+		const Fact *fact2 = &frame->queringRule.fact2;
+		int entryCount = 0;
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			if ((fact->termCount == fact2->termCount) && HazeProlog::StringCompare(fact->predicateName, fact2->predicateName))
+			{
+				if (fact->isTerm1Var || fact->isTerm2Var) // matches any value
+					return false;
+
+				++entryCount;
+			}
+		}
+
+		if (entryCount == 0)
+			return false;
+
+		unsigned int bucketCount = 1;
+		while (bucketCount < (unsigned int)entryCount)
+			bucketCount *= 2;
+
+		ArenaMark mark = frame->context->arena->Mark();
+		JoinEntry *entries = (JoinEntry*)frame->context->arena->Allocate(sizeof(JoinEntry) * entryCount);
+		int *buckets = (int*)frame->context->arena->Allocate(sizeof(int) * bucketCount);
+
+		if ((!entries) || (!buckets)) // not an error. solve fact2 for each fact1 result
+		{
+			frame->context->arena->Release(mark);
+			return false;
+		}
+
+		int index = 0;
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			if ((fact->termCount == fact2->termCount) && HazeProlog::StringCompare(fact->predicateName, fact2->predicateName))
+				entries[index++].fact = fact;
+		}
+
+		for (unsigned int i = 0; i < bucketCount; ++i)
+			buckets[i] = -1;
+
+		for (index = entryCount - 1; index >= 0; --index) // backwards to keep fact list order in each chain
+		{
+			const char *key = (frame->joinColumn == 1) ? entries[index].fact->term1Name : entries[index].fact->term2Name;
+			int *head = &buckets[SymbolTable::HashName(key) & (bucketCount - 1)];
+
+			entries[index].next = *head;
+			*head = index;
+		}
+
+		frame->joinEntries = entries;
+		frame->joinBuckets = buckets;
+		frame->joinBucketMask = bucketCount - 1;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// solve bound fact2 of AND rule. (frame->queringFact)
+	bool SolveJoinQuery(RuleFrame *frame, SolutionVisitor visitor) const
+	{
+		if (!frame->joinEntries)
+			return this->SolveQuery(&frame->queringFact, visitor, frame, frame->context);
+
+		const Fact *query = &frame->queringFact;
+
+		FactFrame factFrame;
+		factFrame.query = query;
+		factFrame.visitor = visitor;
+		factFrame.userData = frame;
+		factFrame.context = frame->context;
+		factFrame.result = 0;
+		factFrame.hasResults = false;
+
+		ArenaMark mark = frame->context->arena->Mark();
+		const char *key = (frame->joinColumn == 1) ? query->term1Name : query->term2Name;
+
+		for (int index = frame->joinBuckets[SymbolTable::HashName(key) & frame->joinBucketMask]; index != -1; index = frame->joinEntries[index].next)
+		{
+			const Fact *fact = frame->joinEntries[index].fact;
+
+			if (HazeProlog::IsMatchingFact(query, fact) && (!HazeProlog::MatchingFactVisitor(fact, &factFrame)))
+				break;
+		}
+
+		frame->context->arena->Release(mark);
+
+		return factFrame.hasResults;
+	}
+
+	// copy fact2 of AND rule to queringFact and replace its variables which are in fact1 with fact1 result
+	static void BindFact2(const Fact *fact1, const Fact *fact1Result, const Fact *fact2, Fact *queringFact)
+	{
+		HazeProlog::CopyFact(queringFact, fact2);
+
+		const char *value = fact2->isTerm1Var ? HazeProlog::GetVariableValue(fact1, fact1Result, fact2->term1Name) : 0;
+		if (value)
+		{
+			queringFact->term1Name = value;
+			queringFact->isTerm1Var = false;
+		}
+
+		value = ((fact2->termCount == 2) && fact2->isTerm2Var) ? HazeProlog::GetVariableValue(fact1, fact1Result, fact2->term2Name) : 0;
+		if (value)
+		{
+			queringFact->term2Name = value;
+			queringFact->isTerm2Var = false;
+		}
+	}
+
+	// true if fact2 results are rule results: head has one variable which is the only variable of fact2 after binding.
+	// Ex: "query(X)" and we have "rule(X) = fact1(Z) , fact2(Z,X)"
+	static bool IsFact2ResultOfHead(const Rule *queringRule, const Fact *boundFact2)
+	{
+		const Fact *head = &queringRule->head;
+
+		if ((HazeProlog::GetVariableCountOfQuery(head) != 1) || (HazeProlog::GetVariableCountOfQuery(boundFact2) != 1))
+			return false;
+
+		const char *variableName = head->isTerm1Var ? head->term1Name : head->term2Name;
+		return HazeProlog::GetVariableValue(boundFact2, boundFact2, variableName) != 0;
+	}
+
+	// solve fact2 of AND rule for a fact1 result
+	static bool AndFact1ResultVisitor(const Fact *fact1Result, void *userData)
+	{
+		RuleFrame *frame = (RuleFrame*)userData;
+		const Rule *queringRule = &frame->queringRule;
+
+		if (frame->isJoinDeferred)
+		{
+			frame->isJoinDeferred = false;
+			frame->prolog->BuildHashJoin(frame);
+		}
+
+		HazeProlog::BindFact2(&queringRule->fact1, fact1Result, &queringRule->fact2, &frame->queringFact);
+
+		// solve queringFact
+		if (frame->isFact2Result) // output is fact2 results
+		{
+			frame->hasResults2 |= frame->prolog->SolveJoinQuery(frame, HazeProlog::RuleResultVisitor);
+		}
+		else // head values come from both facts. So, we need to re-arrange results according to query.
+		{
+			frame->fact1Result = fact1Result;
+			frame->hasResults2 |= frame->prolog->SolveJoinQuery(frame, HazeProlog::JoinResultVisitor);
+		}
+
+		return !frame->context->stopped;
+	}
+
+	// allocates scratch memory of current query. stops the query if arena is full.
+	static void* AllocateScratch(QueryContext *context, size_t size)
+	{
+		void *memory = context->arena->Allocate(size);
+
+		if (!memory)
+		{
+			context->outOfMemory = true;
+			context->stopped = true;
+		}
+
+		return memory;
+	}
+
+	// estimated matches of an AND body when goal1 is solved first and goal2 is solved for each goal1 result
+	unsigned long EstimateAndCost(const Fact *goal1, const Fact *goal2) const
+	{
+		Fact goal1Result;
+		goal1Result.term1Name = "";
+		goal1Result.term2Name = "";
+
+		Fact boundGoal2;
+		HazeProlog::BindFact2(goal1, &goal1Result, goal2, &boundGoal2);
+
+		unsigned long matches = statistics->EstimateMatches(goal1);
+		return matches + matches * statistics->EstimateMatches(&boundGoal2);
+	}
+
+	// true if goal has two different unbound variables and some facts of its predicate have equal terms.
+	// (such goal skips those facts unless a variable is bound by the other goal, so its results depend on goal order)
+	bool HasEqualTermFacts(const Fact *goal) const
+	{
+		if ((goal->termCount != 2) || (!goal->isTerm1Var) || (!goal->isTerm2Var) || HazeProlog::StringCompare(goal->term1Name, goal->term2Name))
+			return false;
+
+		const PredicateStats *entry = statistics->Find(goal->predicateName, goal->termCount);
+		return entry && (entry->equalTermCount > 0);
+	}
+
+	// puts the AND goal first which gives less estimated matches for the whole body. (requires SetPredicateStatistics)
+	// goals of predicates with rules keep their order. (statistics count facts only)
+	// results may come in a different order.
+	void PlanAndRule(Rule *queringRule, Fact *swapBuffer) const
+	{
+		const Fact *fact1 = &queringRule->fact1;
+		const Fact *fact2 = &queringRule->fact2;
+
+		if (!statistics)
+			return;
+
+		if (this->HasPredicateRules(fact1) || this->HasPredicateRules(fact2))
+			return;
+
+		if (this->HasEqualTermFacts(fact1) || this->HasEqualTermFacts(fact2))
+			return;
+
+		if (this->EstimateAndCost(fact2, fact1) < this->EstimateAndCost(fact1, fact2))
+		{
+			HazeProlog::CopyFact(swapBuffer, &queringRule->fact1);
+			HazeProlog::CopyFact(&queringRule->fact1, &queringRule->fact2);
+			HazeProlog::CopyFact(&queringRule->fact2, swapBuffer);
+		}
+	}
+
+	NO_INLINE bool SolveMatchingRule(const Fact *query, const Rule *matchingRule, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+		ArenaMark mark = context->arena->Mark();
+
+		// rule copy and bindings live in query arena, not in the stack frame of this recursion level.
+		RuleFrame *frame = (RuleFrame*)HazeProlog::AllocateScratch(context, sizeof(RuleFrame));
+		if (!frame)
+			return false;
+
+#ifndef NO_RECURSIVE_RULES
+		frame->lock.rule = matchingRule;
+		frame->lock.isLocked = !context->table; // tabled goals terminate with their answer tables
+		frame->lock.next = context->lockedRules;
+		context->lockedRules = &frame->lock; // acquire lock
+#endif
+
+		frame->prolog = this;
+		frame->matchingRule = matchingRule;
+		frame->visitor = visitor;
+		frame->userData = userData;
+		frame->context = context;
+
+		Rule *queringRule = &frame->queringRule;
+		HazeProlog::CopyRule(matchingRule, queringRule);
+		HazeProlog::ReplaceVariablesInRule(query, matchingRule, queringRule);
+
+		// make the fact who has single variable as first fact of queringRule
+		if ((queringRule->factCountInBody == 2) && (queringRule->op1IsAnd))
+		{
+			if (HazeProlog::GetVariableCountOfQuery(&queringRule->fact1) == 2) // exchange fact1 with fact2
+			{
+				HazeProlog::CopyFact(&frame->queringFact, &queringRule->fact1);
+				HazeProlog::CopyFact(&queringRule->fact1, &queringRule->fact2);
+				HazeProlog::CopyFact(&queringRule->fact2, &frame->queringFact);
+			}
+
+			this->PlanAndRule(queringRule, &frame->queringFact);
+		}
+
+		bool hasResults = false;
+
+		if (queringRule->factCountInBody == 1)
+		{
+			hasResults = this->SolveQuery(&queringRule->fact1, HazeProlog::RuleResultVisitor, frame, context);
+		}
+#ifndef NO_OR_RULES
+		else if ((queringRule->factCountInBody == 2) && (!queringRule->op1IsAnd)) // OR with second fact
+		{
+#ifdef ENABLE_PARALLEL_RULES
+			if (taskPool && (!context->table))
+			{
+				BranchTask branches[2];
+				branches[0].query = &queringRule->fact1;
+				branches[0].rule = 0;
+				branches[1].query = &queringRule->fact2;
+				branches[1].rule = 0;
+
+				hasResults = this->SolveBranches(branches, 2, HazeProlog::RuleResultVisitor, frame, context);
+			}
+			else
+#endif
+			{
+				hasResults = this->SolveQuery(&queringRule->fact1, HazeProlog::RuleResultVisitor, frame, context);
+
+				if (!context->stopped)
+					hasResults |= this->SolveQuery(&queringRule->fact2, HazeProlog::RuleResultVisitor, frame, context);
+			}
+		}
+#endif
+		else if ((queringRule->factCountInBody == 2) && (queringRule->op1IsAnd)) // AND with second fact
+		{
+			Fact fact1Result;
+			fact1Result.term1Name = "";
+			fact1Result.term2Name = "";
+			HazeProlog::BindFact2(&queringRule->fact1, &fact1Result, &queringRule->fact2, &frame->queringFact);
+
+			frame->isFact2Result = HazeProlog::IsFact2ResultOfHead(queringRule, &frame->queringFact);
+			frame->hasResults2 = false;
+			this->PlanHashJoin(frame);
+
+			hasResults = this->SolveQuery(&queringRule->fact1, HazeProlog::AndFact1ResultVisitor, frame, context);
+			hasResults &= frame->hasResults2;
+		}
+
+#ifndef NO_RECURSIVE_RULES
+		context->lockedRules = frame->lock.next; // release lock
+#endif
+
+		context->arena->Release(mark);
+
+		return hasResults;
+	}
+
+#ifdef ENABLE_PARALLEL_RULES
+	// estimated fact matches of a goal. a rule goal is assumed to scan the fact list.
+	// without statistics, each bound term of a fact goal is assumed to keep 1/16 of the fact list.
+	unsigned int EstimateGoalCost(const Fact *goal, const QueryContext *context) const
+	{
+		RuleCursor cursor;
+
+		if (this->FindFirstMatchingRule(goal, &cursor, context))
+			return factCount;
+
+		if (statistics)
+			return statistics->EstimateMatches(goal);
+
+		int boundCount = (goal->isTerm1Var ? 0 : 1) + (((goal->termCount == 2) && (!goal->isTerm2Var)) ? 1 : 0);
+		return factCount >> (4 * boundCount);
+	}
+
+	unsigned int EstimateBranchCost(const BranchTask *branch, const QueryContext *context) const
+	{
+		if (!branch->rule)
+			return this->EstimateGoalCost(branch->query, context);
+
+		Rule queringRule;
+		HazeProlog::CopyRule(branch->rule, &queringRule);
+		HazeProlog::ReplaceVariablesInRule(branch->query, branch->rule, &queringRule);
+
+		unsigned int cost = this->EstimateGoalCost(&queringRule.fact1, context);
+
+		if (queringRule.factCountInBody == 2)
+		{
+			unsigned int cost2 = this->EstimateGoalCost(&queringRule.fact2, context);
+			cost = ((~0U - cost) < cost2) ? ~0U : (cost + cost2);
+		}
+
+		return cost;
+	}
+
+	static bool BranchResultVisitor(const Fact *result, void *userData)
+	{
+		BranchTask *branch = (BranchTask*)userData;
+
+		if (branch->cancelled->load(std::memory_order_relaxed))
+			return false;
+
+		if (!branch->results.Add(result))
+		{
+			branch->outOfMemory = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	static void RunBranchTask(void *userData, QueryArena *arena)
+	{
+		BranchTask *branch = (BranchTask*)userData;
+
+		QueryContext context;
+		context.stopped = false;
+		context.outOfMemory = false;
+		context.arena = arena;
+		context.table = 0;
+#ifndef NO_RECURSIVE_RULES
+		context.lockedRules = branch->lockedRules;
+#endif
+
+		if (branch->rule)
+			branch->found = branch->prolog->SolveMatchingRule(branch->query, branch->rule, HazeProlog::BranchResultVisitor, branch, &context);
+		else
+			branch->found = branch->prolog->SolveQuery(branch->query, HazeProlog::BranchResultVisitor, branch, &context);
+
+		branch->outOfMemory |= context.outOfMemory;
+	}
+
+	// solves expensive branches on idle pool threads while the caller solves the others in order.
+	// results of pool threads are passed after the results of previous branches, so the order is same as a sequential search.
+	bool SolveBranches(BranchTask *branches, int branchCount, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+		std::atomic<bool> cancelled(false);
+		ArenaMark mark = context->arena->Mark();
+
+#ifndef NO_RECURSIVE_RULES
+		// branches see the locks of this moment. (caller changes its own locks while passing results)
+		int lockCount = 0;
+		for (const RuleLock *lock = context->lockedRules; lock; lock = lock->next)
+		{
+			if (lock->isLocked)
+				++lockCount;
+		}
+
+		RuleLock *locks = 0;
+		if (lockCount != 0)
+		{
+			locks = (RuleLock*)HazeProlog::AllocateScratch(context, sizeof(RuleLock) * lockCount);
+			if (!locks)
+				return false;
+
+			int index = 0;
+			for (const RuleLock *lock = context->lockedRules; lock; lock = lock->next)
+			{
+				if (!lock->isLocked)
+					continue;
+
+				locks[index] = *lock;
+				locks[index].next = ((index + 1) < lockCount) ? &locks[index + 1] : 0;
+				++index;
+			}
+		}
+#endif
+
+		for (int i = 0; i < branchCount; ++i)
+		{
+			BranchTask *branch = &branches[i];
+			branch->prolog = this;
+#ifndef NO_RECURSIVE_RULES
+			branch->lockedRules = locks;
+#endif
+			branch->cancelled = &cancelled;
+			branch->found = false;
+			branch->outOfMemory = false;
+			branch->task.function = HazeProlog::RunBranchTask;
+			branch->task.userData = branch;
+
+			// first branch is solved by the caller without waiting
+			branch->isStarted = (i != 0) && (this->EstimateBranchCost(branch, context) >= minParallelCost)
+				&& taskPool->TryStart(&branch->task);
+		}
+
+		bool found = false;
+
+		for (int i = 0; i < branchCount; ++i)
+		{
+			BranchTask *branch = &branches[i];
+
+			if (!branch->isStarted)
+			{
+				if (context->stopped)
+					continue;
+
+				if (branch->rule)
+					found |= this->SolveMatchingRule(branch->query, branch->rule, visitor, userData, context);
+				else
+					found |= this->SolveQuery(branch->query, visitor, userData, context);
+
+				if (context->stopped)
+					cancelled = true;
+
+				continue;
+			}
+
+			taskPool->Wait(&branch->task);
+
+			if (context->stopped)
+				continue;
+
+			found |= branch->found;
+
+			for (rcount j = 0; j < branch->results.GetCount(); ++j)
+			{
+				if (!visitor(branch->results.GetResult(j), userData))
+					break;
+			}
+
+			if (branch->outOfMemory)
+			{
+				context->outOfMemory = true;
+				context->stopped = true;
+			}
+
+			if (context->stopped)
+				cancelled = true;
+		}
+
+		context->arena->Release(mark); // (all pool threads are done with the locks)
+
+		return found;
+	}
+
+	// solves the rules from the cursor as parallel branches. rules are read once. each group of MAX_PARALLEL_BRANCHES
+	// rules is solved before the next group is read. (branches are allocated from the query arena)
+	bool SolveRuleBranches(const Fact *query, const Rule *rule, RuleCursor *cursor, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+		ArenaMark mark = context->arena->Mark();
+		BranchTask *branches = (BranchTask*)HazeProlog::AllocateScratch(context, sizeof(BranchTask) * MAX_PARALLEL_BRANCHES);
+
+		if (!branches)
+			return false;
+
+		bool found = false;
+
+		while (rule && (!context->stopped))
+		{
+			int branchCount = 0;
+
+			for (; rule && (branchCount < MAX_PARALLEL_BRANCHES); rule = this->FindNextMatchingRule(query, cursor))
+			{
+				BranchTask *branch = new (&branches[branchCount]) BranchTask;
+				branch->query = query;
+				branch->rule = rule;
+				++branchCount;
+			}
+
+			found |= this->SolveBranches(branches, branchCount, visitor, userData, context);
+
+			for (int i = 0; i < branchCount; ++i)
+				branches[i].~BranchTask();
+		}
+
+		context->arena->Release(mark);
+
+		return found;
+	}
+
+	// alternative rules of the query are solved as parallel branches. returns false if the rules should be solved sequentially.
+	bool SolveParallelRules(const Fact *query, SolutionVisitor visitor, void *userData, QueryContext *context, bool *found) const
+	{
+		if ((!taskPool) || context->table)
+			return false;
+
+		RuleCursor cursor;
+		const Rule *rule = this->FindFirstMatchingRule(query, &cursor, context);
+
+		if (!rule)
+		{
+			*found = false;
+			return true;
+		}
+
+		// a copy of the cursor looks for a second rule. (SolveRuleBranches continues after the first rule)
+		RuleCursor nextCursor = cursor;
+		if (!this->FindNextMatchingRule(query, &nextCursor)) // single rule
+			*found = this->SolveMatchingRule(query, rule, visitor, userData, context);
+		else
+			*found = this->SolveRuleBranches(query, rule, &cursor, visitor, userData, context);
+
+		return true;
+	}
+#endif
+
+	NO_INLINE bool SolveRuleQuery(const Fact *query, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+#ifdef PRINT_FREE_MEM
+		PRINT("SolveRuleQuery Free Mem: ");
+		PRINT(freeMemory());
+		PRINT("\n");
+#endif
+
+		bool found = false;
+
+#ifdef ENABLE_PARALLEL_RULES
+		if (this->SolveParallelRules(query, visitor, userData, context, &found))
+			return found;
+#endif
+
+		RuleCursor cursor;
+
+		for (const Rule *rule = this->FindFirstMatchingRule(query, &cursor, context); rule; rule = this->FindNextMatchingRule(query, &cursor))
+		{
+			found |= this->SolveMatchingRule(query, rule, visitor, userData, context);
+
+			if (context->stopped)
+				break;
+		}
+
+		return found;
+	}
+
+	// passes new answers of a tabled goal to the caller
+	static bool TableAnswerVisitor(const Fact *answer, void *userData)
+	{
+		TableFrame *frame = (TableFrame*)userData;
+		int added = frame->context->table->AddAnswer(frame->entry, answer);
+
+		if (added == -1)
+		{
+			frame->context->outOfMemory = true;
+			frame->context->stopped = true;
+			return false;
+		}
+
+		if (added == 1)
+			return frame->visitor(answer, frame->userData);
+
+		return !frame->context->stopped;
+	}
+
+	static bool ReplayAnswers(const AnswerTable *table, int entry, SolutionVisitor visitor, void *userData, QueryContext *context)
+	{
+		for (int answer = table->GetEntry(entry)->firstAnswer; answer != -1; answer = table->GetAnswer(answer)->nextAnswer)
+		{
+			if (!visitor(&table->GetAnswer(answer)->answer, userData))
+			{
+				context->stopped = true;
+				break;
+			}
+		}
+
+		return (table->GetEntry(entry)->answerCount != 0);
+	}
+
+	NO_INLINE bool SolveTabledQuery(const Fact *query, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+		AnswerTable *table = context->table;
+		int entry = table->FindGoal(query);
+
+		if (entry == -1)
+		{
+			context->outOfMemory = true;
+			context->stopped = true;
+			return false;
+		}
+
+		int8 state = table->GetEntry(entry)->state;
+
+		if (state == AnswerTable::GOAL_COMPLETE)
+			return HazeProlog::ReplayAnswers(table, entry, visitor, userData, context);
+
+		if ((state == AnswerTable::GOAL_EVALUATING) || (state == AnswerTable::GOAL_PENDING)) // recursive call. use answers found so far
+		{
+			table->OnRecursiveCall(entry);
+			return HazeProlog::ReplayAnswers(table, entry, visitor, userData, context);
+		}
+
+		// answers of an incomplete goal are passed first. evaluation only passes new answers.
+		HazeProlog::ReplayAnswers(table, entry, visitor, userData, context);
+		if (context->stopped)
+			return true;
+
+		TableFrame frame;
+		frame.visitor = visitor;
+		frame.userData = userData;
+		frame.context = context;
+		frame.entry = entry;
+
+		table->EnterGoal(entry);
+
+		bool isFirstPass = true;
+		bool isComplete = false;
+
+		while (!isComplete) // until a pass finds no new answers (only the leader of a cycle solves again)
+		{
+			if (!isFirstPass)
+				table->BeginNextPass(entry);
+
+			isFirstPass = false;
+			int answerCount = table->GetAnswerCount();
+			unsigned int recursionCount = table->GetRecursionCount();
+
+			this->EvaluateQuery(query, HazeProlog::TableAnswerVisitor, &frame, context);
+
+			isComplete = context->stopped || (!table->IsLeader(entry))
+				|| (recursionCount == table->GetRecursionCount()) || (answerCount == table->GetAnswerCount());
+		}
+
+		table->LeaveGoal(entry, context->stopped);
+
+		return (table->GetEntry(entry)->answerCount != 0);
+	}
+
+	NO_INLINE bool SolveQuery(const Fact *query, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+		if (context->table)
+			return this->SolveTabledQuery(query, visitor, userData, context);
+
+		return this->EvaluateQuery(query, visitor, userData, context);
+	}
+
+	NO_INLINE bool EvaluateQuery(const Fact *query, SolutionVisitor visitor, void *userData, QueryContext *context) const
+	{
+#ifdef PRINT_FREE_MEM
+		PRINT("SolveQuery Free Mem: ");
+		PRINT(freeMemory());
+		PRINT("\n");
+#endif
+
+		if (!this->SolveRuleQuery(query, visitor, userData, context)) // do we have matching rules?
+		{
+			if (context->stopped)
+				return false;
+
+			return this->SolveFactQuery(query, visitor, userData, context); // search in facts list if we don't have matching rules.
+		}
+		return true;
+	}
+
+	static bool UserVisitor(const Fact *solution, void *userData)
+	{
+		UserFrame *frame = (UserFrame*)userData;
+
+		if (frame->cache)
+			frame->cache->AddResult(solution);
+
+		if (!frame->visitor(solution, frame->userData))
+			frame->context.stopped = true;
+
+		return !frame->context.stopped;
+	}
+
+	// facts of the source are searched after the fact list. (pass 0 to remove)
+	void SetFactSource(const FactSource *factSource)
+	{
+		this->factSource = factSource;
+		++generation;
+	}
+
+	// enables goal reordering and join selection of AND rules. (pass 0 to remove)
+	// statistics must be built from the current fact list.
+	void SetPredicateStatistics(const PredicateStatistics *statistics)
+	{
+		this->statistics = statistics;
+		++generation; // result order can change
+	}
+
+	// memoizes answers of goals and rules. (pass 0 to remove)
+	// recursive rules are solved until no new answers are found instead of being pruned by rule locks.
+	void SetAnswerTable(AnswerTable *answerTable)
+	{
+		this->answerTable = answerTable;
+		++generation; // answers become unique
+	}
+
+#ifdef ENABLE_PARALLEL_RULES
+	// solves alternative rules of a goal and both goals of OR rules on idle threads of the pool. (pass 0 to remove)
+	// a branch is solved in parallel if its estimated fact matches (PredicateStatistics) are at least minParallelCost,
+	// so cheap branches stay on the calling thread. without statistics all branches can be parallel.
+	// results are passed in the same order as a sequential search. (not used while goals are tabled)
+	void SetParallelRules(QueryTaskPool *taskPool, unsigned int minParallelCost)
+	{
+		this->taskPool = taskPool;
+		this->minParallelCost = minParallelCost;
+	}
+#endif
+
+	// caches results of VisitSolutions and SolveQuery calls. (pass 0 to remove)
+	void SetQueryCache(QueryCache *queryCache)
+	{
+		this->queryCache = queryCache;
+	}
+
+	// call after changing facts or rules in place. (cached results are dropped)
+	void InvalidateResults()
+	{
+		++generation;
+	}
+
+	unsigned int GetGeneration() const
+	{
+		return generation;
+	}
+
+	// uses arena of SetQueryArena. (or a QUERY_ARENA_SIZE buffer on stack if there is no arena)
+	void SetQueryArena(QueryArena *queryArena)
+	{
+		this->queryArena = queryArena;
+	}
+
+	// session of the queries which are not given a session. (uses SetQueryArena, SetAnswerTable and SetQueryCache objects)
+	void GetSession(QuerySession *session) const
+	{
+		session->arena = queryArena;
+		session->answerTable = answerTable;
+		session->queryCache = queryCache;
+	}
+
+	static SolveStatus ReplayCachedResults(const QueryCache *queryCache, int entry, SolutionVisitor visitor, void *userData)
+	{
+		const QueryCacheEntry *cached = queryCache->GetEntry(entry);
+
+		for (int i = 0; i < cached->resultCount; ++i)
+		{
+			if (!visitor(queryCache->GetResult(cached->firstResult + i), userData))
+				break;
+		}
+
+		return cached->hasResults ? SOLVE_OK : SOLVE_NO_RESULTS;
+	}
+
+	// calls visitor for each solution of the query. (same layout as SolveQuery results)
+	// visitor can return false to stop the search.
+	// returns SOLVE_OUT_OF_MEMORY if query arena became full before the search was finished.
+	SolveStatus VisitSolutions(const Fact *query, SolutionVisitor visitor, void *userData)
+	{
+		QuerySession session;
+		this->GetSession(&session);
+
+		return this->VisitSolutions(query, visitor, userData, &session);
+	}
+
+	// same as above, but uses arena, answer table and query cache of the session instead of the ones set to HazeProlog.
+	// knowledge base is only read, so threads can query a shared HazeProlog without locks, each with its own session.
+	// (don't change the knowledge base while queries are running)
+	SolveStatus VisitSolutions(const Fact *query, SolutionVisitor visitor, void *userData, const QuerySession *session) const
+	{
+		QueryCache *queryCache = session->queryCache;
+		AnswerTable *answerTable = session->answerTable;
+
+		UserFrame frame;
+		frame.visitor = visitor;
+		frame.userData = userData;
+		frame.context.stopped = false;
+		frame.context.outOfMemory = false;
+		frame.context.table = answerTable;
+#ifndef NO_RECURSIVE_RULES
+		frame.context.lockedRules = 0;
+#endif
+		frame.cache = queryCache;
+
+		if (queryCache)
+		{
+			queryCache->SetGeneration(generation, factSource ? factSource->GetVersion() : 0);
+
+			int entry = queryCache->Find(query);
+			if (entry != -1)
+			{
+				bool isOuterQuery = queryCache->BeginInsert(); // queries of the visitor are not cached while results are replayed
+				SolveStatus status = HazeProlog::ReplayCachedResults(queryCache, entry, visitor, userData);
+
+				if (isOuterQuery)
+					queryCache->CancelInsert();
+
+				return status;
+			}
+
+			if (!queryCache->BeginInsert()) // query of a visitor
+				frame.cache = 0;
+		}
+
+		if (answerTable)
+			answerTable->BeginQuery();
+
+		bool found;
+		if (session->arena)
+		{
+			ArenaMark mark = session->arena->Mark(); // frames of the outer query are kept if a visitor started this query
+
+			frame.context.arena = session->arena;
+			found = this->SolveQuery(query, HazeProlog::UserVisitor, &frame, &frame.context);
+			session->arena->Release(mark);
+		}
+		else
+		{
+			void *buffer[QUERY_ARENA_SIZE / sizeof(void*)]; // aligned storage
+			QueryArena arena(buffer, sizeof(buffer));
+
+			frame.context.arena = &arena;
+			found = this->SolveQuery(query, HazeProlog::UserVisitor, &frame, &frame.context);
+		}
+
+		if (answerTable)
+			answerTable->EndQuery();
+
+		if (frame.cache)
+		{
+			if (frame.context.stopped) // results are not complete
+				queryCache->CancelInsert();
+			else
+				queryCache->EndInsert(query, found);
+		}
+
+		if (frame.context.outOfMemory)
+			return SOLVE_OUT_OF_MEMORY;
+
+		return found ? SOLVE_OK : SOLVE_NO_RESULTS;
+	}
+
+	// calls visitor for each solution of the query. (same layout as SolveQuery results)
+	// visitor can return false to stop the search. returns true if query had any solution.
+	bool SolveQuery(const Fact *query, SolutionVisitor visitor, void *userData)
+	{
+		return (this->VisitSolutions(query, visitor, userData) == SOLVE_OK);
+	}
+
+	static bool CollectResultVisitor(const Fact *solution, void *userData)
+	{
+		ResultCollector *collector = (ResultCollector*)userData;
+
+		if (*collector->resultCount >= collector->maxResults)
+		{
+			collector->exhausted = true;
+			return false;
+		}
+
+		HazeProlog::CopyFact(&collector->results[*collector->resultCount], solution);
+		++(*collector->resultCount);
+
+		return true;
+	}
+
+	// appends solutions of the query into results, without writing past maxResults.
+	// returns SOLVE_BUFFER_EXHAUSTED if query had more solutions than the buffer can hold.
+	SolveStatus SolveQuery(const Fact *query, rcount *resultCount, Fact *results, rcount maxResults)
+	{
+		QuerySession session;
+		this->GetSession(&session);
+
+		return this->SolveQuery(query, resultCount, results, maxResults, &session);
+	}
+
+	// thread-safe version of above. (see VisitSolutions with QuerySession)
+	SolveStatus SolveQuery(const Fact *query, rcount *resultCount, Fact *results, rcount maxResults, const QuerySession *session) const
+	{
+		ResultCollector collector;
+		collector.resultCount = resultCount;
+		collector.results = results;
+		collector.maxResults = maxResults;
+		collector.exhausted = false;
+
+		SolveStatus status = this->VisitSolutions(query, HazeProlog::CollectResultVisitor, &collector, session);
+
+		PRINT_BUFFER_USAGE(*resultCount, maxResults);
+
+		return collector.exhausted ? SOLVE_BUFFER_EXHAUSTED : status;
+	}
+
+	// appends solutions of the query into results. (results must have room for MAX_MATCHING_FACTS items)
+	bool SolveQuery(const Fact *query, rcount *resultCount, Fact *results)
+	{
+		SolveStatus status = this->SolveQuery(query, resultCount, results, MAX_MATCHING_FACTS);
+		return ((status == SOLVE_OK) || (status == SOLVE_BUFFER_EXHAUSTED));
+	}
+
+#ifndef Arduino_h
+	// int8 counter version of above for callers of the embedded API. (rcount is int8 on embedded systems)
+	// at most 127 results are written.
+	bool SolveQuery(const Fact *query, int8 *resultCount, Fact *results)
+	{
+		rcount count = *resultCount;
+		SolveStatus status = this->SolveQuery(query, &count, results, (MAX_MATCHING_FACTS < 127) ? MAX_MATCHING_FACTS : 127);
+
+		*resultCount = (int8)count;
+		return ((status == SOLVE_OK) || (status == SOLVE_BUFFER_EXHAUSTED));
+	}
+#endif
+
+#ifndef Arduino_h
+
+	static bool AddResultVisitor(const Fact *solution, void *userData)
+	{
+		ResultVectorCollector *collector = (ResultVectorCollector*)userData;
+
+		if (!collector->results->Add(solution))
+		{
+			collector->exhausted = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	// appends all solutions of the query into results.
+	// returns SOLVE_BUFFER_EXHAUSTED if results cannot grow anymore.
+	SolveStatus SolveQuery(const Fact *query, ResultVector *results)
+	{
+		QuerySession session;
+		this->GetSession(&session);
+
+		return this->SolveQuery(query, results, &session);
+	}
+
+	// thread-safe version of above. (see VisitSolutions with QuerySession)
+	SolveStatus SolveQuery(const Fact *query, ResultVector *results, const QuerySession *session) const
+	{
+		ResultVectorCollector collector;
+		collector.results = results;
+		collector.exhausted = false;
+
+		SolveStatus status = this->VisitSolutions(query, HazeProlog::AddResultVisitor, &collector, session);
+
+		return collector.exhausted ? SOLVE_BUFFER_EXHAUSTED : status;
+	}
+
+#endif
+
+	// if query has one var then print first term of result
+	// if query has two vars then print both terms of result
+	// if query has no vars then print true
+	static void PrintResultAccordingToQuery(const Fact *query, const Fact *result)
+	{
+		int8 varCount = HazeProlog::GetVariableCountOfQuery(query);
+
+		if (varCount == 0)
+		{
+			PRINT("true");
+		}
+		else if (varCount == 1)
+		{
+			PRINT(result->term1Name);
+		}
+		else if (varCount == 2)
+		{
+			PRINT(result->term1Name);
+			PRINT(", ");
+			PRINT(result->term2Name);
+		}
+
+		PRINT("\n");
+	}
+
+	static bool PrintResultVisitor(const Fact *solution, void *userData)
+	{
+		HazeProlog::PrintResultAccordingToQuery((const Fact*)userData, solution);
+		return true;
+	}
+
+#ifdef ENABLE_SERIAL_PARSER
+
+	static uint8_t ReadStringFromSerial(char *buffer)
+	{
+		uint8_t inIndex = 0;
+
+		while (!Serial.available()){} // wait till we receive data
+
+		while (Serial.available() > 0)
+		{
+			buffer[inIndex] = Serial.read();
+			++inIndex;
+		}
+
+		buffer[inIndex] = 0; // null termination
+		return inIndex;
+	}
+
+#ifdef INTERNED_SYMBOLS
+	// symbols of the knowledge base. names of serial queries are replaced with their canonical names.
+	void SetSymbolTable(const SymbolTable *symbols)
+	{
+		this->symbols = symbols;
+	}
+#endif
+
+	// Serial Monitor Options: No line ending
+	void EvalSerialInput()
+	{
+		char inData[40];
+		uint8_t inLength = HazeProlog::ReadStringFromSerial(inData);
+
+		if (inLength > 0)
+		{
+			char* parenthesStart = strchr(inData, '(');
+			if (parenthesStart)
+			{
+				char* parenthesEnd = strchr(inData, ')');
+				if (parenthesEnd)
+				{
+					char* comma = strchr(inData, ',');
+					bool hasComma = (comma == 0) ? false : true;
+
+					Fact query;
+					query.termCount = hasComma ? 2 : 1;
+
+					query.predicateName = inData;
+					*parenthesStart = 0;
+
+					query.term1Name = parenthesStart + 1;
+					*parenthesEnd = 0;
+
+					if (hasComma) // two terms
+					{
+						*comma = 0;
+						query.term2Name = comma + 1;
+					}
+					else
+					{
+						query.isTerm2Var = false;
+						query.term2Name = "";
+					}
+
+					query.nextFact = 0;
+
+					HazeProlog::FixVariableFlags(&query);
+
+#ifdef INTERNED_SYMBOLS
+					if (symbols)
+						symbols->InternQuery(&query); // unknown names have no matches
+#endif
+
+					if (!this->SolveQuery(&query, HazeProlog::PrintResultVisitor, &query)) // results are printed while solving, no buffer required.
+						Serial.println("no results!");
+
+					return;
+				}
+			}
+		}
+
+		Serial.println("Invalid query!");
+	}
+
+#endif
+
+};
+
+struct DynamicFactEntry
+{
+	Fact fact;
+	int next[3]; // next entry of each key chain. (-1 = end of chain)
+	int prev[3]; // previous entry of each key chain. (prev[0] links retracted entries)
+	bool isRetracted;
+	int8 tag; // set by the caller. (DatalogEvaluator marks derived facts)
+};
+
+// fact store which can be changed while the program runs. pass to HazeProlog::SetFactSource.
+// facts are chained by the same keys as FactIndex, so Assert and Retract of a fact are O(1).
+// a retracted entry keeps its links, so searches which are visiting it continue with the next fact.
+// retracted entries are reused after ReclaimFacts. (call it when no query is running)
+// storage is fixed by SetStorage. names are not copied, so they must live while the fact is stored.
+// (clear persistent answer tables after changing facts)
+class DynamicFactStore : public FactSource
+{
+protected:
+	DynamicFactEntry *entries;
+	int maxEntries;
+	int usedCount; // entries which were used at least once
+	int factCount;
+	int freeEntry; // chain of reusable entries. (linked by next[0])
+	int retiredEntry; // chain of retracted entries. (linked by prev[0])
+	int *buckets; // heads of 3 key chains, followed by their tails
+	unsigned int bucketCount; // power of two
+	unsigned int version;
+
+	int* GetHead(int key, const Fact *fact) const
+	{
+		return &buckets[key * bucketCount + (FactIndex::GetKeyHash(key, fact) & (bucketCount - 1))];
+	}
+
+	int* GetTail(int key, const Fact *fact) const
+	{
+		return &buckets[(3 + key) * bucketCount + (FactIndex::GetKeyHash(key, fact) & (bucketCount - 1))];
+	}
+
+	void Link(int entry, int key)
+	{
+		DynamicFactEntry *item = &entries[entry];
+		int *head = this->GetHead(key, &item->fact);
+		int *tail = this->GetTail(key, &item->fact);
+
+		item->next[key] = -1;
+		item->prev[key] = *tail;
+
+		if (*tail == -1)
+			*head = entry;
+		else
+			entries[*tail].next[key] = entry;
+
+		*tail = entry;
+	}
+
+	// next link of the entry is kept for the searches which are visiting it.
+	void Unlink(int entry, int key)
+	{
+		DynamicFactEntry *item = &entries[entry];
+
+		if (item->prev[key] == -1)
+			*this->GetHead(key, &item->fact) = item->next[key];
+		else
+			entries[item->prev[key]].next[key] = item->next[key];
+
+		if (item->next[key] == -1)
+			*this->GetTail(key, &item->fact) = item->prev[key];
+		else
+			entries[item->next[key]].prev[key] = item->prev[key];
+	}
+
+	// variables of the pattern match any term.
+	static bool IsPatternMatch(const Fact *pattern, const Fact *fact)
+	{
+		return (pattern->termCount == fact->termCount)
+			&& HazeProlog::StringCompare(pattern->predicateName, fact->predicateName)
+			&& (pattern->isTerm1Var || HazeProlog::StringCompare(pattern->term1Name, fact->term1Name))
+			&& ((pattern->termCount != 2) || pattern->isTerm2Var || HazeProlog::StringCompare(pattern->term2Name, fact->term2Name));
+	}
+
+	// picks the most selective key for the query. returns first entry of its chain or -1.
+	int GetFirstEntry(const Fact *query, int *key) const
+	{
+		if (!query->isTerm1Var)
+			*key = FactIndex::KEY_TERM1;
+		else if ((query->termCount == 2) && (!query->isTerm2Var))
+			*key = FactIndex::KEY_TERM2;
+		else
+			*key = FactIndex::KEY_PREDICATE;
+
+		return *this->GetHead(*key, query);
+	}
+
+	int FindFact(const Fact *pattern) const
+	{
+		int key;
+		for (int entry = this->GetFirstEntry(pattern, &key); entry != -1; entry = entries[entry].next[key])
+		{
+			if ((!entries[entry].isRetracted) && DynamicFactStore::IsPatternMatch(pattern, &entries[entry].fact))
+				return entry;
+		}
+
+		return -1;
+	}
+
+	void RetractEntry(int entry)
+	{
+		DynamicFactEntry *item = &entries[entry];
+
+		this->Unlink(entry, FactIndex::KEY_PREDICATE);
+		this->Unlink(entry, FactIndex::KEY_TERM1);
+		if (item->fact.termCount == 2)
+			this->Unlink(entry, FactIndex::KEY_TERM2);
+
+		item->isRetracted = true;
+		item->prev[0] = retiredEntry;
+		retiredEntry = entry;
+
+		--factCount;
+		++version;
+	}
+
+public:
+
+	DynamicFactStore()
+	{
+		entries = 0;
+		maxEntries = 0;
+		buckets = 0;
+		bucketCount = 0;
+		version = 0;
+		this->Clear();
+	}
+
+	// buckets must have room for (6 * bucketCount) items. bucketCount must be a power of two. (use a value close to fact count)
+	void SetStorage(DynamicFactEntry *entries, int maxEntries, int *buckets, unsigned int bucketCount)
+	{
+		this->entries = entries;
+		this->maxEntries = maxEntries;
+		this->buckets = buckets;
+		this->bucketCount = bucketCount;
+		this->Clear();
+	}
+
+	// removes all facts. (call when no query is running)
+	void Clear()
+	{
+		usedCount = 0;
+		factCount = 0;
+		freeEntry = -1;
+		retiredEntry = -1;
+
+		for (unsigned int i = 0; i < (6 * bucketCount); ++i)
+			buckets[i] = -1;
+
+		++version;
+	}
+
+	// adds the fact after the facts of the same key. returns false if the store is full.
+	bool Assert(const Fact *fact)
+	{
+		return this->Assert(fact, 0);
+	}
+
+	bool Assert(const Fact *fact, int8 tag)
+	{
+		int entry = freeEntry;
+
+		if (entry != -1)
+			freeEntry = entries[entry].next[0];
+		else if (usedCount < maxEntries)
+			entry = usedCount++;
+		else
+			return false;
+
+		DynamicFactEntry *item = &entries[entry];
+		item->fact = *fact;
+		item->fact.nextFact = 0;
+		item->isRetracted = false;
+		item->tag = tag;
+
+		this->Link(entry, FactIndex::KEY_PREDICATE);
+		this->Link(entry, FactIndex::KEY_TERM1);
+		item->next[FactIndex::KEY_TERM2] = -1;
+		if (fact->termCount == 2)
+			this->Link(entry, FactIndex::KEY_TERM2);
+
+		++factCount;
+		++version;
+		return true;
+	}
+
+	// removes first fact which matches the pattern. variables of the pattern match any term.
+	// returns false if there is no such fact.
+	bool Retract(const Fact *pattern)
+	{
+		int entry = this->FindFact(pattern);
+		if (entry == -1)
+			return false;
+
+		this->RetractEntry(entry);
+		return true;
+	}
+
+	// removes all facts which match the pattern. returns removed fact count.
+	int RetractAll(const Fact *pattern)
+	{
+		int count = 0;
+		int key;
+
+		for (int entry = this->GetFirstEntry(pattern, &key); entry != -1; entry = entries[entry].next[key])
+		{
+			if ((!entries[entry].isRetracted) && DynamicFactStore::IsPatternMatch(pattern, &entries[entry].fact))
+			{
+				this->RetractEntry(entry);
+				++count;
+			}
+		}
+
+		return count;
+	}
+
+	// returns tag of the first fact which matches the pattern, or -1 if there is no such fact.
+	int GetTag(const Fact *pattern) const
+	{
+		int entry = this->FindFact(pattern);
+		return (entry == -1) ? -1 : entries[entry].tag;
+	}
+
+	// returns false if there is no fact which matches the pattern.
+	bool SetTag(const Fact *pattern, int8 tag)
+	{
+		int entry = this->FindFact(pattern);
+		if (entry == -1)
+			return false;
+
+		entries[entry].tag = tag;
+		return true;
+	}
+
+	// makes retracted entries available to Assert. must not be called while a query is running.
+	void ReclaimFacts()
+	{
+		while (retiredEntry != -1)
+		{
+			int entry = retiredEntry;
+			retiredEntry = entries[entry].prev[0];
+
+			entries[entry].next[0] = freeEntry;
+			freeEntry = entry;
+		}
+	}
+
+	int GetFactCount() const
+	{
+		return factCount;
+	}
+
+	virtual bool VisitMatchingFacts(const Fact *query, FactVisitor visitor, void *userData) const
+	{
+		int key;
+
+		// next link is read after the visitor, so facts retracted by the visitor are skipped
+		for (int entry = this->GetFirstEntry(query, &key); entry != -1; entry = entries[entry].next[key])
+		{
+			const DynamicFactEntry *item = &entries[entry];
+
+			if ((!item->isRetracted) && HazeProlog::IsMatchingFact(query, &item->fact))
+			{
+				if (!visitor(&item->fact, userData))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	// like VisitMatchingFacts, but variables of the pattern match any term. (pred(X , Y) also visits pred(a , a))
+	bool VisitPatternFacts(const Fact *pattern, FactVisitor visitor, void *userData) const
+	{
+		int key;
+
+		for (int entry = this->GetFirstEntry(pattern, &key); entry != -1; entry = entries[entry].next[key])
+		{
+			const DynamicFactEntry *item = &entries[entry];
+
+			if ((!item->isRetracted) && DynamicFactStore::IsPatternMatch(pattern, &item->fact))
+			{
+				if (!visitor(&item->fact, userData))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	virtual unsigned int GetVersion() const
+	{
+		return version;
+	}
+
+private:
+	DynamicFactStore(const DynamicFactStore&);
+	DynamicFactStore& operator=(const DynamicFactStore&);
+};
+
+// terms which a ColumnarFactStore scan compares.
+struct ColumnScanFilter
+{
+	symbolid term1; // 0 if term1 is a variable
+	symbolid term2; // 0 if term2 is a variable
+	bool bothVariables; // pred(X , X) or pred(X , Y)
+	bool sameVariables; // pred(X , X)
+};
+
+struct FactColumnTable
+{
+	symbolid predicate;
+	int8 termCount;
+	int firstRow; // rows of the table in the term columns
+	int rowCount;
+};
+
+// read-only copy of a fact chain with one table per (predicate, termCount). a table is a contiguous range of
+// rows in two columns of term ids, so scans read dense id arrays instead of fact records. (2 * sizeof(symbolid) per fact)
+// rows keep the order of the fact chain. bound terms are compared while scanning, so use FactIndex for point lookups.
+// ids come from the SymbolTable of Build, which must be kept. pass to HazeProlog::SetFactSource.
+class ColumnarFactStore : public FactSource
+{
+protected:
+	const SymbolTable *symbols;
+	FactColumnTable *tables;
+	int maxTables;
+	int tableCount;
+	symbolid *term1Ids;
+	symbolid *term2Ids; // id of "" for single term facts
+	int maxRows;
+	int rowCount;
+
+	static unsigned long ScanRowsScalar(const symbolid *column1, const symbolid *column2, int count, const ColumnScanFilter *filter)
+	{
+		unsigned long mask = 0;
+
+		for (int i = 0; i < count; ++i)
+		{
+			bool match = ((!filter->term1) || (column1[i] == filter->term1))
+				&& ((!filter->term2) || (column2[i] == filter->term2))
+				&& ((!filter->bothVariables) || ((column1[i] == column2[i]) == filter->sameVariables));
+
+			mask |= (unsigned long)match << i;
+		}
+
+		return mask;
+	}
+
+	int FindTableIndex(symbolid predicate, int8 termCount) const
+	{
+		for (int i = 0; i < tableCount; ++i)
+		{
+			if ((tables[i].predicate == predicate) && (tables[i].termCount == termCount))
+				return i;
+		}
+
+		return -1;
+	}
+
+public:
+
+	ColumnarFactStore()
+	{
+		symbols = 0;
+		tables = 0;
+		maxTables = 0;
+		tableCount = 0;
+		term1Ids = 0;
+		term2Ids = 0;
+		maxRows = 0;
+		rowCount = 0;
+	}
+
+	// tables must have room for all (predicate, termCount) pairs. columns must have room for all facts.
+	void SetStorage(FactColumnTable *tables, int maxTables, symbolid *term1Ids, symbolid *term2Ids, int maxRows)
+	{
+		this->tables = tables;
+		this->maxTables = maxTables;
+		this->term1Ids = term1Ids;
+		this->term2Ids = term2Ids;
+		this->maxRows = maxRows;
+		this->tableCount = 0;
+		this->rowCount = 0;
+	}
+
+	// names of the facts are interned into symbols. returns false if storage or symbol table is full.
+	bool Build(const Fact *firstFact, SymbolTable *symbols)
+	{
+		this->symbols = symbols;
+		tableCount = 0;
+		rowCount = 0;
+
+		// count rows of each table. (consecutive facts usually have the same predicate)
+		int lastTable = -1;
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			symbolid predicate = symbols->Intern(fact->predicateName);
+			if (!predicate)
+				return false;
+
+			if ((lastTable == -1) || (tables[lastTable].predicate != predicate) || (tables[lastTable].termCount != fact->termCount))
+				lastTable = this->FindTableIndex(predicate, fact->termCount);
+
+			if (lastTable == -1)
+			{
+				if (tableCount == maxTables)
+					return false;
+
+				lastTable = tableCount++;
+				tables[lastTable].predicate = predicate;
+				tables[lastTable].termCount = fact->termCount;
+				tables[lastTable].rowCount = 0;
+			}
+
+			if (rowCount == maxRows)
+				return false;
+
+			++tables[lastTable].rowCount;
+			++rowCount;
+		}
+
+		// rowCount of each table is used as fill position until all rows are written
+		int firstRow = 0;
+		for (int i = 0; i < tableCount; ++i)
+		{
+			tables[i].firstRow = firstRow;
+			firstRow += tables[i].rowCount;
+			tables[i].rowCount = 0;
+		}
+
+		lastTable = -1;
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			symbolid predicate = symbols->Find(fact->predicateName);
+
+			if ((lastTable == -1) || (tables[lastTable].predicate != predicate) || (tables[lastTable].termCount != fact->termCount))
+				lastTable = this->FindTableIndex(predicate, fact->termCount);
+
+			FactColumnTable *table = &tables[lastTable];
+			int row = table->firstRow + table->rowCount;
+
+			term1Ids[row] = symbols->Intern(fact->term1Name);
+			term2Ids[row] = symbols->Intern((fact->termCount == 2) ? fact->term2Name : "");
+
+			if ((!term1Ids[row]) || (!term2Ids[row]))
+				return false;
+
+			++table->rowCount;
+		}
+
+		return true;
+	}
+
+	int GetTableCount() const
+	{
+		return tableCount;
+	}
+
+	const FactColumnTable* GetTable(int index) const
+	{
+		return &tables[index];
+	}
+
+	// returns 0 if there are no facts of the predicate.
+	const FactColumnTable* FindTable(const char *predicateName, int8 termCount) const
+	{
+		symbolid predicate = symbols ? symbols->Find(predicateName) : 0;
+		int index = predicate ? this->FindTableIndex(predicate, termCount) : -1;
+
+		return (index == -1) ? 0 : &tables[index];
+	}
+
+	const symbolid* GetTerm1Column(const FactColumnTable *table) const
+	{
+		return &term1Ids[table->firstRow];
+	}
+
+	const symbolid* GetTerm2Column(const FactColumnTable *table) const
+	{
+		return &term2Ids[table->firstRow];
+	}
+
+	// returns bit i set if row i of the columns matches the filter. (count <= 32)
+	// compares 8 (AVX2) or 4 (SSE2) ids per instruction when symbolid is 32 bits.
+	static unsigned long ScanRows(const symbolid *column1, const symbolid *column2, int count, const ColumnScanFilter *filter)
+	{
+#if defined(SIMD_SCAN_AVX2)
+		if ((sizeof(symbolid) == 4) && (count == 32))
+		{
+			const __m256i term1 = _mm256_set1_epi32((int)filter->term1);
+			const __m256i term2 = _mm256_set1_epi32((int)filter->term2);
+			const __m256i allOnes = _mm256_set1_epi32(-1);
+			unsigned long mask = 0;
+
+			for (int i = 0; i < 32; i += 8)
+			{
+				__m256i match = allOnes;
+
+				// columns which are not compared are not loaded
+				if (filter->term1)
+					match = _mm256_and_si256(match, _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(column1 + i)), term1));
+
+				if (filter->term2)
+					match = _mm256_and_si256(match, _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(column2 + i)), term2));
+
+				if (filter->bothVariables)
+				{
+					__m256i same = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(column1 + i)), _mm256_loadu_si256((const __m256i*)(column2 + i)));
+					match = filter->sameVariables ? _mm256_and_si256(match, same) : _mm256_andnot_si256(same, match);
+				}
+
+				mask |= (unsigned long)_mm256_movemask_ps(_mm256_castsi256_ps(match)) << i;
+			}
+
+			return mask;
+		}
+#elif defined(SIMD_SCAN_SSE2)
+		if ((sizeof(symbolid) == 4) && (count == 32))
+		{
+			const __m128i term1 = _mm_set1_epi32((int)filter->term1);
+			const __m128i term2 = _mm_set1_epi32((int)filter->term2);
+			const __m128i allOnes = _mm_set1_epi32(-1);
+			unsigned long mask = 0;
+
+			for (int i = 0; i < 32; i += 4)
+			{
+				__m128i match = allOnes;
+
+				// columns which are not compared are not loaded
+				if (filter->term1)
+					match = _mm_and_si128(match, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(column1 + i)), term1));
+
+				if (filter->term2)
+					match = _mm_and_si128(match, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(column2 + i)), term2));
+
+				if (filter->bothVariables)
+				{
+					__m128i same = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(column1 + i)), _mm_loadu_si128((const __m128i*)(column2 + i)));
+					match = filter->sameVariables ? _mm_and_si128(match, same) : _mm_andnot_si128(same, match);
+				}
+
+				mask |= (unsigned long)_mm_movemask_ps(_mm_castsi128_ps(match)) << i;
+			}
+
+			return mask;
+		}
+#endif
+		return ColumnarFactStore::ScanRowsScalar(column1, column2, count, filter);
+	}
+
+	bool VisitMatchingFacts(const Fact *query, FactVisitor visitor, void *userData) const
+	{
+		const FactColumnTable *table = this->FindTable(query->predicateName, query->termCount);
+		if (!table)
+			return true;
+
+		bool term1Bound = !query->isTerm1Var;
+		bool term2Bound = (query->termCount == 2) && (!query->isTerm2Var);
+
+		symbolid term1 = term1Bound ? symbols->Find(query->term1Name) : 0;
+		symbolid term2 = term2Bound ? symbols->Find(query->term2Name) : 0;
+
+		if ((term1Bound && (!term1)) || (term2Bound && (!term2))) // unknown names can not match
+			return true;
+
+		ColumnScanFilter filter;
+		filter.term1 = term1;
+		filter.term2 = term2;
+		filter.bothVariables = (query->termCount == 2) && (!term1Bound) && (!term2Bound);
+		filter.sameVariables = filter.bothVariables && HazeProlog::StringCompare(query->term1Name, query->term2Name);
+
+		const symbolid *column1 = this->GetTerm1Column(table);
+		const symbolid *column2 = this->GetTerm2Column(table);
+
+		for (int blockRow = 0; blockRow < table->rowCount; blockRow += 32) // 32 rows for each mask
+		{
+			int count = ((table->rowCount - blockRow) < 32) ? (table->rowCount - blockRow) : 32;
+			unsigned long mask = ColumnarFactStore::ScanRows(column1 + blockRow, column2 + blockRow, count, &filter);
+
+			for (int i = 0; mask; ++i, mask >>= 1)
+			{
+				if (!(mask & 1))
+					continue;
+
+				int row = blockRow + i;
+
+				Fact fact;
+				fact.termCount = table->termCount;
+				fact.predicateName = symbols->GetName(table->predicate);
+				fact.isTerm1Var = false;
+				fact.term1Name = symbols->GetName(column1[row]);
+				fact.isTerm2Var = false;
+				fact.term2Name = symbols->GetName(column2[row]);
+				fact.nextFact = 0;
+
+				if (!visitor(&fact, userData))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+private:
+	ColumnarFactStore(const ColumnarFactStore&);
+	ColumnarFactStore& operator=(const ColumnarFactStore&);
+};
+
+// computes facts of rules bottom-up into a DynamicFactStore. queries of derived predicates become fact lookups.
+// semi-naive: after the first round, only the facts derived in the previous round (delta) are joined with the store.
+// goals are unified with facts by binding their variables, so pred(X , Y) also matches pred(a , a) and the derived facts
+// do not depend on the join order. rules whose head variables are not bound by the body are skipped.
+// delta storage is supplied by the caller.
+// after Evaluate, AddFact and RemoveFact keep the derived facts up to date by propagating only the changed facts.
+// (store holds the same facts as a new Evaluate of the changed facts. rederived goals are unified like in Evaluate)
+// removal is delete-rederive: facts derived from the removed fact are removed, then the ones with another derivation
+// are derived again. (derived facts are tagged in the store, so they are not changed by DynamicFactStore::Assert)
+class DatalogEvaluator
+{
+protected:
+	enum { MAX_BINDINGS = 6 }; // all names of a rule
+	enum { TAG_FACT = 0, TAG_DERIVED = 1, TAG_REMOVING = 2 };
+	enum { MODE_INSERT = 0, MODE_REMOVE, MODE_REDERIVE };
+
+	struct Bindings
+	{
+		const char *variables[MAX_BINDINGS];
+		const char *values[MAX_BINDINGS];
+		int count;
+	};
+
+	struct JoinFrame
+	{
+		DatalogEvaluator *evaluator;
+		const Rule *rule;
+		const Fact *goal; // goal which is matched by the visited facts
+		const Fact *otherGoal; // 0 if rule has a single goal
+		const Bindings *bindings;
+	};
+
+	const Rule *firstRule;
+	DynamicFactStore *store;
+	Fact *delta; // facts derived in the previous round
+	Fact *nextDelta;
+	int maxDeltaFacts;
+	int deltaCount;
+	int nextDeltaCount;
+	Fact *removed; // facts removed by RemoveFact (before rederive)
+	int maxRemovedFacts;
+	int removedCount;
+	int mode;
+	int roundCount;
+	int derivedCount;
+	bool isFull;
+	bool isRederived;
+
+	static const char* FindValue(const Bindings *bindings, const char *variable)
+	{
+		for (int i = 0; i < bindings->count; ++i)
+		{
+			if (HazeProlog::StringCompare(bindings->variables[i], variable))
+				return bindings->values[i];
+		}
+
+		return 0;
+	}
+
+	static bool Bind(Bindings *bindings, const char *variable, const char *value)
+	{
+		const char *boundValue = DatalogEvaluator::FindValue(bindings, variable);
+
+		if (boundValue)
+			return HazeProlog::StringCompare(boundValue, value);
+
+		if (bindings->count == MAX_BINDINGS)
+			return false;
+
+		bindings->variables[bindings->count] = variable;
+		bindings->values[bindings->count] = value;
+		++bindings->count;
+
+		return true;
+	}
+
+	// binds variables of the goal to terms of the fact. returns false if a variable is bound to another term.
+	static bool BindGoal(Bindings *bindings, const Fact *goal, const Fact *fact)
+	{
+		if (goal->isTerm1Var && (!DatalogEvaluator::Bind(bindings, goal->term1Name, fact->term1Name)))
+			return false;
+
+		if ((goal->termCount == 2) && goal->isTerm2Var && (!DatalogEvaluator::Bind(bindings, goal->term2Name, fact->term2Name)))
+			return false;
+
+		return true;
+	}
+
+	// unifies a rule head or goal with the fact. constant terms must be equal to the fact. (pred(X , X) matches equal terms)
+	static bool BindHead(Bindings *bindings, const Fact *head, const Fact *fact)
+	{
+		if ((head->termCount != fact->termCount) || (!HazeProlog::StringCompare(head->predicateName, fact->predicateName)))
+			return false;
+
+		if ((!head->isTerm1Var) && (!HazeProlog::StringCompare(head->term1Name, fact->term1Name)))
+			return false;
+
+		if ((head->termCount == 2) && (!head->isTerm2Var) && (!HazeProlog::StringCompare(head->term2Name, fact->term2Name)))
+			return false;
+
+		return DatalogEvaluator::BindGoal(bindings, head, fact);
+	}
+
+	// replaces bound variables of the fact with their values. returns false if a variable is not bound and mustBind is set.
+	static bool Substitute(const Bindings *bindings, const Fact *input, Fact *output, bool mustBind)
+	{
+		*output = *input;
+		output->nextFact = 0;
+
+		if (input->isTerm1Var)
+		{
+			const char *value = DatalogEvaluator::FindValue(bindings, input->term1Name);
+
+			if (value)
+			{
+				output->term1Name = value;
+				output->isTerm1Var = false;
+			}
+			else if (mustBind)
+				return false;
+		}
+
+		if ((input->termCount == 2) && input->isTerm2Var)
+		{
+			const char *value = DatalogEvaluator::FindValue(bindings, input->term2Name);
+
+			if (value)
+			{
+				output->term2Name = value;
+				output->isTerm2Var = false;
+			}
+			else if (mustBind)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool AddDelta(const Fact *fact)
+	{
+		if (nextDeltaCount == maxDeltaFacts)
+		{
+			isFull = true;
+			return false;
+		}
+
+		nextDelta[nextDeltaCount++] = *fact;
+		return true;
+	}
+
+	// inserts the head of the rule if it is a new fact. (marks it if a removal is propagated)
+	void Derive(const Rule *rule, const Bindings *bindings)
+	{
+		Fact fact;
+		if (!DatalogEvaluator::Substitute(bindings, &rule->head, &fact, true)) // head variable is not bound by the body
+			return;
+
+		int tag = store->GetTag(&fact);
+
+		if (mode == MODE_REMOVE)
+		{
+			// facts which are not derived stay. (marked facts are already removed)
+			if ((tag == TAG_DERIVED) && this->AddDelta(&fact))
+				store->SetTag(&fact, TAG_REMOVING);
+
+			return;
+		}
+
+		if (tag != -1)
+			return;
+
+		if (!store->Assert(&fact, TAG_DERIVED))
+		{
+			isFull = true;
+			return;
+		}
+
+		if (!this->AddDelta(&fact))
+			return;
+
+		++derivedCount;
+		isRederived = true;
+	}
+
+	static bool JoinVisitor(const Fact *fact, void *userData)
+	{
+		JoinFrame *frame = (JoinFrame*)userData;
+		DatalogEvaluator *evaluator = frame->evaluator;
+
+		Bindings bindings = *frame->bindings;
+		if (!DatalogEvaluator::BindHead(&bindings, frame->goal, fact))
+			return true;
+
+		if (!frame->otherGoal)
+		{
+			evaluator->Derive(frame->rule, &bindings);
+			return (!evaluator->isFull) && ((evaluator->mode != MODE_REDERIVE) || (!evaluator->isRederived));
+		}
+
+		// second goal with the variables bound by this fact
+		Fact query;
+		DatalogEvaluator::Substitute(&bindings, frame->otherGoal, &query, false);
+
+		JoinFrame otherFrame;
+		otherFrame.evaluator = evaluator;
+		otherFrame.rule = frame->rule;
+		otherFrame.goal = frame->otherGoal;
+		otherFrame.otherGoal = 0;
+		otherFrame.bindings = &bindings;
+
+		return evaluator->store->VisitPatternFacts(&query, DatalogEvaluator::JoinVisitor, &otherFrame);
+	}
+
+	// goal is matched by store facts, or by delta facts if useDelta is set. otherGoal is matched by store facts.
+	void EvaluateGoals(const Rule *rule, const Fact *goal, const Fact *otherGoal, const Bindings *bindings, bool useDelta)
+	{
+		JoinFrame frame;
+		frame.evaluator = this;
+		frame.rule = rule;
+		frame.goal = goal;
+		frame.otherGoal = otherGoal;
+		frame.bindings = bindings;
+
+		if (!useDelta)
+		{
+			Fact query;
+			DatalogEvaluator::Substitute(bindings, goal, &query, false);
+
+			store->VisitPatternFacts(&query, DatalogEvaluator::JoinVisitor, &frame);
+			return;
+		}
+
+		for (int i = 0; (i < deltaCount) && (!isFull); ++i)
+			DatalogEvaluator::JoinVisitor(&delta[i], &frame);
+	}
+
+	void EvaluateRule(const Rule *rule, const Bindings *bindings, bool useDelta)
+	{
+		if (rule->factCountInBody == 1)
+		{
+			this->EvaluateGoals(rule, &rule->fact1, 0, bindings, useDelta);
+		}
+		else if (!rule->op1IsAnd) // OR
+		{
+			this->EvaluateGoals(rule, &rule->fact1, 0, bindings, useDelta);
+			this->EvaluateGoals(rule, &rule->fact2, 0, bindings, useDelta);
+		}
+		else if (useDelta) // new facts come from a delta fact at either goal
+		{
+			this->EvaluateGoals(rule, &rule->fact1, &rule->fact2, bindings, true);
+			this->EvaluateGoals(rule, &rule->fact2, &rule->fact1, bindings, true);
+		}
+		else
+		{
+			this->EvaluateGoals(rule, &rule->fact1, &rule->fact2, bindings, false);
+		}
+	}
+
+	void SwapDelta()
+	{
+		Fact *swap = delta;
+		delta = nextDelta;
+		nextDelta = swap;
+
+		deltaCount = nextDeltaCount;
+		nextDeltaCount = 0;
+	}
+
+	// joins the delta with the store until no new fact is found. (first round uses all facts if useDelta is not set)
+	bool Propagate(bool useDelta)
+	{
+		Bindings bindings = Bindings();
+
+		do
+		{
+			for (const Rule *rule = firstRule; rule && (!isFull); rule = rule->nextRule)
+				this->EvaluateRule(rule, &bindings, useDelta);
+
+			if (isFull)
+				return false;
+
+			this->SwapDelta();
+			useDelta = true;
+			++roundCount;
+		} while (deltaCount != 0);
+
+		return true;
+	}
+
+	// derives the fact again if a rule body is true without the removed facts.
+	void Rederive(const Fact *fact)
+	{
+		for (const Rule *rule = firstRule; rule && (!isFull); rule = rule->nextRule)
+		{
+			Bindings bindings = Bindings();
+
+			if (!DatalogEvaluator::BindHead(&bindings, &rule->head, fact))
+				continue;
+
+			isRederived = false;
+			this->EvaluateRule(rule, &bindings, false);
+
+			if (isRederived)
+				return;
+		}
+	}
+
+	void Reset()
+	{
+		deltaCount = 0;
+		nextDeltaCount = 0;
+		removedCount = 0;
+		mode = MODE_INSERT;
+		roundCount = 0;
+		derivedCount = 0;
+		isFull = false;
+	}
+
+public:
+
+	DatalogEvaluator()
+	{
+		firstRule = 0;
+		store = 0;
+		delta = 0;
+		nextDelta = 0;
+		maxDeltaFacts = 0;
+		removed = 0;
+		maxRemovedFacts = 0;
+		isRederived = false;
+		this->Reset();
+	}
+
+	// delta buffers must have room for the facts derived in a single round.
+	void SetStorage(Fact *delta, Fact *nextDelta, int maxDeltaFacts)
+	{
+		this->delta = delta;
+		this->nextDelta = nextDelta;
+		this->maxDeltaFacts = maxDeltaFacts;
+	}
+
+	// needed by RemoveFact. must have room for all facts which depend on a removed fact.
+	void SetRemovalStorage(Fact *removed, int maxRemovedFacts)
+	{
+		this->removed = removed;
+		this->maxRemovedFacts = maxRemovedFacts;
+	}
+
+	// asserts the facts into the store and adds facts of the rules until no new fact can be derived.
+	// afterwards query the store without rules. (SetRuleFactDefinitions(0, 0) and SetFactSource)
+	// rules and store are kept for AddFact and RemoveFact. returns false if store or delta buffers became full.
+	bool Evaluate(const Rule *firstRule, const Fact *firstFact, DynamicFactStore *store)
+	{
+		this->firstRule = firstRule;
+		this->store = store;
+		this->Reset();
+
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			if (!store->Assert(fact, TAG_FACT))
+				return false;
+		}
+
+		return this->Propagate(false);
+	}
+
+	// asserts the fact and derives the facts which follow from it.
+	// returns false if store or delta buffers became full. (clear the store and call Evaluate again)
+	bool AddFact(const Fact *fact)
+	{
+		this->Reset();
+
+		int tag = store->GetTag(fact);
+		if (tag == TAG_DERIVED) // consequences are already derived
+			return store->SetTag(fact, TAG_FACT);
+		else if (tag != -1)
+			return true;
+
+		if ((!store->Assert(fact, TAG_FACT)) || (!this->AddDelta(fact)))
+			return false;
+
+		this->SwapDelta();
+		return this->Propagate(true);
+	}
+
+	// retracts the fact and the derived facts which are not derivable without it.
+	// returns false if the fact was not added, or if storage became full. (clear the store and call Evaluate again)
+	// retracted entries are reused after DynamicFactStore::ReclaimFacts.
+	bool RemoveFact(const Fact *fact)
+	{
+		this->Reset();
+
+		if ((store->GetTag(fact) != TAG_FACT) || (!this->AddDelta(fact)))
+			return false;
+
+		store->SetTag(fact, TAG_REMOVING);
+		this->SwapDelta();
+
+		// marks the facts derived from removed facts. (store still holds all of them)
+		mode = MODE_REMOVE;
+		while (deltaCount != 0)
+		{
+			if (removedCount + deltaCount > maxRemovedFacts)
+				isFull = true;
+
+			for (int i = 0; (i < deltaCount) && (!isFull); ++i)
+				removed[removedCount++] = delta[i];
+
+			Bindings bindings = Bindings();
+
+			for (const Rule *rule = firstRule; rule && (!isFull); rule = rule->nextRule)
+				this->EvaluateRule(rule, &bindings, true);
+
+			this->SwapDelta();
+			++roundCount;
+		}
+
+		for (int i = 0; i < removedCount; ++i)
+			store->Retract(&removed[i]);
+
+		if (isFull)
+			return false;
+
+		// facts with another derivation are the delta of an insert
+		mode = MODE_REDERIVE;
+		for (int i = 0; (i < removedCount) && (!isFull); ++i)
+			this->Rederive(&removed[i]);
+
+		if (isFull)
+			return false;
+
+		mode = MODE_INSERT;
+		this->SwapDelta();
+
+		return (deltaCount == 0) || this->Propagate(true);
+	}
+
+	int GetRoundCount() const
+	{
+		return roundCount;
+	}
+
+	// facts derived by the last Evaluate, AddFact or RemoveFact.
+	int GetDerivedCount() const
+	{
+		return derivedCount;
+	}
+
+	// facts retracted by the last RemoveFact before they were derived again.
+	int GetRemovedCount() const
+	{
+		return removedCount;
+	}
+
+private:
+	DatalogEvaluator(const DatalogEvaluator&);
+	DatalogEvaluator& operator=(const DatalogEvaluator&);
+};
+
+// nesting limit of ClauseSolver goals. (each level uses stack)
+#ifndef MAX_CLAUSE_DEPTH
+#ifdef Arduino_h
+#define MAX_CLAUSE_DEPTH 16
+#else
+#define MAX_CLAUSE_DEPTH 1024
+#endif
+#endif
+
+struct ClauseTerm
+{
+	const char *name; // constant or variable name
+	int8 slot; // variable slot of the clause, or -1 for a constant
+};
+
+struct ClauseGoal
+{
+	const char *predicateName;
+	int8 termCount;
+	const ClauseTerm *terms;
+};
+
+// head :- body[0] , body[1] , ... (a fact has no body goals. alternatives are separate clauses with the same head)
+struct Clause
+{
+	ClauseGoal head;
+	int8 goalCount;
+	const ClauseGoal *body;
+	int8 slotCount; // variables of the clause. (slots are 0 to slotCount - 1)
+	const Clause *nextClause;
+};
+
+// variable binding of ClauseSolver. an unbound cell has no value and no ref.
+struct ClauseCell
+{
+	const char *value;
+	int ref; // cell which this variable is bound to, or -1
+};
+
+class ClauseSolver;
+
+// called for each solution of ClauseSolver::VisitSolutions. return false to stop the search.
+typedef bool (*ClauseVisitor)(const ClauseSolver *solver, void *userData);
+
+// solves clauses of any term and goal count. variables are slots of a binding environment, so goals are unified
+// term by term without copying rules. (HazeProlog stays the small solver of 2 term facts and 2 goal rules)
+// goals are solved depth first in clause order, like Prolog. a recursive clause must not call itself before its
+// other goals bind a term. (left recursion does not terminate) cells and trail are supplied by the caller.
+class ClauseSolver
+{
+protected:
+	// remaining goals of a clause body and the cells of its variables.
+	struct GoalFrame
+	{
+		const ClauseGoal *goals;
+		int8 goalCount;
+		int env;
+		const GoalFrame *next;
+	};
+
+	const Clause *firstClause;
+	ClauseCell *cells;
+	int maxCells;
+	int cellCount;
+	int *trail; // cells bound since the choice point
+	int maxTrail;
+	int trailCount;
+	const Clause *query;
+	int queryEnv;
+	ClauseVisitor visitor;
+	void *userData;
+	int depth;
+	bool stopped;
+	bool outOfMemory;
+	bool hasResults;
+
+	int Dereference(int cell) const
+	{
+		while ((cells[cell].ref != -1) && (!cells[cell].value))
+			cell = cells[cell].ref;
+
+		return cell;
+	}
+
+	bool BindValue(int cell, const char *value)
+	{
+		if (trailCount == maxTrail)
+		{
+			outOfMemory = true;
+			return false;
+		}
+
+		trail[trailCount++] = cell;
+		cells[cell].value = value;
+		return true;
+	}
+
+	// binds the younger cell, so bindings never point to cells which are released first.
+	bool BindRef(int cell1, int cell2)
+	{
+		if (cell1 == cell2)
+			return true;
+
+		if (trailCount == maxTrail)
+		{
+			outOfMemory = true;
+			return false;
+		}
+
+		int younger = (cell1 > cell2) ? cell1 : cell2;
+
+		trail[trailCount++] = younger;
+		cells[younger].ref = (cell1 > cell2) ? cell2 : cell1;
+		return true;
+	}
+
+	void Undo(int mark)
+	{
+		while (trailCount > mark)
+		{
+			int cell = trail[--trailCount];
+			cells[cell].value = 0;
+			cells[cell].ref = -1;
+		}
+	}
+
+	// value of the term in the environment. returns 0 and the unbound cell if the term is an unbound variable.
+	const char* Resolve(const ClauseTerm *term, int env, int *cell) const
+	{
+		if (term->slot == -1)
+			return term->name;
+
+		*cell = this->Dereference(env + term->slot);
+		return cells[*cell].value;
+	}
+
+	bool UnifyTerms(const ClauseTerm *term1, int env1, const ClauseTerm *term2, int env2)
+	{
+		int cell1 = -1, cell2 = -1;
+		const char *value1 = this->Resolve(term1, env1, &cell1);
+		const char *value2 = this->Resolve(term2, env2, &cell2);
+
+		if (value1 && value2)
+			return HazeProlog::StringCompare(value1, value2);
+		else if (value1)
+			return this->BindValue(cell2, value1);
+		else if (value2)
+			return this->BindValue(cell1, value2);
+
+		return this->BindRef(cell1, cell2);
+	}
+
+	bool UnifyGoals(const ClauseGoal *goal, int goalEnv, const ClauseGoal *head, int headEnv)
+	{
+		for (int i = 0; i < goal->termCount; ++i)
+		{
+			if (!this->UnifyTerms(&goal->terms[i], goalEnv, &head->terms[i], headEnv))
+				return false;
+		}
+
+		return true;
+	}
+
+	// returns false to stop the search.
+	bool SolveGoals(const GoalFrame *frame)
+	{
+		while (frame && (frame->goalCount == 0))
+			frame = frame->next;
+
+		if (!frame)
+		{
+			hasResults = true;
+
+			if (!visitor(this, userData))
+				stopped = true;
+
+			return !stopped;
+		}
+
+		if (depth == MAX_CLAUSE_DEPTH)
+		{
+			outOfMemory = true;
+			return false;
+		}
+
+		const ClauseGoal *goal = frame->goals;
+
+		GoalFrame rest;
+		rest.goals = goal + 1;
+		rest.goalCount = frame->goalCount - 1;
+		rest.env = frame->env;
+		rest.next = frame->next;
+
+		++depth;
+
+		for (const Clause *clause = firstClause; clause; clause = clause->nextClause)
+		{
+			if ((clause->head.termCount != goal->termCount) || (!HazeProlog::StringCompare(clause->head.predicateName, goal->predicateName)))
+				continue;
+
+			if ((cellCount + clause->slotCount) > maxCells)
+			{
+				outOfMemory = true;
+				break;
+			}
+
+			int trailMark = trailCount;
+			int env = cellCount;
+
+			for (int i = 0; i < clause->slotCount; ++i)
+			{
+				cells[env + i].value = 0;
+				cells[env + i].ref = -1;
+			}
+
+			cellCount += clause->slotCount;
+
+			bool searching = true;
+
+			if (this->UnifyGoals(goal, frame->env, &clause->head, env))
+			{
+				GoalFrame body;
+				body.goals = clause->body;
+				body.goalCount = clause->goalCount;
+				body.env = env;
+				body.next = &rest;
+
+				searching = this->SolveGoals(&body);
+			}
+
+			this->Undo(trailMark);
+			cellCount = env;
+
+			if ((!searching) || outOfMemory)
+				break;
+		}
+
+		--depth;
+		return !(stopped || outOfMemory);
+	}
+
+public:
+
+	ClauseSolver()
+	{
+		firstClause = 0;
+		cells = 0;
+		maxCells = 0;
+		cellCount = 0;
+		trail = 0;
+		maxTrail = 0;
+		trailCount = 0;
+		query = 0;
+		queryEnv = 0;
+		visitor = 0;
+		userData = 0;
+		depth = 0;
+		stopped = false;
+		outOfMemory = false;
+		hasResults = false;
+	}
+
+	// a query uses slotCount cells of each clause it visits, and a trail item for each binding.
+	void SetStorage(ClauseCell *cells, int maxCells, int *trail, int maxTrail)
+	{
+		this->cells = cells;
+		this->maxCells = maxCells;
+		this->trail = trail;
+		this->maxTrail = maxTrail;
+	}
+
+	void SetClauses(const Clause *firstClause)
+	{
+		this->firstClause = firstClause;
+	}
+
+	// solves body of the query clause. visitor reads the head terms of the query with GetAnswer.
+	// ex: q(X , Y) :- parent(X , Z) , parent(Z , Y) , likes(Y , wine).
+	SolveStatus VisitSolutions(const Clause *query, ClauseVisitor visitor, void *userData)
+	{
+		this->query = query;
+		this->visitor = visitor;
+		this->userData = userData;
+		cellCount = 0;
+		trailCount = 0;
+		depth = 0;
+		stopped = false;
+		outOfMemory = false;
+		hasResults = false;
+
+		if (query->slotCount > maxCells)
+			return SOLVE_OUT_OF_MEMORY;
+
+		queryEnv = 0;
+		for (int i = 0; i < query->slotCount; ++i)
+		{
+			cells[i].value = 0;
+			cells[i].ref = -1;
+		}
+
+		cellCount = query->slotCount;
+
+		GoalFrame frame;
+		frame.goals = query->body;
+		frame.goalCount = query->goalCount;
+		frame.env = queryEnv;
+		frame.next = 0;
+
+		this->SolveGoals(&frame);
+		this->Undo(0);
+
+		if (outOfMemory)
+			return SOLVE_OUT_OF_MEMORY;
+
+		return hasResults ? SOLVE_OK : SOLVE_NO_RESULTS;
+	}
+
+	// value of a head term of the query for the current solution. returns 0 if the variable is not bound.
+	const char* GetAnswer(int term) const
+	{
+		int cell = -1;
+		return this->Resolve(&query->head.terms[term], queryEnv, &cell);
+	}
+
+	int8 GetAnswerCount() const
+	{
+		return query->head.termCount;
+	}
+
+private:
+	ClauseSolver(const ClauseSolver&);
+	ClauseSolver& operator=(const ClauseSolver&);
+};
+
+// converts Fact and Rule chains into clauses, so existing knowledge bases run on ClauseSolver. (an OR rule becomes two clauses)
+// variables are unified like Prolog, so pred(X , Y) also matches facts with equal terms.
+// storage is supplied by the caller. names are not copied.
+class ClauseBuilder
+{
+protected:
+	Clause *clauses;
+	int maxClauses;
+	int clauseCount;
+	ClauseGoal *goals;
+	int maxGoals;
+	int goalCount;
+	ClauseTerm *terms;
+	int maxTerms;
+	int termCount;
+
+	ClauseTerm* AddTerm(const char *name, bool isVar, Clause *clause)
+	{
+		if (termCount == maxTerms)
+			return 0;
+
+		ClauseTerm *term = &terms[termCount++];
+		term->name = name;
+		term->slot = -1;
+
+		if (!isVar)
+			return term;
+
+		// same name is the same slot within a clause
+		for (const ClauseTerm *other = clause->head.terms; other != term; ++other)
+		{
+			if ((other->slot != -1) && HazeProlog::StringCompare(other->name, name))
+			{
+				term->slot = other->slot;
+				return term;
+			}
+		}
+
+		term->slot = clause->slotCount++;
+		return term;
+	}
+
+	// terms of the clause are contiguous, starting with the head terms.
+	bool SetGoal(ClauseGoal *goal, const Fact *fact, Clause *clause)
+	{
+		goal->predicateName = fact->predicateName;
+		goal->termCount = fact->termCount;
+		goal->terms = &terms[termCount];
+
+		if (!this->AddTerm(fact->term1Name, fact->isTerm1Var, clause))
+			return false;
+
+		if ((fact->termCount == 2) && (!this->AddTerm(fact->term2Name, fact->isTerm2Var, clause)))
+			return false;
+
+		return true;
+	}
+
+	Clause* AddClause(const Fact *head)
+	{
+		if (clauseCount == maxClauses)
+			return 0;
+
+		Clause *clause = &clauses[clauseCount];
+		clause->goalCount = 0;
+		clause->body = 0;
+		clause->slotCount = 0;
+		clause->nextClause = 0;
+		clause->head.terms = &terms[termCount];
+
+		if (!this->SetGoal(&clause->head, head, clause))
+			return 0;
+
+		if (clauseCount)
+			clauses[clauseCount - 1].nextClause = clause;
+
+		++clauseCount;
+		return clause;
+	}
+
+	bool AddBody(Clause *clause, const Fact *fact1, const Fact *fact2)
+	{
+		int count = fact2 ? 2 : 1;
+		if ((goalCount + count) > maxGoals)
+			return false;
+
+		clause->body = &goals[goalCount];
+		clause->goalCount = (int8)count;
+		goalCount += count;
+
+		return this->SetGoal(&goals[goalCount - count], fact1, clause)
+			&& ((!fact2) || this->SetGoal(&goals[goalCount - 1], fact2, clause));
+	}
+
+public:
+
+	ClauseBuilder()
+	{
+		this->SetStorage(0, 0, 0, 0, 0, 0);
+	}
+
+	// clauses are chained in the order they are added.
+	void SetStorage(Clause *clauses, int maxClauses, ClauseGoal *goals, int maxGoals, ClauseTerm *terms, int maxTerms)
+	{
+		this->clauses = clauses;
+		this->maxClauses = maxClauses;
+		this->goals = goals;
+		this->maxGoals = maxGoals;
+		this->terms = terms;
+		this->maxTerms = maxTerms;
+		clauseCount = 0;
+		goalCount = 0;
+		termCount = 0;
+	}
+
+	// returns false if storage is full.
+	bool AddFacts(const Fact *firstFact)
+	{
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+		{
+			if (!this->AddClause(fact))
+				return false;
+		}
+
+		return true;
+	}
+
+	// returns false if storage is full.
+	bool AddRules(const Rule *firstRule)
+	{
+		for (const Rule *rule = firstRule; rule; rule = rule->nextRule)
+		{
+			Clause *clause = this->AddClause(&rule->head);
+			if (!clause)
+				return false;
+
+			if ((rule->factCountInBody == 1) || rule->op1IsAnd)
+			{
+				if (!this->AddBody(clause, &rule->fact1, (rule->factCountInBody == 2) ? &rule->fact2 : 0))
+					return false;
+
+				continue;
+			}
+
+			// OR
+			if (!this->AddBody(clause, &rule->fact1, 0))
+				return false;
+
+			clause = this->AddClause(&rule->head);
+			if ((!clause) || (!this->AddBody(clause, &rule->fact2, 0)))
+				return false;
+		}
+
+		return true;
+	}
+
+	const Clause* GetFirstClause() const
+	{
+		return clauseCount ? &clauses[0] : 0;
+	}
+
+	int GetClauseCount() const
+	{
+		return clauseCount;
+	}
+
+private:
+	ClauseBuilder(const ClauseBuilder&);
+	ClauseBuilder& operator=(const ClauseBuilder&);
+};
+
+// define CLAUSE_PROGRAM_PROGMEM to keep compiled clause programs in flash. (AVR, see ClauseCompiler::WriteSource)
+#if defined(Arduino_h) && defined(CLAUSE_PROGRAM_PROGMEM)
+#include <avr/pgmspace.h>
+#define CLAUSE_PROGRAM_TABLE PROGMEM
+#define CLAUSE_READ_BYTE(address) ((unsigned char)pgm_read_byte(address))
+#define CLAUSE_READ_WORD(address) ((unsigned short)pgm_read_word(address))
+#define CLAUSE_READ_NAME(address) ((const char*)pgm_read_ptr(address))
+#else
+#define CLAUSE_PROGRAM_TABLE
+#define CLAUSE_READ_BYTE(address) (*(address))
+#define CLAUSE_READ_WORD(address) (*(address))
+#define CLAUSE_READ_NAME(address) (*(address))
+#endif
+
+// instructions of a compiled clause. operands are bytes, constant and predicate indices are 2 bytes. (low byte first)
+// a clause starts with its slot count, then get instructions of the head terms (argument cells),
+// then put instructions and a call for each body goal, then proceed.
+enum ClauseOpcode
+{
+	CLAUSE_GET_CONST = 0, // term, constant
+	CLAUSE_GET_VAR, // term, slot (first use of the variable)
+	CLAUSE_GET_VALUE, // term, slot
+	CLAUSE_PUT_CONST, // term, constant
+	CLAUSE_PUT_VAR, // term, slot (first use of the variable)
+	CLAUSE_PUT_VALUE, // term, slot
+	CLAUSE_CALL, // predicate
+	CLAUSE_PROCEED
+};
+
+struct ClausePredicate
+{
+	const char *name;
+	int8 termCount;
+	unsigned short firstClause; // clauses of the predicate are contiguous in clauseOffsets
+	unsigned short clauseCount;
+};
+
+struct ClauseProgram
+{
+	const unsigned char *code;
+	const char *const *constants;
+	const ClausePredicate *predicates;
+	int predicateCount;
+	const unsigned short *clauseOffsets; // code position of each clause
+};
+
+// compiles clauses into a ClauseProgram for ClauseMachine. variables become slot indices, and goals become calls
+// of predicate indices, so solving does not compare variable or predicate names. storage is supplied by the caller.
+class ClauseCompiler
+{
+protected:
+	unsigned char *code;
+	int maxCode;
+	int codeSize;
+	const char **constants;
+	int maxConstants;
+	int constantCount;
+	ClausePredicate *predicates;
+	int maxPredicates;
+	int predicateCount;
+	unsigned short *clauseOffsets;
+	int maxClauses;
+	int clauseCount;
+	ClauseProgram program;
+
+	bool Emit(int value)
+	{
+		if (codeSize == maxCode)
+			return false;
+
+		code[codeSize++] = (unsigned char)value;
+		return true;
+	}
+
+	bool EmitIndex(int opcode, int term, int index)
+	{
+		return this->Emit(opcode) && this->Emit(term) && this->Emit(index & 0xFF) && this->Emit(index >> 8);
+	}
+
+	// returns -1 if the table is full.
+	int FindConstant(const char *name)
+	{
+		for (int i = 0; i < constantCount; ++i)
+		{
+			if (HazeProlog::StringCompare(constants[i], name))
+				return i;
+		}
+
+		if ((constantCount == maxConstants) || (constantCount > 0xFFFF))
+			return -1;
+
+		constants[constantCount] = name;
+		return constantCount++;
+	}
+
+	// returns -1 if the table is full.
+	int FindPredicate(const ClauseGoal *goal)
+	{
+		for (int i = 0; i < predicateCount; ++i)
+		{
+			if ((predicates[i].termCount == goal->termCount) && HazeProlog::StringCompare(predicates[i].name, goal->predicateName))
+				return i;
+		}
+
+		if ((predicateCount == maxPredicates) || (predicateCount > 0xFFFF))
+			return -1;
+
+		ClausePredicate *predicate = &predicates[predicateCount];
+		predicate->name = goal->predicateName;
+		predicate->termCount = goal->termCount;
+		predicate->firstClause = 0;
+		predicate->clauseCount = 0;
+
+		return predicateCount++;
+	}
+
+	// seen holds a bit for each slot which is already bound.
+	bool EmitTerm(const ClauseTerm *term, int index, bool isHead, unsigned char *seen)
+	{
+		if (term->slot == -1)
+		{
+			int constant = this->FindConstant(term->name);
+			return (constant != -1) && this->EmitIndex(isHead ? CLAUSE_GET_CONST : CLAUSE_PUT_CONST, index, constant);
+		}
+
+		bool isFirst = !(seen[term->slot >> 3] & (1 << (term->slot & 7)));
+		seen[term->slot >> 3] |= (unsigned char)(1 << (term->slot & 7));
+
+		int opcode = isHead ? (isFirst ? CLAUSE_GET_VAR : CLAUSE_GET_VALUE) : (isFirst ? CLAUSE_PUT_VAR : CLAUSE_PUT_VALUE);
+		return this->Emit(opcode) && this->Emit(index) && this->Emit(term->slot);
+	}
+
+	bool EmitClause(const Clause *clause)
+	{
+		unsigned char seen[16]; // 128 slots
+		memset(seen, 0, sizeof(seen));
+
+		if ((clauseCount == maxClauses) || (codeSize > 0xFFFF))
+			return false;
+
+		clauseOffsets[clauseCount++] = (unsigned short)codeSize;
+
+		if (!this->Emit(clause->slotCount))
+			return false;
+
+		for (int i = 0; i < clause->head.termCount; ++i)
+		{
+			if (!this->EmitTerm(&clause->head.terms[i], i, true, seen))
+				return false;
+		}
+
+		for (int i = 0; i < clause->goalCount; ++i)
+		{
+			const ClauseGoal *goal = &clause->body[i];
+
+			for (int j = 0; j < goal->termCount; ++j)
+			{
+				if (!this->EmitTerm(&goal->terms[j], j, false, seen))
+					return false;
+			}
+
+			int predicate = this->FindPredicate(goal);
+			if ((predicate == -1) || (!this->Emit(CLAUSE_CALL)) || (!this->Emit(predicate & 0xFF)) || (!this->Emit(predicate >> 8)))
+				return false;
+		}
+
+		return this->Emit(CLAUSE_PROCEED);
+	}
+
+#ifndef Arduino_h
+
+	static void WriteString(FILE *file, const char *text)
+	{
+		::fputc('"', file);
+
+		for (; *text; ++text)
+		{
+			if ((*text == '"') || (*text == '\\'))
+				::fputc('\\', file);
+
+			::fputc(*text, file);
+		}
+
+		::fputc('"', file);
+	}
+
+#endif
+
+public:
+
+	ClauseCompiler()
+	{
+		this->SetStorage(0, 0, 0, 0, 0, 0, 0, 0);
+	}
+
+	// maxClauses is the clause count. (predicates also include called predicates without clauses)
+	void SetStorage(unsigned char *code, int maxCode, const char **constants, int maxConstants,
+		ClausePredicate *predicates, int maxPredicates, unsigned short *clauseOffsets, int maxClauses)
+	{
+		this->code = code;
+		this->maxCode = maxCode;
+		this->constants = constants;
+		this->maxConstants = maxConstants;
+		this->predicates = predicates;
+		this->maxPredicates = maxPredicates;
+		this->clauseOffsets = clauseOffsets;
+		this->maxClauses = maxClauses;
+		codeSize = 0;
+		constantCount = 0;
+		predicateCount = 0;
+		clauseCount = 0;
+	}
+
+	// clauses of a predicate keep their order. returns false if storage is full.
+	bool Compile(const Clause *firstClause)
+	{
+		codeSize = 0;
+		constantCount = 0;
+		predicateCount = 0;
+		clauseCount = 0;
+
+		// predicate table in order of first clause
+		for (const Clause *clause = firstClause; clause; clause = clause->nextClause)
+		{
+			int predicate = this->FindPredicate(&clause->head);
+			if (predicate == -1)
+				return false;
+
+			++predicates[predicate].clauseCount;
+		}
+
+		int first = 0;
+		for (int i = 0; i < predicateCount; ++i)
+		{
+			predicates[i].firstClause = (unsigned short)first;
+			first += predicates[i].clauseCount;
+		}
+
+		// one pass for each predicate, so clauses are grouped
+		int headCount = predicateCount;
+		for (int i = 0; i < headCount; ++i)
+		{
+			for (const Clause *clause = firstClause; clause; clause = clause->nextClause)
+			{
+				if ((clause->head.termCount == predicates[i].termCount) && HazeProlog::StringCompare(clause->head.predicateName, predicates[i].name)
+					&& (!this->EmitClause(clause)))
+					return false;
+			}
+		}
+
+		program.code = code;
+		program.constants = constants;
+		program.predicates = predicates;
+		program.predicateCount = predicateCount;
+		program.clauseOffsets = clauseOffsets;
+
+		return true;
+	}
+
+	const ClauseProgram* GetProgram() const
+	{
+		return &program;
+	}
+
+	int GetCodeSize() const
+	{
+		return codeSize;
+	}
+
+#ifndef Arduino_h
+
+	// writes the program as C++ tables, so it can be compiled into flash. (define CLAUSE_PROGRAM_PROGMEM on AVR)
+	// names stay in RAM. returns false if the file cannot be written.
+	bool WriteSource(const char *fileName, const char *name) const
+	{
+		FILE *file = ::fopen(fileName, "w");
+		if (!file)
+			return false;
+
+		::fprintf(file, "static const unsigned char %s_code[] CLAUSE_PROGRAM_TABLE = {", name);
+		for (int i = 0; i < codeSize; ++i)
+			::fprintf(file, "%s%d", (i % 24) ? ", " : (i ? ",\n\t" : "\n\t"), (int)code[i]);
+
+		::fprintf(file, "\n};\n\nstatic const char *const %s_constants[] CLAUSE_PROGRAM_TABLE = {", name);
+		for (int i = 0; i < constantCount; ++i)
+		{
+			::fprintf(file, "%s", i ? ", " : "\n\t");
+			ClauseCompiler::WriteString(file, constants[i]);
+		}
+
+		::fprintf(file, "%s\n};\n\nstatic const ClausePredicate %s_predicates[] CLAUSE_PROGRAM_TABLE = {", constantCount ? "" : "\n\t0", name);
+		for (int i = 0; i < predicateCount; ++i)
+		{
+			::fprintf(file, "%s{ ", i ? ",\n\t" : "\n\t");
+			ClauseCompiler::WriteString(file, predicates[i].name);
+			::fprintf(file, ", %d, %d, %d }", (int)predicates[i].termCount, (int)predicates[i].firstClause, (int)predicates[i].clauseCount);
+		}
+
+		::fprintf(file, "\n};\n\nstatic const unsigned short %s_clauses[] CLAUSE_PROGRAM_TABLE = {", name);
+		for (int i = 0; i < clauseCount; ++i)
+			::fprintf(file, "%s%d", (i % 16) ? ", " : (i ? ",\n\t" : "\n\t"), (int)clauseOffsets[i]);
+
+		::fprintf(file, "%s\n};\n\nstatic const ClauseProgram %s = { %s_code, %s_constants, %s_predicates, %d, %s_clauses };\n",
+			clauseCount ? "" : "\n\t0", name, name, name, name, predicateCount, name);
+
+		return (::fclose(file) == 0);
+	}
+
+#endif
+
+private:
+	ClauseCompiler(const ClauseCompiler&);
+	ClauseCompiler& operator=(const ClauseCompiler&);
+};
+
+// runs a ClauseProgram. a call unifies argument cells with the get instructions of each clause of the predicate,
+// so a clause which does not match fails at its first differing term. results are the same as ClauseSolver.
+// goals of the query are found by name. (program may be in flash, see CLAUSE_PROGRAM_PROGMEM)
+class ClauseMachine : public ClauseSolver
+{
+protected:
+	// code which runs after a call. (next goal of the query if pc is -1)
+	struct MachineFrame
+	{
+		int pc;
+		int queryGoal;
+		int env;
+		const MachineFrame *next;
+	};
+
+	const ClauseProgram *program;
+
+	bool UnifyCells(int cell1, int cell2)
+	{
+		cell1 = this->Dereference(cell1);
+		cell2 = this->Dereference(cell2);
+
+		const char *value1 = cells[cell1].value;
+		const char *value2 = cells[cell2].value;
+
+		if (value1 && value2)
+			return HazeProlog::StringCompare(value1, value2);
+		else if (value1)
+			return this->BindValue(cell2, value1);
+		else if (value2)
+			return this->BindValue(cell1, value2);
+
+		return this->BindRef(cell1, cell2);
+	}
+
+	bool UnifyValue(int cell, const char *value)
+	{
+		cell = this->Dereference(cell);
+
+		if (cells[cell].value)
+			return HazeProlog::StringCompare(cells[cell].value, value);
+
+		return this->BindValue(cell, value);
+	}
+
+	unsigned short ReadIndex(int pc) const
+	{
+		return (unsigned short)(CLAUSE_READ_BYTE(&program->code[pc]) | (CLAUSE_READ_BYTE(&program->code[pc + 1]) << 8));
+	}
+
+	// runs get instructions. pc is moved to the first body instruction.
+	bool RunHead(int *pc, int env, int args)
+	{
+		const unsigned char *code = program->code;
+
+		for (;;)
+		{
+			int opcode = CLAUSE_READ_BYTE(&code[*pc]);
+			if (opcode > CLAUSE_GET_VALUE)
+				return true;
+
+			int arg = args + CLAUSE_READ_BYTE(&code[*pc + 1]);
+
+			if (opcode == CLAUSE_GET_CONST)
+			{
+				if (!this->UnifyValue(arg, CLAUSE_READ_NAME(&program->constants[this->ReadIndex(*pc + 2)])))
+					return false;
+
+				*pc += 4;
+				continue;
+			}
+
+			int slot = env + CLAUSE_READ_BYTE(&code[*pc + 2]);
+			*pc += 3;
+
+			if (opcode == CLAUSE_GET_VAR)
+				cells[slot] = cells[arg]; // (slot is not bound yet)
+			else if (!this->UnifyCells(arg, slot))
+				return false;
+		}
+	}
+
+	// returns false to stop the search.
+	bool Call(int predicate, int args, const MachineFrame *next)
+	{
+		if (depth == MAX_CLAUSE_DEPTH)
+		{
+			outOfMemory = true;
+			return false;
+		}
+
+		const ClausePredicate *item = &program->predicates[predicate];
+		int first = CLAUSE_READ_WORD(&item->firstClause);
+		int end = first + CLAUSE_READ_WORD(&item->clauseCount);
+
+		++depth;
+
+		for (int clause = first; clause < end; ++clause)
+		{
+			int pc = CLAUSE_READ_WORD(&program->clauseOffsets[clause]);
+			int slotCount = CLAUSE_READ_BYTE(&program->code[pc++]);
+
+			if ((cellCount + slotCount) > maxCells)
+			{
+				outOfMemory = true;
+				break;
+			}
+
+			int trailMark = trailCount;
+			int env = cellCount;
+
+			for (int i = 0; i < slotCount; ++i)
+			{
+				cells[env + i].value = 0;
+				cells[env + i].ref = -1;
+			}
+
+			cellCount += slotCount;
+
+			bool searching = true;
+
+			if (this->RunHead(&pc, env, args))
+				searching = this->RunBody(pc, env, next);
+
+			this->Undo(trailMark);
+			cellCount = env;
+
+			if ((!searching) || outOfMemory)
+				break;
+		}
+
+		--depth;
+		return !(stopped || outOfMemory);
+	}
+
+	// runs put instructions into argument cells above the clause cells, then calls the goal.
+	bool RunBody(int pc, int env, const MachineFrame *next)
+	{
+		const unsigned char *code = program->code;
+		int args = cellCount;
+
+		for (;;)
+		{
+			int opcode = CLAUSE_READ_BYTE(&code[pc]);
+
+			if (opcode == CLAUSE_PROCEED)
+				return this->Continue(next);
+
+			if (opcode == CLAUSE_CALL)
+			{
+				int predicate = this->ReadIndex(pc + 1);
+
+				MachineFrame frame;
+				frame.pc = pc + 3;
+				frame.queryGoal = -1;
+				frame.env = env;
+				frame.next = next;
+
+				cellCount = args + CLAUSE_READ_BYTE(&program->predicates[predicate].termCount);
+				bool searching = this->Call(predicate, args, &frame);
+				cellCount = args;
+
+				return searching;
+			}
+
+			int arg = args + CLAUSE_READ_BYTE(&code[pc + 1]);
+			if (arg >= maxCells)
+			{
+				outOfMemory = true;
+				return false;
+			}
+
+			if (opcode == CLAUSE_PUT_CONST)
+			{
+				cells[arg].value = CLAUSE_READ_NAME(&program->constants[this->ReadIndex(pc + 2)]);
+				cells[arg].ref = -1;
+				pc += 4;
+				continue;
+			}
+
+			// (PUT_VAR and PUT_VALUE refer to the slot. slot of PUT_VAR is still unbound)
+			cells[arg].value = 0;
+			cells[arg].ref = env + CLAUSE_READ_BYTE(&code[pc + 2]);
+			pc += 3;
+		}
+	}
+
+	int FindPredicate(const ClauseGoal *goal) const
+	{
+		for (int i = 0; i < program->predicateCount; ++i)
+		{
+			const ClausePredicate *item = &program->predicates[i];
+
+			if (((int8)CLAUSE_READ_BYTE((const unsigned char*)&item->termCount) == goal->termCount)
+				&& HazeProlog::StringCompare(CLAUSE_READ_NAME(&item->name), goal->predicateName))
+				return i;
+		}
+
+		return -1;
+	}
+
+	// solves the query goals from the index.
+	bool RunQuery(int goalIndex)
+	{
+		if (goalIndex == query->goalCount)
+			return this->Continue(0);
+
+		const ClauseGoal *goal = &query->body[goalIndex];
+
+		int predicate = this->FindPredicate(goal);
+		if (predicate == -1)
+			return true; // no clauses
+
+		int args = cellCount;
+		if ((args + goal->termCount) > maxCells)
+		{
+			outOfMemory = true;
+			return false;
+		}
+
+		for (int i = 0; i < goal->termCount; ++i)
+		{
+			const ClauseTerm *term = &goal->terms[i];
+
+			cells[args + i].value = (term->slot == -1) ? term->name : 0;
+			cells[args + i].ref = (term->slot == -1) ? -1 : (queryEnv + term->slot);
+		}
+
+		MachineFrame frame;
+		frame.pc = -1;
+		frame.queryGoal = goalIndex + 1;
+		frame.env = queryEnv;
+		frame.next = 0;
+
+		cellCount = args + goal->termCount;
+		bool searching = this->Call(predicate, args, &frame);
+		cellCount = args;
+
+		return searching;
+	}
+
+	bool Continue(const MachineFrame *frame)
+	{
+		if (!frame)
+		{
+			hasResults = true;
+
+			if (!visitor(this, userData))
+				stopped = true;
+
+			return !stopped;
+		}
+
+		if (frame->pc == -1)
+			return this->RunQuery(frame->queryGoal);
+
+		return this->RunBody(frame->pc, frame->env, frame->next);
+	}
+
+public:
+
+	ClauseMachine()
+	{
+		program = 0;
+	}
+
+	void SetProgram(const ClauseProgram *program)
+	{
+		this->program = program;
+	}
+
+	// solves body of the query clause with the program. visitor reads the head terms of the query with GetAnswer.
+	SolveStatus VisitSolutions(const Clause *query, ClauseVisitor visitor, void *userData)
+	{
+		this->query = query;
+		this->visitor = visitor;
+		this->userData = userData;
+		cellCount = 0;
+		trailCount = 0;
+		depth = 0;
+		stopped = false;
+		outOfMemory = false;
+		hasResults = false;
+
+		if (query->slotCount > maxCells)
+			return SOLVE_OUT_OF_MEMORY;
+
+		queryEnv = 0;
+		for (int i = 0; i < query->slotCount; ++i)
+		{
+			cells[i].value = 0;
+			cells[i].ref = -1;
+		}
+
+		cellCount = query->slotCount;
+
+		this->RunQuery(0);
+		this->Undo(0);
+
+		if (outOfMemory)
+			return SOLVE_OUT_OF_MEMORY;
+
+		return hasResults ? SOLVE_OK : SOLVE_NO_RESULTS;
+	}
+
+private:
+	ClauseMachine(const ClauseMachine&);
+	ClauseMachine& operator=(const ClauseMachine&);
+};
+
+// parses Prolog source text into Fact and Rule chains in a single pass.
+// names are not copied: text is modified in place (terminators are written after names) and facts/rules point into it,
+// so the text must live as long as the loaded knowledge base.
+// supported syntax: "pred(a, b)." , "head(X, Y) :- goal1(X, Z), goal2(Z, Y)." , "head(X) :- goal1(X) ; goal2(X)."
+// and '%' line comments. names can contain letters, digits, '_' and '-'. quoted names ('New York') are also accepted.
+class KnowledgeBaseLoader
+{
+protected:
+	Fact *facts;
+	int maxFacts;
+	int factCount;
+	Rule *rules;
+	int maxRules;
+	int ruleCount;
+	SymbolTable *symbols;
+
+	char *position;
+	int line;
+	const char *error;
+	int errorLine;
+
+	static bool IsNameChar(char x)
+	{
+		return ((x >= 'a') && (x <= 'z')) || ((x >= 'A') && (x <= 'Z')) || ((x >= '0') && (x <= '9')) || (x == '_') || (x == '-');
+	}
+
+	bool Fail(const char *message)
+	{
+		error = message;
+		errorLine = line;
+		return false;
+	}
+
+	void SkipSpaces()
+	{
+		while (true)
+		{
+			char x = *position;
+
+			if (x == '\n')
+			{
+				++line;
+				++position;
+			}
+			else if ((x == ' ') || (x == '\t') || (x == '\r'))
+			{
+				++position;
+			}
+			else if (x == '%') // comment till end of line
+			{
+				while (*position && (*position != '\n'))
+					++position;
+			}
+			else
+			{
+				return;
+			}
+		}
+	}
+
+	// returns the delimiter which was replaced by the terminator. (0 on error)
+	char ReadName(const char **name, bool *isQuoted)
+	{
+		this->SkipSpaces();
+
+		char *start = position;
+		*isQuoted = (*position == '\'');
+
+		if (*isQuoted) // quoted name is always a constant
+		{
+			++start;
+			++position;
+
+			while (*position && (*position != '\'') && (*position != '\n'))
+				++position;
+
+			if (*position != '\'')
+				return 0;
+
+			*position = 0;
+			++position;
+			*name = start;
+
+			this->SkipSpaces();
+			char delimiter = *position;
+			if (delimiter)
+				++position;
+			return delimiter;
+		}
+
+		if (*position == '-') // names can not start with '-'
+			return 0;
+
+		while (KnowledgeBaseLoader::IsNameChar(*position))
+			++position;
+
+		if (position == start)
+			return 0;
+
+		char *end = position;
+		this->SkipSpaces();
+
+		char delimiter = *position;
+		*end = 0; // terminate name. (delimiter is already read, so "end" can be overwritten)
+		if (delimiter)
+			++position;
+
+		*name = start;
+		return delimiter;
+	}
+
+	bool ReadPredicate(Fact *fact)
+	{
+		bool isQuoted, isTerm1Quoted, isTerm2Quoted = false;
+		char delimiter = this->ReadName(&fact->predicateName, &isQuoted);
+
+		if (delimiter != '(')
+			return this->Fail("expected predicate with terms");
+
+		delimiter = this->ReadName(&fact->term1Name, &isTerm1Quoted);
+		fact->termCount = 1;
+		fact->term2Name = "";
+		fact->isTerm2Var = false;
+		fact->nextFact = 0;
+
+		if (delimiter == ',')
+		{
+			delimiter = this->ReadName(&fact->term2Name, &isTerm2Quoted);
+			fact->termCount = 2;
+		}
+
+		if (delimiter != ')')
+			return this->Fail((delimiter == ',') ? "more than 2 terms" : "expected ')'");
+
+		HazeProlog::FixVariableFlags(fact);
+		fact->isTerm1Var &= !isTerm1Quoted;
+		fact->isTerm2Var &= !isTerm2Quoted;
+
+		if (symbols && (!symbols->InternFact(fact)))
+			return this->Fail("symbol table is full");
+
+		return true;
+	}
+
+	// reads ".", ",", ";" or ":-" after a predicate
+	char ReadOperator()
+	{
+		this->SkipSpaces();
+
+		char x = *position;
+
+		if ((x == '.') || (x == ',') || (x == ';'))
+		{
+			++position;
+			return x;
+		}
+
+		if ((x == ':') && (position[1] == '-'))
+		{
+			position += 2;
+			return ':';
+		}
+
+		return 0;
+	}
+
+	bool ReadClause()
+	{
+		Fact head;
+		if (!this->ReadPredicate(&head))
+			return false;
+
+		char op = this->ReadOperator();
+
+		if (op == '.') // fact
+		{
+			if (head.isTerm1Var || ((head.termCount == 2) && head.isTerm2Var))
+				return this->Fail("fact can only have constants");
+
+			if (factCount == maxFacts)
+				return this->Fail("too many facts");
+
+			Fact *fact = &facts[factCount];
+			*fact = head;
+
+			if (factCount)
+				facts[factCount - 1].nextFact = fact;
+
+			++factCount;
+			return true;
+		}
+
+		if (op != ':')
+			return this->Fail("expected '.' or ':-'");
+
+		if (ruleCount == maxRules)
+			return this->Fail("too many rules");
+
+		Rule *rule = &rules[ruleCount];
+		rule->head = head;
+		rule->factCountInBody = 1;
+		rule->op1IsAnd = false;
+		rule->nextRule = 0;
+
+		if (!this->ReadPredicate(&rule->fact1))
+			return false;
+
+		op = this->ReadOperator();
+
+		if ((op == ',') || (op == ';'))
+		{
+			rule->factCountInBody = 2;
+			rule->op1IsAnd = (op == ',');
+
+			if (!this->ReadPredicate(&rule->fact2))
+				return false;
+
+			op = this->ReadOperator();
+		}
+		else
+		{
+			Fact emptyFact = { 0, "", false, "", false, "", 0 };
+			rule->fact2 = emptyFact;
+		}
+
+		if (op != '.')
+			return this->Fail((op == ',') || (op == ';') ? "more than 2 facts in rule body" : "expected '.'");
+
+		if (ruleCount)
+			rules[ruleCount - 1].nextRule = rule;
+
+		++ruleCount;
+		return true;
+	}
+
+public:
+
+	KnowledgeBaseLoader()
+	{
+		this->SetStorage(0, 0, 0, 0);
+	}
+
+	// loaded facts and rules are stored in these arrays. (use CountClauses to find required sizes)
+	void SetStorage(Fact *facts, int maxFacts, Rule *rules, int maxRules)
+	{
+		this->facts = facts;
+		this->maxFacts = maxFacts;
+		this->factCount = 0;
+		this->rules = rules;
+		this->maxRules = maxRules;
+		this->ruleCount = 0;
+		this->symbols = 0;
+		this->error = 0;
+		this->errorLine = 0;
+	}
+
+	// names will be interned while loading. (required if INTERNED_SYMBOLS is defined)
+	void SetSymbolTable(SymbolTable *symbols)
+	{
+		this->symbols = symbols;
+	}
+
+	// appends clauses of the text into the storage. text is modified!
+	// returns false on syntax error or if storage is full. (see GetError and GetErrorLine)
+	bool Load(char *text)
+	{
+		position = text;
+		line = 1;
+
+		while (true)
+		{
+			this->SkipSpaces();
+
+			if (*position == 0)
+				return true;
+
+			if (!this->ReadClause())
+				return false;
+		}
+	}
+
+	// parses a single query like "grandMotherOf(X, GM)". text is modified!
+	bool ParseQuery(char *text, Fact *query)
+	{
+		position = text;
+		line = 1;
+
+		if (!this->ReadPredicate(query))
+			return false;
+
+		char op = this->ReadOperator();
+		this->SkipSpaces();
+
+		if (((op != 0) && (op != '.')) || (*position != 0))
+			return this->Fail("expected single query");
+
+		return true;
+	}
+
+	// upper bounds of fact and rule counts of the text. (counts '.' and ":-" outside of comments and quotes)
+	static void CountClauses(const char *text, int *factCount, int *ruleCount)
+	{
+		int clauseCount = 0;
+		*ruleCount = 0;
+
+		while (*text)
+		{
+			if (*text == '%')
+			{
+				while (*text && (*text != '\n'))
+					++text;
+				continue;
+			}
+
+			if (*text == '\'')
+			{
+				++text;
+				while (*text && (*text != '\''))
+					++text;
+				if (*text)
+					++text;
+				continue;
+			}
+
+			if (*text == '.')
+				++clauseCount;
+			else if ((*text == ':') && (text[1] == '-'))
+				++(*ruleCount);
+
+			++text;
+		}
+
+		*factCount = (clauseCount > (*ruleCount)) ? (clauseCount - (*ruleCount)) : 0;
+	}
+
+	const Fact* GetFirstFact() const
+	{
+		return factCount ? &facts[0] : 0;
+	}
+
+	const Rule* GetFirstRule() const
+	{
+		return ruleCount ? &rules[0] : 0;
+	}
+
+	int GetFactCount() const
+	{
+		return factCount;
+	}
+
+	int GetRuleCount() const
+	{
+		return ruleCount;
+	}
+
+	const char* GetError() const
+	{
+		return error;
+	}
+
+	int GetErrorLine() const
+	{
+		return errorLine;
+	}
+};
+
+#ifdef ENABLE_ROM_TABLES
+
+// tables are built by constexpr functions with loops and local arrays. (MSVC reports the standard in _MSVC_LANG)
+#if (defined(_MSVC_LANG) ? _MSVC_LANG : __cplusplus) < 201402L
+#error "ROM tables require C++14 (constexpr loops)"
+#endif
+
+#ifdef Arduino_h
+#include <avr/pgmspace.h>
+#define ROM_TABLE PROGMEM
+#define ROM_READ_ID(address) ((symbolid)pgm_read_word(address))
+#define ROM_READ_NAME(address) ((const char*)pgm_read_ptr(address))
+#else
+#define ROM_TABLE
+#define ROM_READ_ID(address) (*(address))
+#define ROM_READ_NAME(address) (*(address))
+#endif
+
+// fact declaration which is compiled into a RomFactTable.
+struct RomFactDefinition
+{
+	int8 termCount;
+	const char *predicateName;
+	const char *term1Name;
+	const char *term2Name; // "" for single term facts
+};
+
+// fact with symbol ids. (index of RomFactTable::symbols)
+struct RomFact
+{
+	symbolid termCount;
+	symbolid predicate;
+	symbolid term1;
+	symbolid term2;
+};
+
+// compile time string helpers
+constexpr int RomCompareNames(const char *name1, const char *name2)
+{
+	while ((*name1) && (*name1 == *name2))
+	{
+		++name1;
+		++name2;
+	}
+
+	return (int)(unsigned char)(*name1) - (int)(unsigned char)(*name2);
+}
+
+// compile time heap sort. (O(n log n) steps, so large tables stay in the constexpr step limit of compilers)
+template <typename Item, typename Less>
+constexpr void RomSiftDown(Item *items, int root, int count, const Less &isLess)
+{
+	for (int child = (2 * root) + 1; child < count; root = child, child = (2 * root) + 1)
+	{
+		if (((child + 1) < count) && isLess(items[child], items[child + 1]))
+			++child;
+
+		if (!isLess(items[root], items[child]))
+			return;
+
+		Item item = items[root];
+		items[root] = items[child];
+		items[child] = item;
+	}
+}
+
+template <typename Item, typename Less>
+constexpr void RomSort(Item *items, int count, const Less &isLess)
+{
+	for (int root = (count / 2) - 1; root >= 0; --root)
+		RomSiftDown(items, root, count, isLess);
+
+	for (int last = count - 1; last > 0; --last)
+	{
+		Item item = items[0];
+		items[0] = items[last];
+		items[last] = item;
+
+		RomSiftDown(items, 0, last, isLess);
+	}
+}
+
+struct RomNameLess
+{
+	constexpr bool operator()(const char *name1, const char *name2) const
+	{
+		return RomCompareNames(name1, name2) < 0;
+	}
+};
+
+// sorted names of the definitions. (3 names for each fact, duplicates are kept)
+template <int factCount>
+struct RomNameList
+{
+	const char *names[3 * factCount];
+
+	constexpr RomNameList(const RomFactDefinition *definitions) : names()
+	{
+		for (int i = 0; i < factCount; ++i)
+		{
+			names[3 * i] = definitions[i].predicateName;
+			names[(3 * i) + 1] = definitions[i].term1Name;
+			names[(3 * i) + 2] = definitions[i].term2Name;
+		}
+
+		RomSort(names, 3 * factCount, RomNameLess());
+	}
+
+	constexpr bool IsFirst(int position) const
+	{
+		return (position == 0) || (RomCompareNames(names[position - 1], names[position]) != 0);
+	}
+};
+
+// number of unique names of the definitions. (template argument of RomFactTable)
+template <int factCount>
+constexpr int RomCountSymbols(const RomFactDefinition *definitions)
+{
+	RomNameList<factCount> list(definitions);
+	int symbolCount = 0;
+
+	for (int i = 0; i < (3 * factCount); ++i)
+	{
+		if (list.IsFirst(i))
+			++symbolCount;
+	}
+
+	return symbolCount;
+}
+
+// facts compiled into flat tables by the compiler. (flash on AVR, .rodata on PC)
+// symbols are sorted names, facts are sorted by (predicate, term1, term2) and term2Order lists
+// fact positions sorted by (predicate, term2, term1). no runtime initialization is needed.
+// declare with ROM_FACT_TABLE and query through a RomFactSource.
+template <int factCount, int symbolCount>
+struct RomFactTable
+{
+	const char *symbols[symbolCount];
+	RomFact facts[factCount];
+	symbolid term2Order[factCount];
+
+	constexpr symbolid FindSymbol(const char *name) const
+	{
+		int first = 0, last = symbolCount - 1;
+
+		while (first < last)
+		{
+			int middle = (first + last) / 2;
+
+			if (RomCompareNames(symbols[middle], name) < 0)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+
+		return (symbolid)first;
+	}
+
+	struct FactLess
+	{
+		constexpr bool operator()(const RomFact &fact1, const RomFact &fact2) const
+		{
+			return RomFactTable::IsLess(fact1, fact2, false);
+		}
+	};
+
+	struct Term2OrderLess
+	{
+		const RomFact *facts;
+
+		constexpr bool operator()(symbolid position1, symbolid position2) const
+		{
+			return RomFactTable::IsLess(facts[position1], facts[position2], true);
+		}
+	};
+
+	static constexpr bool IsLess(const RomFact &fact1, const RomFact &fact2, bool term2First)
+	{
+		if (fact1.predicate != fact2.predicate)
+			return fact1.predicate < fact2.predicate;
+
+		symbolid key1 = term2First ? fact1.term2 : fact1.term1;
+		symbolid key2 = term2First ? fact2.term2 : fact2.term1;
+
+		if (key1 != key2)
+			return key1 < key2;
+
+		return term2First ? (fact1.term1 < fact2.term1) : (fact1.term2 < fact2.term2);
+	}
+
+	constexpr RomFactTable(const RomFactDefinition *definitions) : symbols(), facts(), term2Order()
+	{
+		// unique sorted names
+		RomNameList<factCount> list(definitions);
+
+		int count = 0;
+		for (int i = 0; i < (3 * factCount); ++i)
+		{
+			if (list.IsFirst(i))
+				symbols[count++] = list.names[i];
+		}
+
+		// resolve and sort facts
+		for (int i = 0; i < factCount; ++i)
+		{
+			facts[i] = RomFact{ (symbolid)definitions[i].termCount, this->FindSymbol(definitions[i].predicateName),
+				this->FindSymbol(definitions[i].term1Name), this->FindSymbol(definitions[i].term2Name) };
+		}
+
+		RomSort(facts, factCount, FactLess());
+
+		// term2 index
+		for (int i = 0; i < factCount; ++i)
+			term2Order[i] = (symbolid)i;
+
+		RomSort(term2Order, factCount, Term2OrderLess{ facts });
+	}
+};
+
+// declares a RomFactTable named "name" from a constexpr RomFactDefinition array.
+#define ROM_FACT_TABLE(name, definitions) \
+	constexpr RomFactTable<sizeof(definitions) / sizeof(RomFactDefinition), \
+		RomCountSymbols<sizeof(definitions) / sizeof(RomFactDefinition)>(definitions)> name ROM_TABLE { definitions }
+
+// queries a RomFactTable with binary search. pass to HazeProlog::SetFactSource.
+// results are in sorted order, not in declaration order.
+// names of the results point to the table symbols. (use InternFact on rules and queries if INTERNED_SYMBOLS is defined)
+class RomFactSource : public FactSource
+{
+protected:
+	const char * const *symbols;
+	const RomFact *facts;
+	const symbolid *term2Order;
+	int factCount;
+	int symbolCount;
+
+	// returns -1 if name is not in the table.
+	int FindSymbol(const char *name) const
+	{
+		int first = 0, last = symbolCount - 1;
+
+		while (first <= last)
+		{
+			int middle = (first + last) / 2;
+			int result = ::strcmp(ROM_READ_NAME(&symbols[middle]), name);
+
+			if (result == 0)
+				return middle;
+
+			if (result < 0)
+				first = middle + 1;
+			else
+				last = middle - 1;
+		}
+
+		return -1;
+	}
+
+	void ReadFact(int position, RomFact *fact) const
+	{
+		fact->termCount = ROM_READ_ID(&facts[position].termCount);
+		fact->predicate = ROM_READ_ID(&facts[position].predicate);
+		fact->term1 = ROM_READ_ID(&facts[position].term1);
+		fact->term2 = ROM_READ_ID(&facts[position].term2);
+	}
+
+	// first position of (predicate, term) in facts or term2Order
+	int FindFirstPosition(int predicate, int term, bool term2First) const
+	{
+		int first = 0, last = factCount;
+
+		while (first < last)
+		{
+			int middle = (first + last) / 2;
+			RomFact fact;
+			this->ReadFact(term2First ? ROM_READ_ID(&term2Order[middle]) : middle, &fact);
+
+			int factPredicate = (int)fact.predicate;
+			int key = (int)(term2First ? fact.term2 : fact.term1);
+
+			if ((factPredicate < predicate) || ((factPredicate == predicate) && (key < term)))
+				first = middle + 1;
+			else
+				last = middle;
+		}
+
+		return first;
+	}
+
+public:
+
+	template <int tableFactCount, int tableSymbolCount>
+	RomFactSource(const RomFactTable<tableFactCount, tableSymbolCount> *table)
+	{
+		symbols = table->symbols;
+		facts = table->facts;
+		term2Order = table->term2Order;
+		factCount = tableFactCount;
+		symbolCount = tableSymbolCount;
+	}
+
+	// replace names of the fact with table symbols. returns false if a name is not in the table.
+	bool InternFact(Fact *fact) const
+	{
+		const char **names[3] = { &fact->predicateName, &fact->term1Name, &fact->term2Name };
+		bool found = true;
+
+		for (int i = 0; i < ((fact->termCount == 2) ? 3 : 2); ++i)
+		{
+			int id = this->FindSymbol(*names[i]);
+
+			if (id != -1)
+				*names[i] = ROM_READ_NAME(&symbols[id]);
+			else
+				found = false;
+		}
+
+		return found;
+	}
+
+	bool VisitMatchingFacts(const Fact *query, FactVisitor visitor, void *userData) const
+	{
+		bool term1Bound = !query->isTerm1Var;
+		bool term2Bound = (query->termCount == 2) && (!query->isTerm2Var);
+
+		int predicate = this->FindSymbol(query->predicateName);
+		int term1 = term1Bound ? this->FindSymbol(query->term1Name) : -1;
+		int term2 = term2Bound ? this->FindSymbol(query->term2Name) : -1;
+
+		if ((predicate == -1) || (term1Bound && (term1 == -1)) || (term2Bound && (term2 == -1))) // unknown names can not match
+			return true;
+
+		// facts are sorted by term1, term2Order by term2
+		bool useTerm2Order = (!term1Bound) && term2Bound;
+		int key = useTerm2Order ? term2 : term1;
+
+		// pred(X , X) or pred(X , Y)
+		bool sameVariables = (!term1Bound) && (query->termCount == 2) && (!term2Bound) && HazeProlog::StringCompare(query->term1Name, query->term2Name);
+
+		for (int position = this->FindFirstPosition(predicate, key, useTerm2Order); position < factCount; ++position)
+		{
+			RomFact romFact;
+			this->ReadFact(useTerm2Order ? ROM_READ_ID(&term2Order[position]) : position, &romFact);
+
+			if (((int)romFact.predicate != predicate) || ((key != -1) && ((int)(useTerm2Order ? romFact.term2 : romFact.term1) != key)))
+				break;
+
+			if (romFact.termCount != (symbolid)query->termCount)
+				continue;
+
+			if (term2Bound && ((int)romFact.term2 != term2))
+				continue;
+
+			if ((query->termCount == 2) && (!term1Bound) && (!term2Bound) && ((romFact.term1 == romFact.term2) != sameVariables))
+				continue;
+
+			Fact fact{ (int8)romFact.termCount, ROM_READ_NAME(&symbols[romFact.predicate]), false, ROM_READ_NAME(&symbols[romFact.term1]),
+				false, ROM_READ_NAME(&symbols[romFact.term2]), 0 };
+
+			if (!visitor(&fact, userData))
+				return false;
+		}
+
+		return true;
+	}
+};
+
+#endif
+
+#ifdef ENABLE_KB_IMAGE
+
+#ifdef Arduino_h
+#error "knowledge base images require a PC build"
+#endif
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define KB_IMAGE_VERSION 1
+
+// all offsets are relative to the start of the image. values are stored in native byte order.
+struct KnowledgeBaseImageHeader
+{
+	char magic[4]; // "HZKB"
+	uint32_t version;
+	uint32_t fileSize;
+	uint32_t symbolCount;
+	uint32_t symbolOffsets; // uint32_t[symbolCount + 1], offset of each name. (name is preceded by its uint32_t id)
+	uint32_t symbolSlotCount; // power of two
+	uint32_t symbolSlots; // uint32_t[symbolSlotCount], open addressing hash table of symbol ids
+	uint32_t factCount;
+	uint32_t facts; // KnowledgeBaseImageFact[factCount]
+	uint32_t factBucketCount; // power of two
+	uint32_t factBuckets; // int32_t[3 * factBucketCount], chain heads of FactIndex keys
+	uint32_t factNext; // int32_t[3 * factCount], next fact of each key chain
+	uint32_t ruleCount;
+	uint32_t rules; // KnowledgeBaseImageRule[ruleCount]
+};
+
+struct KnowledgeBaseImageFact
+{
+	uint32_t termCount;
+	uint32_t predicate; // symbol ids
+	uint32_t term1;
+	uint32_t term2;
+};
+
+struct KnowledgeBaseImageRuleFact
+{
+	KnowledgeBaseImageFact fact;
+	uint32_t isTerm1Var;
+	uint32_t isTerm2Var;
+};
+
+struct KnowledgeBaseImageRule
+{
+	KnowledgeBaseImageRuleFact head;
+	KnowledgeBaseImageRuleFact fact1;
+	KnowledgeBaseImageRuleFact fact2;
+	uint32_t factCountInBody;
+	uint32_t op1IsAnd;
+};
+
+// precompiled knowledge base which is memory mapped and queried in place.
+// symbols, facts and fact index are used directly from the mapped file, so worker processes share the same pages.
+// only rules are copied at Open because names of image rules are offsets. (use GetFirstRule)
+// names of facts and rules point into the image, so they are canonical pointers when INTERNED_SYMBOLS is defined.
+class KnowledgeBaseImage : public FactSource
+{
+protected:
+	const char *base;
+	size_t size;
+	const KnowledgeBaseImageHeader *header;
+	const uint32_t *symbolOffsets;
+	const uint32_t *symbolSlots;
+	const KnowledgeBaseImageFact *facts;
+	const int32_t *factBuckets;
+	const int32_t *factNext;
+	Rule *rules;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	enum { KEY_PREDICATE = 0, KEY_TERM1 = 1, KEY_TERM2 = 2 };
+
+	static uint32_t GetKeyHash(int key, uint32_t termCount, uint32_t predicate, uint32_t term)
+	{
+		uint32_t hash = (predicate * 2654435761u) ^ (termCount + (uint32_t)key * 0x9e3779b9u);
+		hash = (hash ^ term) * 0x85ebca6bu;
+		return hash ^ (hash >> 13);
+	}
+
+	template <class T>
+	const T* At(uint32_t offset) const
+	{
+		return (const T*)(base + offset);
+	}
+
+	void SetFact(Fact *fact, const KnowledgeBaseImageFact *imageFact) const
+	{
+		fact->termCount = (int8)imageFact->termCount;
+		fact->predicateName = this->GetSymbolName(imageFact->predicate);
+		fact->isTerm1Var = false;
+		fact->term1Name = this->GetSymbolName(imageFact->term1);
+		fact->isTerm2Var = false;
+		fact->term2Name = this->GetSymbolName(imageFact->term2);
+		fact->nextFact = 0;
+	}
+
+	// tables are read as 4 byte items, so they must be aligned.
+	static bool IsValidRange(uint32_t offset, uint64_t itemSize, uint64_t itemCount, size_t size)
+	{
+		return ((offset & 3) == 0) && (((uint64_t)offset + (itemSize * itemCount)) <= (uint64_t)size);
+	}
+
+	static bool IsPowerOfTwo(uint32_t value)
+	{
+		return (value != 0) && ((value & (value - 1)) == 0);
+	}
+
+	bool IsValidSymbol(uint32_t id) const
+	{
+		return (id != 0) && (id <= header->symbolCount);
+	}
+
+	// each name is terminated inside the image and is preceded by its id. (used by FindSymbol)
+	// slots hold valid ids and at least one slot is empty, so FindSymbol stops.
+	bool IsValidSymbolTable() const
+	{
+		const uint32_t *offsets = this->At<uint32_t>(header->symbolOffsets);
+		const uint32_t *slots = this->At<uint32_t>(header->symbolSlots);
+
+		for (uint32_t id = 1; id <= header->symbolCount; ++id)
+		{
+			uint32_t offset = offsets[id];
+
+			if ((offset < sizeof(KnowledgeBaseImageHeader) + 4) || (offset >= size) || ((offset & 3) != 0)
+				|| (*this->At<uint32_t>(offset - 4) != id) || (!::memchr(base + offset, 0, size - offset)))
+				return false;
+		}
+
+		bool hasEmptySlot = false;
+		for (uint32_t slot = 0; slot < header->symbolSlotCount; ++slot)
+		{
+			if (slots[slot] == 0)
+				hasEmptySlot = true;
+			else if (!this->IsValidSymbol(slots[slot]))
+				return false;
+		}
+
+		return hasEmptySlot;
+	}
+
+	bool IsValidFact(const KnowledgeBaseImageFact *fact, uint32_t minTermCount) const
+	{
+		return (fact->termCount >= minTermCount) && (fact->termCount <= 2)
+			&& this->IsValidSymbol(fact->predicate) && this->IsValidSymbol(fact->term1) && this->IsValidSymbol(fact->term2);
+	}
+
+	// chain links point to a later fact, so chains end. (facts are linked in fact order)
+	bool IsValidFactTable() const
+	{
+		const KnowledgeBaseImageFact *imageFacts = this->At<KnowledgeBaseImageFact>(header->facts);
+		const int32_t *buckets = this->At<int32_t>(header->factBuckets);
+		const int32_t *next = this->At<int32_t>(header->factNext);
+		int64_t factCount = (int64_t)header->factCount;
+
+		for (uint32_t i = 0; i < header->factCount; ++i)
+		{
+			if (!this->IsValidFact(&imageFacts[i], 1))
+				return false;
+
+			for (int key = 0; key < 3; ++key)
+			{
+				int32_t link = next[i * 3 + key];
+
+				if ((link != -1) && ((link <= (int64_t)i) || (link >= factCount)))
+					return false;
+			}
+		}
+
+		for (uint64_t i = 0; i < (uint64_t)header->factBucketCount * 3; ++i)
+		{
+			if ((buckets[i] < -1) || (buckets[i] >= factCount))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool IsValidRuleTable() const
+	{
+		const KnowledgeBaseImageRule *imageRules = this->At<KnowledgeBaseImageRule>(header->rules);
+
+		for (uint32_t i = 0; i < header->ruleCount; ++i)
+		{
+			const KnowledgeBaseImageRule *rule = &imageRules[i];
+
+			if ((rule->factCountInBody < 1) || (rule->factCountInBody > 2)
+				|| (!this->IsValidFact(&rule->head.fact, 1)) || (!this->IsValidFact(&rule->fact1.fact, 1))
+				|| (!this->IsValidFact(&rule->fact2.fact, (rule->factCountInBody == 2) ? 1 : 0)))
+				return false;
+		}
+
+		return true;
+	}
+
+	// header, table ranges, symbol ids and chain links are checked, so a damaged image can not be read out of bounds.
+	bool IsValidImage() const
+	{
+		if ((size < sizeof(KnowledgeBaseImageHeader)) || (::memcmp(header->magic, "HZKB", 4) != 0)
+			|| (header->version != KB_IMAGE_VERSION) || (header->fileSize != size))
+			return false;
+
+		return KnowledgeBaseImage::IsValidRange(header->symbolOffsets, 4, (uint64_t)header->symbolCount + 1, size)
+			&& KnowledgeBaseImage::IsValidRange(header->symbolSlots, 4, header->symbolSlotCount, size)
+			&& KnowledgeBaseImage::IsValidRange(header->facts, sizeof(KnowledgeBaseImageFact), header->factCount, size)
+			&& KnowledgeBaseImage::IsValidRange(header->factBuckets, 4, (uint64_t)header->factBucketCount * 3, size)
+			&& KnowledgeBaseImage::IsValidRange(header->factNext, 4, (uint64_t)header->factCount * 3, size)
+			&& KnowledgeBaseImage::IsValidRange(header->rules, sizeof(KnowledgeBaseImageRule), header->ruleCount, size)
+			&& KnowledgeBaseImage::IsPowerOfTwo(header->symbolSlotCount) && KnowledgeBaseImage::IsPowerOfTwo(header->factBucketCount)
+			&& this->IsValidSymbolTable() && this->IsValidFactTable() && this->IsValidRuleTable();
+	}
+
+	void SetRuleFact(Fact *fact, const KnowledgeBaseImageRuleFact *imageFact) const
+	{
+		this->SetFact(fact, &imageFact->fact);
+		fact->isTerm1Var = (imageFact->isTerm1Var != 0);
+		fact->isTerm2Var = (imageFact->isTerm2Var != 0);
+	}
+
+	void LoadRules()
+	{
+		uint32_t ruleCount = header->ruleCount;
+		rules = ruleCount ? new Rule[ruleCount] : 0;
+
+		const KnowledgeBaseImageRule *imageRules = this->At<KnowledgeBaseImageRule>(header->rules);
+
+		for (uint32_t i = 0; i < ruleCount; ++i)
+		{
+			Rule *rule = &rules[i];
+			this->SetRuleFact(&rule->head, &imageRules[i].head);
+			this->SetRuleFact(&rule->fact1, &imageRules[i].fact1);
+			this->SetRuleFact(&rule->fact2, &imageRules[i].fact2);
+			rule->factCountInBody = (int8)imageRules[i].factCountInBody;
+			rule->op1IsAnd = (imageRules[i].op1IsAnd != 0);
+			rule->nextRule = ((i + 1) < ruleCount) ? &rules[i + 1] : 0;
+		}
+	}
+
+public:
+
+	KnowledgeBaseImage()
+	{
+		base = 0;
+		size = 0;
+		rules = 0;
+	}
+
+	~KnowledgeBaseImage()
+	{
+		this->Close();
+	}
+
+	bool Open(const char *fileName)
+	{
+		this->Close();
+
+#ifdef _WIN32
+		file = ::CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		mapping = 0;
+		if (::GetFileSizeEx(file, &fileSize) && (fileSize.QuadPart > 0))
+			mapping = ::CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+
+		if (!mapping)
+		{
+			::CloseHandle(file);
+			return false;
+		}
+
+		base = (const char*)::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!base)
+		{
+			::CloseHandle(mapping);
+			::CloseHandle(file);
+			return false;
+		}
+
+		size = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(fileName, O_RDONLY);
+		if (fd == -1)
+			return false;
+
+		struct stat fileInfo;
+		if ((::fstat(fd, &fileInfo) != 0) || (fileInfo.st_size <= 0))
+		{
+			::close(fd);
+			return false;
+		}
+
+		void *memory = ::mmap(0, (size_t)fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd); // mapping keeps the file
+
+		if (memory == MAP_FAILED)
+			return false;
+
+		base = (const char*)memory;
+		size = (size_t)fileInfo.st_size;
+#endif
+
+		header = (const KnowledgeBaseImageHeader*)base;
+
+		if (!this->IsValidImage())
+		{
+			this->Close();
+			return false;
+		}
+
+		symbolOffsets = this->At<uint32_t>(header->symbolOffsets);
+		symbolSlots = this->At<uint32_t>(header->symbolSlots);
+		facts = this->At<KnowledgeBaseImageFact>(header->facts);
+		factBuckets = this->At<int32_t>(header->factBuckets);
+		factNext = this->At<int32_t>(header->factNext);
+
+		this->LoadRules();
+		return true;
+	}
+
+	void Close()
+	{
+		delete[] rules;
+		rules = 0;
+
+		if (!base)
+			return;
+
+#ifdef _WIN32
+		::UnmapViewOfFile(base);
+		::CloseHandle(mapping);
+		::CloseHandle(file);
+#else
+		::munmap((void*)base, size);
+#endif
+
+		base = 0;
+		size = 0;
+	}
+
+	const Rule* GetFirstRule() const
+	{
+		return rules;
+	}
+
+	uint32_t GetFactCount() const
+	{
+		return base ? header->factCount : 0;
+	}
+
+	const char* GetSymbolName(uint32_t id) const
+	{
+		return base + symbolOffsets[id];
+	}
+
+	// returns 0 if name is not in the image.
+	uint32_t FindSymbol(const char *name) const
+	{
+		if ((name >= base) && (name < (base + size))) // name is already a canonical name of the image
+			return *(const uint32_t*)(name - sizeof(uint32_t));
+
+		uint32_t mask = header->symbolSlotCount - 1;
+		uint32_t slot = SymbolTable::HashString(name) & mask;
+
+		while (symbolSlots[slot])
 		{
-			Fact fact1Results[MAX_MATCHING_FACTS];
+			if (::strcmp(this->GetSymbolName(symbolSlots[slot]), name) == 0)
+				return symbolSlots[slot];
 
-			bool found = false;
-			for (int8 i = 0; i < matchingRulesCount; ++i)
-			{
-				const Rule *matchingRule = matchingRules[i];
+			slot = (slot + 1) & mask;
+		}
 
-#ifndef NO_RECURSIVE_RULES
-				matchingRule->readLock = true; // acquire lock
-#endif
+		return 0;
+	}
 
-				Rule queringRule;
-				HazeProlog::CopyRule(matchingRule, &queringRule);
-				HazeProlog::ReplaceVariablesInRule(query, matchingRule, &queringRule);
+	// replace names of the query with canonical names of the image. (required if INTERNED_SYMBOLS is defined)
+	// returns false if a name is not in the image. (such names are not changed)
+	bool InternQuery(Fact *query) const
+	{
+		const char **names[3] = { &query->predicateName, &query->term1Name, &query->term2Name };
+		bool found = true;
 
-				// make the fact who has single variable as first fact of queringRule
-				if ((queringRule.factCountInBody == 2) && (queringRule.op1IsAnd))
-				{
-					if (HazeProlog::GetVariableCountOfQuery(&queringRule.fact1) == 2) // exchange fact1 with fact2
-					{
-						Fact tmp;
-						HazeProlog::CopyFact(&tmp, &queringRule.fact1);
-						HazeProlog::CopyFact(&queringRule.fact1, &queringRule.fact2);
-						HazeProlog::CopyFact(&queringRule.fact2, &tmp);
-					}
-				}
+		for (int i = 0; i < ((query->termCount == 2) ? 3 : 2); ++i)
+		{
+			uint32_t id = this->FindSymbol(*names[i]);
 
-				int8 resultCountForFact1 = 0;
-				bool hasResults = this->SolveQuery(&queringRule.fact1, &resultCountForFact1, fact1Results);
+			if (id)
+				*names[i] = this->GetSymbolName(id);
+			else
+				found = false;
+		}
 
-				PRINT_BUFFER_USAGE(resultCountForFact1, MAX_MATCHING_FACTS);
+		return found;
+	}
 
-				if (queringRule.factCountInBody == 1)
-				{
-					for (int8 j = 0; j < resultCountForFact1; ++j) // add first fact results
-					{
-						HazeProlog::CopyFact(&results[(*resultCount)], &fact1Results[j]);
-						++(*resultCount);
-					}
-				}
-#ifndef NO_OR_RULES
-				else if ((queringRule.factCountInBody == 2) && (!queringRule.op1IsAnd)) // OR with second fact
-				{
-					for (int8 j = 0; j < resultCountForFact1; ++j) // add first fact results
-					{
-						HazeProlog::CopyFact(&results[(*resultCount)], &fact1Results[j]);
-						++(*resultCount);
-					}
+	bool VisitMatchingFacts(const Fact *query, FactVisitor visitor, void *userData) const
+	{
+		if (!base)
+			return true;
 
-					int8 resultCountForFact2 = 0;
-					bool hasResults2 = this->SolveQuery(&queringRule.fact2, &resultCountForFact2, fact1Results); // we can use same buffer(fact1Results) to store results.
+		bool term1Bound = !query->isTerm1Var;
+		bool term2Bound = (query->termCount == 2) && (!query->isTerm2Var);
 
-					PRINT_BUFFER_USAGE(resultCountForFact2, MAX_MATCHING_FACTS);
+		uint32_t predicate = this->FindSymbol(query->predicateName);
+		uint32_t term1 = term1Bound ? this->FindSymbol(query->term1Name) : 0;
+		uint32_t term2 = term2Bound ? this->FindSymbol(query->term2Name) : 0;
 
-					for (int8 j = 0; j < resultCountForFact2; ++j) // add second fact results
-					{
-						HazeProlog::CopyFact(&results[(*resultCount)], &fact1Results[j]);
-						++(*resultCount);
-					}
+		if ((!predicate) || (term1Bound && (!term1)) || (term2Bound && (!term2))) // unknown names can not match
+			return true;
 
-					hasResults |= hasResults2;
-				}
-#endif
-				else if (hasResults && (queringRule.factCountInBody == 2) && (queringRule.op1IsAnd)) // AND with second fact
-				{
-					int8 fact1VariableCount = HazeProlog::GetVariableCountOfQuery(&queringRule.fact1);
-					bool hasResults2 = false;
+		int key = term1Bound ? KEY_TERM1 : (term2Bound ? KEY_TERM2 : KEY_PREDICATE);
+		uint32_t termCount = (uint32_t)query->termCount;
+		uint32_t hash = KnowledgeBaseImage::GetKeyHash(key, termCount, predicate, term1Bound ? term1 : term2);
 
-					for (int8 j = 0; j < resultCountForFact1; ++j) // check each fact1 results
-					{
-						Fact queringFact;
-						HazeProlog::CopyFact(&queringFact, &queringRule.fact2);
-
-						// replace queringFact variables with fact1 result
-						if (queringRule.fact1.isTerm1Var)
-						{
-							if (HazeProlog::StringCompare(queringRule.fact1.term1Name, queringFact.term1Name))
-							{
-								queringFact.term1Name = fact1Results[j].term1Name;
-								queringFact.isTerm1Var = false;
-							}
-							else if ((queringFact.termCount == 2) && HazeProlog::StringCompare(queringRule.fact1.term1Name, queringFact.term2Name))
-							{
-								queringFact.term2Name = fact1Results[j].term1Name;
-								queringFact.isTerm2Var = false;
-							}
-						}
-
-						if ((queringRule.fact1.termCount == 2) && queringRule.fact1.isTerm2Var)
-						{
-							if (HazeProlog::StringCompare(queringRule.fact1.term2Name, queringFact.term1Name))
-							{
-								queringFact.term1Name = fact1Results[j].term1Name;
-								queringFact.isTerm1Var = false;
-							}
-							else if ((queringFact.termCount == 2) && HazeProlog::StringCompare(queringRule.fact1.term2Name, queringFact.term2Name))
-							{
-								queringFact.term2Name = fact1Results[j].term1Name;
-								queringFact.isTerm2Var = false;
-							}
-						}
-
-						// solve queringFact
-						if (fact1VariableCount == 1) // first fact has one variable
-						{
-							if (HazeProlog::GetVariableCountOfQuery(&queringRule.head) == 1) // output require one column results
-							{
-								hasResults2 |= this->SolveQuery(&queringFact, resultCount, results);
-							}
-							else // output require 2 column results. So, we need to re-arrange results according to query. Ex: "query(X,Y)" and we have "rule(X,Y) = fact1(X) , fact2(X,Y)"
-							{
-#ifndef NO_ALL_VAR_QUERIES
-								OptFunc1(&hasResults2, &queringFact, &queringRule, fact1Results, resultCount, results, j);
-#endif
-							}
-						}
-						else if (fact1VariableCount == 2) // both facts has 2 variables. Ex: "query(X,Y)" and we have "rule(X,Y) = fact1(X,Z) , fact2(Z,Y)"
-						{
-#ifndef NO_ALL_VAR_QUERIES
-							OptFunc2(&hasResults2, &queringFact, &queringRule, fact1Results, resultCount, results, j);
-#endif
-						}
-					}
+		// pred(X , X) or pred(X , Y)
+		bool sameVariables = (!term1Bound) && (termCount == 2) && (!term2Bound) && HazeProlog::StringCompare(query->term1Name, query->term2Name);
 
-					hasResults &= hasResults2;
-				}
+		for (int32_t i = factBuckets[key * header->factBucketCount + (hash & (header->factBucketCount - 1))]; i != -1; i = factNext[i * 3 + key])
+		{
+			const KnowledgeBaseImageFact *imageFact = &facts[i];
 
-#ifndef NO_RECURSIVE_RULES
-				matchingRule->readLock = false; // release lock
-#endif
+			if ((imageFact->predicate != predicate) || (imageFact->termCount != termCount))
+				continue;
 
-				found |= hasResults;
-			}
+			if (term1Bound && (imageFact->term1 != term1))
+				continue;
 
-			return found;
+			if (term2Bound && (imageFact->term2 != term2))
+				continue;
+
+			if ((termCount == 2) && (!term1Bound) && (!term2Bound) && ((imageFact->term1 == imageFact->term2) != sameVariables))
+				continue;
+
+			Fact fact;
+			this->SetFact(&fact, imageFact);
+
+			if (!visitor(&fact, userData))
+				return false;
 		}
 
-		return false;
+		return true;
 	}
 
-	NO_INLINE bool SolveQuery(const Fact *query, int8 *resultCount, Fact *results)
+	// writes the fact and rule chains into an image file.
+	static bool Compile(const char *fileName, const Rule *firstRule, const Fact *firstFact)
 	{
-#ifdef PRINT_FREE_MEM
-		PRINT("SolveQuery Free Mem: ");
-		PRINT(freeMemory());
-		PRINT("\n");
-#endif
+		uint32_t factCount = 0, ruleCount = 0;
+
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
+			++factCount;
 
-		if (!this->SolveRuleQuery(query, resultCount, results)) // do we have matching rules?
+		for (const Rule *rule = firstRule; rule; rule = rule->nextRule)
+			++ruleCount;
+
+		// intern all names
+		uint32_t slotCount = 16;
+		while (slotCount < (((factCount + ruleCount * 3) * 3 + 1) * 2))
+			slotCount *= 2;
+
+		// (zeroed, so names which are not interned yet are never read uninitialized)
+		const char **names = (const char**)::calloc(slotCount, sizeof(const char*));
+		symbolid *slots = (symbolid*)::calloc(slotCount, sizeof(symbolid));
+
+		if ((!names) || (!slots))
 		{
-			return this->SolveFactQuery(query, resultCount, results); // search in facts list if we don't have matching rules.
+			::free(names);
+			::free(slots);
+			return false;
 		}
-		return true;
-	}
 
-	// if query has one var then print first term of result
-	// if query has two vars then print both terms of result
-	// if query has no vars then print true
-	static void PrintResultAccordingToQuery(Fact *query, Fact *result)
-	{
-		int8 varCount = HazeProlog::GetVariableCountOfQuery(query);
+		SymbolTable symbols;
+		symbols.SetStorage(names, slots, slotCount);
+		symbols.Intern(""); // term2 of single term facts
 
-		if (varCount == 0)
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact)
 		{
-			PRINT("true");
+			symbols.Intern(fact->predicateName);
+			symbols.Intern(fact->term1Name);
+			symbols.Intern(fact->term2Name);
 		}
-		else if (varCount == 1)
+
+		for (const Rule *rule = firstRule; rule; rule = rule->nextRule)
 		{
-			PRINT(result->term1Name);
+			const Fact *ruleFacts[3] = { &rule->head, &rule->fact1, &rule->fact2 };
+
+			for (int i = 0; i < 3; ++i)
+			{
+				symbols.Intern(ruleFacts[i]->predicateName);
+				symbols.Intern(ruleFacts[i]->term1Name);
+				symbols.Intern(ruleFacts[i]->term2Name);
+			}
 		}
-		else if (varCount == 2)
+
+		uint32_t symbolCount = symbols.GetSymbolCount();
+		uint32_t factBucketCount = 1;
+		while (factBucketCount < factCount)
+			factBucketCount *= 2;
+
+		// layout
+		KnowledgeBaseImageHeader header;
+		::memset(&header, 0, sizeof(header));
+		::memcpy(header.magic, "HZKB", 4);
+		header.version = KB_IMAGE_VERSION;
+		header.symbolCount = symbolCount;
+		header.symbolSlotCount = slotCount;
+		header.factCount = factCount;
+		header.factBucketCount = factBucketCount;
+		header.ruleCount = ruleCount;
+
+		uint64_t offset = sizeof(KnowledgeBaseImageHeader);
+		header.symbolOffsets = (uint32_t)offset;
+		offset += 4 * ((uint64_t)symbolCount + 1);
+		header.symbolSlots = (uint32_t)offset;
+		offset += 4 * (uint64_t)slotCount;
+		uint64_t stringsOffset = offset;
+
+		for (uint32_t id = 1; id <= symbolCount; ++id)
+			offset += (4 + ::strlen(symbols.GetName(id)) + 1 + 3) & ~(uint64_t)3;
+
+		header.facts = (uint32_t)offset;
+		offset += sizeof(KnowledgeBaseImageFact) * (uint64_t)factCount;
+		header.factBuckets = (uint32_t)offset;
+		offset += 4 * 3 * (uint64_t)factBucketCount;
+		header.factNext = (uint32_t)offset;
+		offset += 4 * 3 * (uint64_t)factCount;
+		header.rules = (uint32_t)offset;
+		offset += sizeof(KnowledgeBaseImageRule) * (uint64_t)ruleCount;
+
+		if (offset > 0xffffffffu)
 		{
-			PRINT(result->term1Name);
-			PRINT(", ");
-			PRINT(result->term2Name);
+			::free(names);
+			::free(slots);
+			return false;
 		}
 
-		PRINT("\n");
+		header.fileSize = (uint32_t)offset;
+
+		char *image = (char*)::calloc(1, (size_t)offset);
+		if (!image)
+		{
+			::free(names);
+			::free(slots);
+			return false;
+		}
+
+		::memcpy(image, &header, sizeof(header));
+
+		// symbols
+		uint32_t *symbolOffsets = (uint32_t*)(image + header.symbolOffsets);
+		uint32_t *symbolSlots = (uint32_t*)(image + header.symbolSlots);
+		offset = stringsOffset;
+
+		for (uint32_t id = 1; id <= symbolCount; ++id)
+		{
+			const char *name = symbols.GetName(id);
+			size_t length = ::strlen(name);
+
+			*(uint32_t*)(image + offset) = id;
+			symbolOffsets[id] = (uint32_t)offset + 4;
+			::memcpy(image + offset + 4, name, length + 1);
+			offset += (4 + length + 1 + 3) & ~(uint64_t)3;
+
+			uint32_t slot = SymbolTable::HashString(name) & (slotCount - 1);
+			while (symbolSlots[slot])
+				slot = (slot + 1) & (slotCount - 1);
+			symbolSlots[slot] = id;
+		}
+
+		// facts and their index chains. (inserted backwards to keep fact order in each chain)
+		KnowledgeBaseImageFact *imageFacts = (KnowledgeBaseImageFact*)(image + header.facts);
+		int32_t *factBuckets = (int32_t*)(image + header.factBuckets);
+		int32_t *factNext = (int32_t*)(image + header.factNext);
+
+		for (uint32_t i = 0; i < (3 * factBucketCount); ++i)
+			factBuckets[i] = -1;
+
+		uint32_t index = 0;
+		for (const Fact *fact = firstFact; fact; fact = fact->nextFact, ++index)
+		{
+			imageFacts[index].termCount = (uint32_t)fact->termCount;
+			imageFacts[index].predicate = symbols.Find(fact->predicateName);
+			imageFacts[index].term1 = symbols.Find(fact->term1Name);
+			imageFacts[index].term2 = symbols.Find(fact->term2Name);
+		}
+
+		for (int32_t i = (int32_t)factCount - 1; i >= 0; --i)
+		{
+			const KnowledgeBaseImageFact *imageFact = &imageFacts[i];
+			uint32_t terms[3] = { 0, imageFact->term1, imageFact->term2 };
+
+			for (int key = KEY_PREDICATE; key <= KEY_TERM2; ++key)
+			{
+				factNext[i * 3 + key] = -1;
+
+				if ((key == KEY_TERM2) && (imageFact->termCount != 2))
+					continue;
+
+				uint32_t hash = KnowledgeBaseImage::GetKeyHash(key, imageFact->termCount, imageFact->predicate, terms[key]);
+				int32_t *head = &factBuckets[key * factBucketCount + (hash & (factBucketCount - 1))];
+				factNext[i * 3 + key] = *head;
+				*head = i;
+			}
+		}
+
+		// rules
+		KnowledgeBaseImageRule *imageRules = (KnowledgeBaseImageRule*)(image + header.rules);
+
+		index = 0;
+		for (const Rule *rule = firstRule; rule; rule = rule->nextRule, ++index)
+		{
+			const Fact *ruleFacts[3] = { &rule->head, &rule->fact1, &rule->fact2 };
+			KnowledgeBaseImageRuleFact *imageRuleFacts[3] = { &imageRules[index].head, &imageRules[index].fact1, &imageRules[index].fact2 };
+
+			for (int i = 0; i < 3; ++i)
+			{
+				imageRuleFacts[i]->fact.termCount = (uint32_t)ruleFacts[i]->termCount;
+				imageRuleFacts[i]->fact.predicate = symbols.Find(ruleFacts[i]->predicateName);
+				imageRuleFacts[i]->fact.term1 = symbols.Find(ruleFacts[i]->term1Name);
+				imageRuleFacts[i]->fact.term2 = symbols.Find(ruleFacts[i]->term2Name);
+				imageRuleFacts[i]->isTerm1Var = ruleFacts[i]->isTerm1Var ? 1 : 0;
+				imageRuleFacts[i]->isTerm2Var = ruleFacts[i]->isTerm2Var ? 1 : 0;
+			}
+
+			imageRules[index].factCountInBody = (uint32_t)rule->factCountInBody;
+			imageRules[index].op1IsAnd = rule->op1IsAnd ? 1 : 0;
+		}
+
+		::free(names);
+		::free(slots);
+
+		FILE *file = ::fopen(fileName, "wb");
+		bool written = file && (::fwrite(image, 1, header.fileSize, file) == header.fileSize);
+
+		if (file)
+			written &= (::fclose(file) == 0);
+
+		::free(image);
+		return written;
 	}
 
-#ifdef ENABLE_SERIAL_PARSER
+private:
+	KnowledgeBaseImage(const KnowledgeBaseImage&);
+	KnowledgeBaseImage& operator=(const KnowledgeBaseImage&);
+};
 
-	static uint8_t ReadStringFromSerial(char *buffer)
+#endif
+
+#ifdef ENABLE_BATCH_QUERIES
+
+#ifdef Arduino_h
+#error "batch queries require a PC build"
+#endif
+
+#if __cplusplus < 201103L
+#error "batch queries require C++11"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// solves arrays of independent queries on a pool of threads. results are written per query in input order.
+// queries are split into one range per thread. a thread which finished its range steals the upper half of
+// another thread's range. each thread keeps its own query arena between batches, and HazeProlog is only read.
+// (answer table and query cache of HazeProlog are not used by the threads)
+class BatchQuerySolver
+{
+protected:
+	// remaining queries of a thread. (begin in low 32 bits, end in high 32 bits)
+	struct WorkRange
 	{
-		uint8_t inIndex = 0;
+		std::atomic<unsigned long long> range;
+		char padding[64 - sizeof(std::atomic<unsigned long long>)]; // one cache line per thread
+	};
 
-		while (!Serial.available()){} // wait till we receive data
+	struct Worker
+	{
+		QueryArena arena;
+		std::vector<void*> buffer; // aligned storage
+	};
 
-		while (Serial.available() > 0)
+	static unsigned long long MakeRange(unsigned int begin, unsigned int end)
+	{
+		return ((unsigned long long)end << 32) | begin;
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<Worker*> workers; // worker 0 is the calling thread
+	WorkRange *ranges;
+
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	unsigned int batchNumber;
+	int runningCount;
+	bool stopping;
+
+	// current batch
+	const HazeProlog *prolog;
+	const Fact *queries;
+	ResultVector *results;
+	SolveStatus *statuses;
+
+	std::atomic<unsigned long> stealCount;
+
+	// takes the next query of the thread. returns -1 if range is empty.
+	int TakeQuery(int workerIndex)
+	{
+		std::atomic<unsigned long long> *range = &ranges[workerIndex].range;
+		unsigned long long current = range->load();
+
+		for (;;)
 		{
-			buffer[inIndex] = Serial.read();
-			++inIndex;
-		}
+			unsigned int begin = (unsigned int)current, end = (unsigned int)(current >> 32);
 
-		buffer[inIndex] = 0; // null termination
-		return inIndex;
+			if (begin >= end)
+				return -1;
+
+			if (range->compare_exchange_weak(current, BatchQuerySolver::MakeRange(begin + 1, end)))
+				return (int)begin;
+		}
 	}
 
-	// Serial Monitor Options: No line ending
-	void EvalSerialInput()
+	// moves upper half of the largest range of other threads into the range of the thread.
+	bool StealQueries(int workerIndex)
 	{
-		char inData[40];
-		uint8_t inLength = HazeProlog::ReadStringFromSerial(inData);
+		int workerCount = (int)workers.size();
 
-		if (inLength > 0)
+		for (;;)
 		{
-			char* parenthesStart = strchr(inData, '(');
-			if (parenthesStart)
+			int victim = -1;
+			unsigned long long victimRange = 0;
+			unsigned int largest = 0;
+
+			for (int i = 0; i < workerCount; ++i)
 			{
-				char* parenthesEnd = strchr(inData, ')');
-				if (parenthesEnd)
-				{
-					char* comma = strchr(inData, ',');
-					bool hasComma = (comma == 0) ? false : true;
+				unsigned long long current = ranges[i].range.load();
+				unsigned int begin = (unsigned int)current, end = (unsigned int)(current >> 32);
 
-					Fact query;
-					query.termCount = hasComma ? 2 : 1;
+				if ((i != workerIndex) && (begin < end) && ((end - begin) > largest))
+				{
+					victim = i;
+					victimRange = current;
+					largest = end - begin;
+				}
+			}
 
-					query.predicateName = inData;
-					*parenthesStart = 0;
+			if (victim == -1)
+				return false;
 
-					query.term1Name = parenthesStart + 1;
-					*parenthesEnd = 0;
+			unsigned int begin = (unsigned int)victimRange, end = (unsigned int)(victimRange >> 32);
+			unsigned int middle = begin + ((end - begin) / 2); // a single query is taken whole
 
-					if (hasComma) // two terms
-					{
-						*comma = 0;
-						query.term2Name = comma + 1;
-					}
+			if (ranges[victim].range.compare_exchange_strong(victimRange, BatchQuerySolver::MakeRange(begin, middle)))
+			{
+				ranges[workerIndex].range.store(BatchQuerySolver::MakeRange(middle, end));
+				++stealCount;
+				return true;
+			}
+		}
+	}
 
-					query.nextFact = 0;
+	void RunWorker(int workerIndex)
+	{
+		QuerySession session;
+		session.arena = &workers[workerIndex]->arena;
+		session.answerTable = 0;
+		session.queryCache = 0;
 
-					HazeProlog::FixVariableFlags(&query);
+		do
+		{
+			int index;
+			while ((index = this->TakeQuery(workerIndex)) != -1)
+			{
+				results[index].Clear();
+				statuses[index] = prolog->SolveQuery(&queries[index], &results[index], &session);
+			}
+		} while (this->StealQueries(workerIndex));
+	}
 
-					int8 resultCount = 0;
-					Fact results[MAX_MATCHING_FACTS];
+	void ThreadMain(int workerIndex)
+	{
+		unsigned int lastBatch = 0;
 
-					if (this->SolveQuery(&query, &resultCount, results))
-					{
-						for (int8 i = 0; i < resultCount; ++i)
-							HazeProlog::PrintResultAccordingToQuery(&query, &results[i]);
-					}
-					else
-					{
-						Serial.println("no results!");
-					}
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				startCondition.wait(lock, [&] { return stopping || (batchNumber != lastBatch); });
 
+				if (stopping)
 					return;
-				}
+
+				lastBatch = batchNumber;
 			}
+
+			this->RunWorker(workerIndex);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--runningCount == 0)
+				doneCondition.notify_one();
 		}
+	}
 
-		Serial.println("Invalid query!");
+public:
+
+	BatchQuerySolver()
+	{
+		ranges = 0;
+		batchNumber = 0;
+		runningCount = 0;
+		stopping = false;
+		prolog = 0;
+		queries = 0;
+		results = 0;
+		statuses = 0;
+		stealCount = 0;
 	}
 
-#endif
+	~BatchQuerySolver()
+	{
+		this->Stop();
+	}
+
+	// threadCount includes the calling thread. (0 uses all hardware threads)
+	// arenaSize is the query arena size of each thread. returns false if threads cannot be created.
+	bool Start(int threadCount, size_t arenaSize)
+	{
+		this->Stop();
+
+		if (threadCount <= 0)
+			threadCount = (int)std::thread::hardware_concurrency();
+
+		if (threadCount <= 0)
+			threadCount = 1;
+
+		ranges = new WorkRange[threadCount];
+
+		for (int i = 0; i < threadCount; ++i)
+		{
+			Worker *worker = new Worker;
+			worker->buffer.resize((arenaSize + sizeof(void*) - 1) / sizeof(void*));
+			worker->arena.SetStorage(&worker->buffer[0], worker->buffer.size() * sizeof(void*));
+			workers.push_back(worker);
+			ranges[i].range = 0;
+		}
+
+		try
+		{
+			for (int i = 1; i < threadCount; ++i)
+				threads.push_back(std::thread(&BatchQuerySolver::ThreadMain, this, i));
+		}
+		catch (const std::system_error&)
+		{
+			this->Stop();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		startCondition.notify_all();
+
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+
+		for (size_t i = 0; i < workers.size(); ++i)
+			delete workers[i];
+
+		delete[] ranges;
+
+		threads.clear();
+		workers.clear();
+		ranges = 0;
+		stopping = false;
+	}
+
+	int GetThreadCount() const
+	{
+		return (int)workers.size();
+	}
+
+	// solves each query into results[i] and statuses[i]. results of all queries are ready when Solve returns.
+	// knowledge base of prolog must not be changed during the batch. (uses a single thread if Start was not called)
+	// all statuses are SOLVE_OUT_OF_MEMORY if that thread cannot be started.
+	void Solve(const HazeProlog *prolog, const Fact *queries, int queryCount, ResultVector *results, SolveStatus *statuses)
+	{
+		if (workers.empty() && (!this->Start(1, QUERY_ARENA_SIZE)))
+		{
+			for (int i = 0; i < queryCount; ++i)
+			{
+				results[i].Clear();
+				statuses[i] = SOLVE_OUT_OF_MEMORY;
+			}
+
+			return;
+		}
+
+		this->prolog = prolog;
+		this->queries = queries;
+		this->results = results;
+		this->statuses = statuses;
+
+		int workerCount = (int)workers.size();
+		for (int i = 0; i < workerCount; ++i)
+		{
+			ranges[i].range = BatchQuerySolver::MakeRange((unsigned int)(((long long)queryCount * i) / workerCount),
+				(unsigned int)(((long long)queryCount * (i + 1)) / workerCount));
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			runningCount = workerCount - 1;
+			++batchNumber;
+		}
+		startCondition.notify_all();
 
+		this->RunWorker(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [&] { return runningCount == 0; });
+	}
+
+	// number of ranges which were moved to idle threads.
+	unsigned long GetStealCount() const
+	{
+		return stealCount;
+	}
+
+private:
+	BatchQuerySolver(const BatchQuerySolver&);
+	BatchQuerySolver& operator=(const BatchQuerySolver&);
 };
 
 #endif
+
+#endif
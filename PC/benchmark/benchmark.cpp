@@ -0,0 +1,682 @@
+
+// measures the engine with synthetic knowledge bases.
+// usage: benchmark [-i] [-p] [-t | -T] [-c] [-b] [-r] [-k] [-d] [-s scale]
+//   -i  use FactIndex and RuleIndex (with term1 chains)
+//   -p  use PredicateStatistics (goal reordering)
+//   -t  use an AnswerTable for each query. (-T keeps answers between queries)
+//   -c  use a QueryCache. (repeated queries are answered from the cache)
+//   -b  measure BatchQuerySolver throughput from 1 thread up to all hardware threads
+//   -r  solve alternative rules and OR branches on a QueryTaskPool
+//   -k  store facts in a ColumnarFactStore instead of the fact list
+//   -d  compute facts of the rules with a DatalogEvaluator before the queries (rules become fact lookups)
+//   -s  size multiplier of the generated knowledge bases (default 1)
+// reports queries/sec, answers/sec, latency percentiles, peak query arena usage and peak stack usage.
+
+//#define INTERNED_SYMBOLS
+#define ENABLE_BATCH_QUERIES
+#define ENABLE_PARALLEL_RULES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "../HazeProlog.h"
+
+typedef std::chrono::steady_clock Clock;
+
+#define MIN_BENCHMARK_SECONDS 0.25
+#define MIN_BENCHMARK_QUERIES 10
+
+// storage of generated names. (facts keep pointers to them)
+class NamePool
+{
+protected:
+	std::vector<char*> blocks;
+	size_t used;
+
+#ifdef INTERNED_SYMBOLS
+	std::vector<const char*> symbolNames;
+	std::vector<symbolid> symbolSlots;
+	SymbolTable symbols;
+#endif
+
+public:
+
+	NamePool(unsigned int maxNames)
+	{
+		used = 0;
+
+#ifdef INTERNED_SYMBOLS
+		unsigned int capacity = 64;
+		while (capacity < (maxNames * 2))
+			capacity *= 2;
+
+		symbolNames.resize(capacity);
+		symbolSlots.resize(capacity);
+		symbols.SetStorage(&symbolNames[0], &symbolSlots[0], capacity);
+#else
+		(void)maxNames;
+#endif
+	}
+
+	~NamePool()
+	{
+		for (size_t i = 0; i < blocks.size(); ++i)
+			free(blocks[i]);
+	}
+
+	// returns the canonical pointer of the name. (text is not copied)
+	const char* Get(const char *text)
+	{
+#ifdef INTERNED_SYMBOLS
+		return symbols.GetName(symbols.Intern(text));
+#else
+		return text;
+#endif
+	}
+
+	const char* Format(const char *prefix, int number)
+	{
+		if (blocks.empty() || ((used + 32) > 65536))
+		{
+			blocks.push_back((char*)malloc(65536));
+			used = 0;
+		}
+
+		char *text = blocks.back() + used;
+		used += sprintf(text, "%s%d", prefix, number) + 1;
+
+		return this->Get(text);
+	}
+};
+
+struct KnowledgeBase
+{
+	std::vector<Fact> facts;
+	std::vector<Rule> rules;
+
+	std::vector<FactIndexEntry> factIndexEntries;
+	std::vector<int> factIndexBuckets;
+	FactIndex factIndex;
+
+	std::vector<RuleIndexEntry> ruleIndexEntries;
+	std::vector<int> ruleIndexBuckets;
+	std::vector<int> ruleTerm1Buckets;
+	RuleIndex ruleIndex;
+
+	std::vector<PredicateStats> statisticsEntries;
+	std::vector<unsigned int> statisticsScratch;
+	PredicateStatistics statistics;
+
+	std::vector<const char*> columnSymbolNames;
+	std::vector<symbolid> columnSymbolSlots;
+	SymbolTable columnSymbols;
+	std::vector<FactColumnTable> columnTables;
+	std::vector<symbolid> term1Column;
+	std::vector<symbolid> term2Column;
+	ColumnarFactStore columnStore;
+
+	std::vector<DynamicFactEntry> dynamicEntries;
+	std::vector<int> dynamicBuckets;
+	DynamicFactStore dynamicStore;
+	std::vector<Fact> deltaFacts;
+	std::vector<Fact> nextDeltaFacts;
+	DatalogEvaluator evaluator;
+
+	void AddFact(const char *predicateName, const char *term1Name, const char *term2Name)
+	{
+		Fact fact{ (int8)(term2Name[0] ? 2 : 1), predicateName, false, term1Name, false, term2Name, 0 };
+		facts.push_back(fact);
+	}
+
+	// (termCount of fact2 is 0 for single fact bodies)
+	void AddRule(const Fact &head, const Fact &fact1, bool op1IsAnd, const Fact &fact2)
+	{
+		Rule rule = Rule();
+		rule.head = head;
+		rule.factCountInBody = (int8)(fact2.termCount ? 2 : 1);
+		rule.fact1 = fact1;
+		rule.op1IsAnd = op1IsAnd;
+		rule.fact2 = fact2;
+
+		HazeProlog::FixVariableFlags(&rule.head);
+		HazeProlog::FixVariableFlags(&rule.fact1);
+		HazeProlog::FixVariableFlags(&rule.fact2);
+		rules.push_back(rule);
+	}
+
+	void Link()
+	{
+		for (size_t i = 0; (i + 1) < facts.size(); ++i)
+			facts[i].nextFact = &facts[i + 1];
+
+		for (size_t i = 0; (i + 1) < rules.size(); ++i)
+			rules[i].nextRule = &rules[i + 1];
+	}
+
+	const Fact* GetFirstFact() const
+	{
+		return facts.empty() ? 0 : &facts[0];
+	}
+
+	const Rule* GetFirstRule() const
+	{
+		return rules.empty() ? 0 : &rules[0];
+	}
+
+	// columns replace the fact list. (returns false if symbols do not fit into symbolid)
+	bool BuildColumns()
+	{
+		unsigned int capacity = 16;
+		while (capacity < (facts.size() * 4))
+			capacity *= 2;
+
+		columnSymbolNames.resize(capacity);
+		columnSymbolSlots.resize(capacity);
+		columnSymbols.SetStorage(&columnSymbolNames[0], &columnSymbolSlots[0], capacity);
+
+		columnTables.resize(64);
+		term1Column.resize(facts.size() + 1);
+		term2Column.resize(facts.size() + 1);
+		columnStore.SetStorage(&columnTables[0], (int)columnTables.size(), &term1Column[0], &term2Column[0], (int)term1Column.size());
+
+		return columnStore.Build(this->GetFirstFact(), &columnSymbols);
+	}
+
+	// store holds the facts and the facts of the rules. (returns false if storage is too small)
+	bool Materialize()
+	{
+		unsigned int capacity = (unsigned int)(facts.size() * 8 + 64);
+
+		unsigned int bucketCount = 16;
+		while (bucketCount < capacity)
+			bucketCount *= 2;
+
+		dynamicEntries.resize(capacity);
+		dynamicBuckets.resize(bucketCount * 6);
+		dynamicStore.SetStorage(&dynamicEntries[0], (int)capacity, &dynamicBuckets[0], bucketCount);
+		dynamicStore.Clear();
+
+		deltaFacts.resize(capacity);
+		nextDeltaFacts.resize(capacity);
+		evaluator.SetStorage(&deltaFacts[0], &nextDeltaFacts[0], (int)capacity);
+
+		Clock::time_point start = Clock::now();
+		if (!evaluator.Evaluate(this->GetFirstRule(), this->GetFirstFact(), &dynamicStore))
+			return false;
+
+		printf("(datalog: %d facts derived in %d rounds, %.1f ms)\n", evaluator.GetDerivedCount(), evaluator.GetRoundCount(),
+			std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+		return true;
+	}
+
+	// answerTable is 0 if queries are not tabled.
+	void Attach(HazeProlog *prolog, AnswerTable *answerTable, bool useIndex, bool useStatistics, bool useColumns, bool useDatalog)
+	{
+		if (answerTable)
+			answerTable->Clear(); // answers of previous knowledge base
+
+		prolog->SetPredicateStatistics(0);
+		prolog->SetFactSource(0);
+
+		if (useDatalog && this->Materialize())
+		{
+			prolog->SetRuleFactDefinitions(0, 0);
+			prolog->SetFactSource(&dynamicStore);
+			return;
+		}
+
+		if (useColumns && this->BuildColumns())
+		{
+			prolog->SetRuleFactDefinitions(this->GetFirstRule(), 0);
+			prolog->SetFactSource(&columnStore);
+			return;
+		}
+
+		if (useStatistics)
+		{
+			statisticsEntries.resize(64);
+			statistics.SetStorage(&statisticsEntries[0], (unsigned int)statisticsEntries.size());
+
+			unsigned int scratchCount = 16;
+			while (scratchCount <= (facts.size() * 2))
+				scratchCount *= 2;
+
+			statisticsScratch.resize(scratchCount);
+			if (statistics.Build(this->GetFirstFact(), &statisticsScratch[0], scratchCount))
+				prolog->SetPredicateStatistics(&statistics);
+		}
+
+		if (!useIndex)
+		{
+			prolog->SetRuleFactDefinitions(this->GetFirstRule(), this->GetFirstFact());
+			return;
+		}
+
+		unsigned int bucketCount = 16;
+		while (bucketCount < facts.size())
+			bucketCount *= 2;
+
+		factIndexEntries.resize(facts.size() + 1);
+		factIndexBuckets.resize(bucketCount * 3);
+		factIndex.SetStorage(&factIndexEntries[0], (int)factIndexEntries.size(), &factIndexBuckets[0], bucketCount);
+
+		bucketCount = 16;
+		while (bucketCount < rules.size())
+			bucketCount *= 2;
+
+		ruleIndexEntries.resize(rules.size() + 1);
+		ruleIndexBuckets.resize(bucketCount);
+		ruleIndex.SetStorage(&ruleIndexEntries[0], (int)ruleIndexEntries.size(), &ruleIndexBuckets[0], bucketCount);
+
+		ruleTerm1Buckets.resize(bucketCount * 2);
+		ruleIndex.SetTerm1Storage(&ruleTerm1Buckets[0], bucketCount);
+
+		prolog->SetRuleFactDefinitions(this->GetFirstRule(), this->GetFirstFact(), &factIndex, &ruleIndex);
+	}
+};
+
+static Fact MakeQuery(int8 termCount, const char *predicateName, const char *term1Name, const char *term2Name)
+{
+	Fact query{ termCount, predicateName, false, term1Name, false, term2Name, 0 };
+	HazeProlog::FixVariableFlags(&query);
+	return query;
+}
+
+// family tree of full binary generations. person i has mother 2i and father 2i+1.
+static void GenerateFamilyTree(KnowledgeBase *kb, NamePool *names, int generations, std::vector<const char*> *persons)
+{
+	int personCount = (1 << generations) - 1;
+	persons->resize(personCount + 1);
+
+	for (int i = 1; i <= personCount; ++i)
+		(*persons)[i] = names->Format("p", i);
+
+	const char *motherOf = names->Get("motherOf");
+	const char *fatherOf = names->Get("fatherOf");
+
+	for (int i = 1; (i * 2 + 1) <= personCount; ++i)
+	{
+		kb->AddFact(motherOf, (*persons)[i], (*persons)[i * 2]);
+		kb->AddFact(fatherOf, (*persons)[i], (*persons)[i * 2 + 1]);
+	}
+
+	const char *X = names->Get("X"), *F = names->Get("F"), *GM = names->Get("GM"), *Y = names->Get("Y");
+	const char *grandMotherOf = names->Get("grandMotherOf"), *parentOf = names->Get("parentOf");
+
+	kb->AddRule({ 2, grandMotherOf, true, X, true, GM, 0 }, { 2, motherOf, true, X, true, F, 0 }, true, { 2, motherOf, true, F, true, GM, 0 });
+	kb->AddRule({ 2, grandMotherOf, true, X, true, GM, 0 }, { 2, fatherOf, true, X, true, F, 0 }, true, { 2, motherOf, true, F, true, GM, 0 });
+	kb->AddRule({ 2, parentOf, true, X, true, Y, 0 }, { 2, motherOf, true, X, true, Y, 0 }, false, { 2, fatherOf, true, X, true, Y, 0 });
+
+	kb->Link();
+}
+
+// directed random graph with edgeCount edges. (xorshift, fixed seed)
+static void GenerateGraph(KnowledgeBase *kb, NamePool *names, int nodeCount, int edgeCount, std::vector<const char*> *nodes)
+{
+	nodes->resize(nodeCount);
+
+	for (int i = 0; i < nodeCount; ++i)
+		(*nodes)[i] = names->Format("n", i);
+
+	const char *edge = names->Get("edge");
+	unsigned int state = 2463534242u;
+
+	for (int i = 0; i < edgeCount; ++i)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		int from = (int)(state % (unsigned int)nodeCount);
+
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		int to = (int)(state % (unsigned int)nodeCount);
+
+		kb->AddFact(edge, (*nodes)[from], (*nodes)[to]);
+	}
+
+	const char *X = names->Get("X"), *Y = names->Get("Y"), *Z = names->Get("Z");
+	kb->AddRule({ 2, names->Get("path2"), true, X, true, Z, 0 }, { 2, edge, true, X, true, Y, 0 }, true, { 2, edge, true, Y, true, Z, 0 });
+
+	kb->Link();
+}
+
+// single predicate table with rowCount rows and valueCount distinct values.
+// a few rows are tagged and taggedRow(X) :- row(X, v0), tag(X) joins a large goal with a small one.
+static void GenerateWideTable(KnowledgeBase *kb, NamePool *names, int rowCount, int valueCount,
+	std::vector<const char*> *keys, std::vector<const char*> *values)
+{
+	keys->resize(rowCount);
+	values->resize(valueCount);
+
+	for (int i = 0; i < valueCount; ++i)
+		(*values)[i] = names->Format("v", i);
+
+	const char *row = names->Get("row");
+
+	for (int i = 0; i < rowCount; ++i)
+	{
+		(*keys)[i] = names->Format("k", i);
+		kb->AddFact(row, (*keys)[i], (*values)[i % valueCount]);
+	}
+
+	const char *tag = names->Get("tag");
+	for (int i = 0; i < rowCount; i += (rowCount / 4))
+		kb->AddFact(tag, (*keys)[i], names->Get(""));
+
+	const char *X = names->Get("X");
+	kb->AddRule({ 1, names->Get("taggedRow"), true, X, false, names->Get(""), 0 }, { 2, row, true, X, false, (*values)[0], 0 }, true,
+		{ 1, tag, true, X, false, names->Get(""), 0 });
+
+	kb->Link();
+}
+
+struct BenchmarkRun
+{
+	long long answerCount;
+	char *stackBase;
+	char *stackTop; // lowest stack address seen by the visitor
+};
+
+static bool CountSolution(const Fact *solution, void *userData)
+{
+	(void)solution;
+	BenchmarkRun *run = (BenchmarkRun*)userData;
+	char marker;
+
+	++run->answerCount;
+	if (&marker < run->stackTop)
+		run->stackTop = &marker;
+
+	return true;
+}
+
+static double GetPercentile(const std::vector<double> &sortedLatencies, double percentile)
+{
+	size_t index = (size_t)(percentile * (sortedLatencies.size() - 1) + 0.5);
+	return sortedLatencies[index];
+}
+
+NO_INLINE static void RunBenchmark(const char *name, HazeProlog *prolog, QueryArena *arena, const std::vector<Fact> &queries)
+{
+	static char arenaBuffer[QUERY_ARENA_SIZE];
+	arena->SetStorage(arenaBuffer, sizeof(arenaBuffer)); // resets peak usage
+
+	char stackBase;
+	BenchmarkRun run{ 0, &stackBase, &stackBase };
+	std::vector<double> latencies;
+
+	Clock::time_point start = Clock::now();
+	double totalSeconds = 0.0;
+
+	for (size_t i = 0; (totalSeconds < MIN_BENCHMARK_SECONDS) || (latencies.size() < MIN_BENCHMARK_QUERIES); ++i)
+	{
+		const Fact *query = &queries[i % queries.size()];
+
+		Clock::time_point queryStart = Clock::now();
+		prolog->VisitSolutions(query, CountSolution, &run);
+		Clock::time_point queryEnd = Clock::now();
+
+		latencies.push_back(std::chrono::duration<double, std::micro>(queryEnd - queryStart).count());
+		totalSeconds = std::chrono::duration<double>(queryEnd - start).count();
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("%-22s %8d %11.0f %12.0f %9.2f %9.2f %9.2f %9.2f %8d %8d\n", name, (int)latencies.size(),
+		latencies.size() / totalSeconds, run.answerCount / totalSeconds,
+		GetPercentile(latencies, 0.5), GetPercentile(latencies, 0.9), GetPercentile(latencies, 0.99), latencies.back(),
+		(int)arena->GetPeakUsage(), (int)(run.stackBase - run.stackTop));
+}
+
+// solves the queries as batches with 1, 2, 4 ... threads and reports speedup over a single thread.
+static void RunBatchScaling(const char *name, const HazeProlog *prolog, const std::vector<Fact> &queries)
+{
+	const int batchSize = 4096;
+	std::vector<Fact> batch(batchSize);
+	std::vector<ResultVector> results(batchSize);
+	std::vector<SolveStatus> statuses(batchSize);
+
+	for (int i = 0; i < batchSize; ++i)
+		batch[i] = queries[i % queries.size()];
+
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	double singleThreadRate = 0.0;
+
+	for (int threadCount = 1; ; threadCount *= 2)
+	{
+		if (threadCount > maxThreads)
+			threadCount = maxThreads;
+
+		BatchQuerySolver solver;
+		if (!solver.Start(threadCount, QUERY_ARENA_SIZE * 64))
+			return;
+
+		long long queryCount = 0;
+		Clock::time_point start = Clock::now();
+		double totalSeconds = 0.0;
+
+		while (totalSeconds < MIN_BENCHMARK_SECONDS)
+		{
+			solver.Solve(prolog, &batch[0], batchSize, &results[0], &statuses[0]);
+			queryCount += batchSize;
+			totalSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		}
+
+		double rate = queryCount / totalSeconds;
+		if (threadCount == 1)
+			singleThreadRate = rate;
+
+		printf("%-22s %8d %11.0f %8.2fx %8lu\n", name, threadCount, rate, rate / singleThreadRate, solver.GetStealCount());
+
+		if (threadCount == maxThreads)
+			break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	bool useIndex = false;
+	bool useStatistics = false;
+	int tableMode = 0; // 1 = per query, 2 = persistent
+	bool useCache = false;
+	bool useBatch = false;
+	bool useParallelRules = false;
+	bool useColumns = false;
+	bool useDatalog = false;
+	int scale = 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-i") == 0)
+			useIndex = true;
+		else if (strcmp(argv[i], "-p") == 0)
+			useStatistics = true;
+		else if (strcmp(argv[i], "-t") == 0)
+			tableMode = 1;
+		else if (strcmp(argv[i], "-T") == 0)
+			tableMode = 2;
+		else if (strcmp(argv[i], "-c") == 0)
+			useCache = true;
+		else if (strcmp(argv[i], "-b") == 0)
+			useBatch = true;
+		else if (strcmp(argv[i], "-r") == 0)
+			useParallelRules = true;
+		else if (strcmp(argv[i], "-k") == 0)
+			useColumns = true;
+		else if (strcmp(argv[i], "-d") == 0)
+			useDatalog = true;
+		else if ((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc))
+			scale = atoi(argv[++i]);
+		else
+		{
+			printf("usage: benchmark [-i] [-p] [-t | -T] [-c] [-b] [-r] [-k] [-d] [-s scale]\n");
+			return 1;
+		}
+	}
+
+	if (scale < 1)
+		scale = 1;
+
+	int generations = 12;
+	while ((1 << (generations - 12)) < scale)
+		++generations;
+
+	int nodeCount = 2000 * scale, edgeCount = 10000 * scale;
+	int rowCount = 20000 * scale, valueCount = 100;
+
+	NamePool names((1 << generations) + nodeCount + rowCount + valueCount + 64);
+	KnowledgeBase family, graph, table;
+	std::vector<const char*> persons, nodes, keys, values;
+
+	GenerateFamilyTree(&family, &names, generations, &persons);
+	GenerateGraph(&graph, &names, nodeCount, edgeCount, &nodes);
+	GenerateWideTable(&table, &names, rowCount, valueCount, &keys, &values);
+
+	printf("family tree: %d facts, graph: %d facts, wide table: %d facts, index: %s, statistics: %s, tabling: %s, cache: %s, parallel rules: %s, columns: %s, datalog: %s\n\n",
+		(int)family.facts.size(), (int)graph.facts.size(), (int)table.facts.size(), useIndex ? "yes" : "no", useStatistics ? "yes" : "no",
+		(tableMode == 2) ? "persistent" : (tableMode ? "per query" : "no"), useCache ? "yes" : "no",
+		useParallelRules ? "yes" : "no", useColumns ? "yes" : "no", useDatalog ? "yes" : "no");
+
+	printf("%-22s %8s %11s %12s %9s %9s %9s %9s %8s %8s\n", "benchmark", "queries", "queries/s", "answers/s",
+		"p50 us", "p90 us", "p99 us", "max us", "arena B", "stack B");
+
+	HazeProlog prolog;
+	QueryArena arena;
+	prolog.SetQueryArena(&arena);
+
+	// (answers of the two variable queries fill the table, so those queries run out of table memory)
+	std::vector<AnswerTableEntry> tableEntries(1 << 16);
+	std::vector<TableAnswer> tableAnswers(1 << 18);
+	std::vector<int> tableBuckets(2 << 18);
+	AnswerTable answerTable;
+
+	if (tableMode)
+	{
+		answerTable.SetStorage(&tableEntries[0], (int)tableEntries.size(), &tableAnswers[0], (int)tableAnswers.size(),
+			&tableBuckets[0], (unsigned int)tableBuckets.size() / 2);
+		answerTable.SetPersistent(tableMode == 2);
+		prolog.SetAnswerTable(&answerTable);
+	}
+
+	std::vector<QueryCacheEntry> cacheEntries(1 << 14);
+	std::vector<Fact> cacheResults(1 << 20);
+	std::vector<int> cacheBuckets(1 << 14);
+	std::vector<char> cacheNames(1 << 16);
+	QueryCache queryCache;
+
+	if (useCache)
+	{
+		queryCache.SetStorage(&cacheEntries[0], (int)cacheEntries.size(), &cacheResults[0], (int)cacheResults.size(),
+			&cacheBuckets[0], (unsigned int)cacheBuckets.size(), &cacheNames[0], (int)cacheNames.size());
+		prolog.SetQueryCache(&queryCache);
+	}
+
+	QueryTaskPool taskPool;
+
+	if (useParallelRules)
+	{
+		int threadCount = (int)std::thread::hardware_concurrency() - 1; // caller solves a branch too
+		if (taskPool.Start((threadCount > 0) ? threadCount : 1, QUERY_ARENA_SIZE * 64))
+			prolog.SetParallelRules(&taskPool, 64);
+	}
+
+	const char *X = names.Get("X"), *Y = names.Get("Y"), *GM = names.Get("GM");
+	int parentCount = (1 << (generations - 1)) - 1; // persons with parents
+	std::vector<Fact> queries;
+
+	// family tree
+	family.Attach(&prolog, tableMode ? &answerTable : 0, useIndex, useStatistics, useColumns, useDatalog);
+
+	queries.clear();
+	for (int i = 1; i <= parentCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("motherOf"), persons[i], persons[i * 2]));
+	RunBenchmark("bound lookup", &prolog, &arena, queries);
+
+	queries.clear();
+	for (int i = 1; i <= parentCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("motherOf"), persons[i], X));
+	RunBenchmark("one variable", &prolog, &arena, queries);
+
+	queries.clear();
+	for (int i = 1; i <= parentCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("motherOf"), X, persons[i * 2]));
+	RunBenchmark("one variable (term2)", &prolog, &arena, queries);
+
+	queries.clear();
+	queries.push_back(MakeQuery(2, names.Get("motherOf"), X, Y));
+	RunBenchmark("two variables", &prolog, &arena, queries);
+
+	queries.clear();
+	for (int i = 1; i <= (parentCount / 2); i += 7)
+		queries.push_back(MakeQuery(2, names.Get("grandMotherOf"), persons[i], GM));
+	RunBenchmark("and join", &prolog, &arena, queries);
+
+	queries.clear();
+	for (int i = 1; i <= parentCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("parentOf"), persons[i], X));
+	RunBenchmark("or rule", &prolog, &arena, queries);
+
+	// random graph
+	graph.Attach(&prolog, tableMode ? &answerTable : 0, useIndex, useStatistics, useColumns, useDatalog);
+
+	queries.clear();
+	for (int i = 0; i < nodeCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("edge"), nodes[i], X));
+	RunBenchmark("graph edges", &prolog, &arena, queries);
+
+	queries.clear();
+	for (int i = 0; i < nodeCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("path2"), nodes[i], X));
+	RunBenchmark("graph path2 join", &prolog, &arena, queries);
+
+	// wide table
+	table.Attach(&prolog, tableMode ? &answerTable : 0, useIndex, useStatistics, useColumns, useDatalog);
+
+	queries.clear();
+	for (int i = 0; i < rowCount; i += 7)
+		queries.push_back(MakeQuery(2, names.Get("row"), keys[i], X));
+	RunBenchmark("table key lookup", &prolog, &arena, queries);
+
+	queries.clear();
+	for (int i = 0; i < valueCount; ++i)
+		queries.push_back(MakeQuery(2, names.Get("row"), X, values[i]));
+	RunBenchmark("table value scan", &prolog, &arena, queries);
+
+	queries.clear();
+	queries.push_back(MakeQuery(1, names.Get("taggedRow"), X, names.Get("")));
+	RunBenchmark("selective and", &prolog, &arena, queries);
+
+	if (useCache)
+	{
+		printf("\nquery cache: %lu hits, %lu misses, %lu evictions\n", queryCache.GetHitCount(), queryCache.GetMissCount(),
+			queryCache.GetEvictionCount());
+	}
+
+	if (useBatch)
+	{
+		printf("\n%-22s %8s %11s %9s %8s\n", "batch", "threads", "queries/s", "speedup", "steals");
+
+		graph.Attach(&prolog, tableMode ? &answerTable : 0, useIndex, useStatistics, useColumns, useDatalog);
+
+		queries.clear();
+		for (int i = 0; i < nodeCount; i += 7)
+			queries.push_back(MakeQuery(2, names.Get("edge"), nodes[i], X));
+		RunBatchScaling("graph edges", &prolog, queries);
+
+		queries.clear();
+		for (int i = 0; i < nodeCount; i += 7)
+			queries.push_back(MakeQuery(2, names.Get("path2"), nodes[i], X));
+		RunBatchScaling("graph path2 join", &prolog, queries);
+	}
+
+	return 0;
+}
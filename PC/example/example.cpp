@@ -1,5 +1,6 @@
 
 //#define MONITOR_BUFFERS
+//#define INTERNED_SYMBOLS
 
 #include <stdio.h>
 #include "../HazeProlog.h"
@@ -58,11 +59,28 @@ int main()
 
 	//FixVariableFlags(&query); // no need to call if you are manualy set variable flags!
 
-	int8 resultCount = 0;
+	rcount resultCount = 0;
 	Fact results[MAX_MATCHING_FACTS];
 
 	HazeProlog prolog;
+
+#ifdef INTERNED_SYMBOLS
+	const char *symbolNames[64];
+	symbolid symbolSlots[64];
+	Fact internedFacts[16];
+	Rule internedRules[8];
+	int internedFactCount, internedRuleCount;
+
+	SymbolTable symbols;
+	symbols.SetStorage(symbolNames, symbolSlots, 64);
+	symbols.InternFacts(&fact1, internedFacts, 16, &internedFactCount);
+	symbols.InternRules(&rule1, internedRules, 8, &internedRuleCount);
+	symbols.InternFact(&query);
+
+	prolog.SetRuleFactDefinitions(internedRules, internedFacts);
+#else
 	prolog.SetRuleFactDefinitions(&rule1, &fact1);
+#endif
 
 	if (prolog.SolveQuery(&query, &resultCount, results))
 	{
@@ -0,0 +1,22 @@
+% same knowledge base as example.cpp
+
+motherOf(marry, judy).
+motherOf(ann, marry).
+motherOf(dick, jane).
+fatherOf(tom, dick).
+fruit(apple).
+likes(john, wine).
+likes(ann, wine).
+likes(madona, wine).
+female(ann).
+female(madona).
+understands(madona, tom).
+understands(ann, tom).
+
+grandMotherOf(X, GM) :- motherOf(X, F), motherOf(F, GM).
+grandMotherOf(X, GM) :- fatherOf(X, F), motherOf(F, GM).
+likes(john, X) :- likes(X, wine).
+john-likes-mother(X) :- john-likes(X), motherOf(X, marry).
+is-bitch(X) :- female(X), likes(X, wine).
+friend-with(tom, X) :- understands(X, tom).
+female-with-like-to(X, Y) :- likes(X, Y), female(X).
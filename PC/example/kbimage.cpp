@@ -0,0 +1,128 @@
+
+// compiles a knowledge base into a memory mapped image and queries it in place.
+// usage: kbimage compile <file.pl> <file.hkb>
+//        kbimage query <file.hkb> <query>
+
+//#define INTERNED_SYMBOLS
+#define ENABLE_KB_IMAGE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "../HazeProlog.h"
+
+static char* ReadTextFile(const char *fileName)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (!file)
+		return 0;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char *text = (char*)malloc(size + 1);
+	size_t readSize = fread(text, 1, size, file);
+	text[readSize] = 0;
+
+	fclose(file);
+	return text;
+}
+
+static bool PrintSolution(const Fact *solution, void *userData)
+{
+	HazeProlog::PrintResultAccordingToQuery((const Fact*)userData, solution);
+	return true;
+}
+
+static int Compile(const char *sourceFile, const char *imageFile)
+{
+	char *text = ReadTextFile(sourceFile);
+	if (!text)
+	{
+		printf("cannot read %s\n", sourceFile);
+		return 1;
+	}
+
+	int maxFacts, maxRules;
+	KnowledgeBaseLoader::CountClauses(text, &maxFacts, &maxRules);
+
+	Fact *facts = new Fact[maxFacts];
+	Rule *rules = new Rule[maxRules];
+
+	KnowledgeBaseLoader loader;
+	loader.SetStorage(facts, maxFacts, rules, maxRules);
+
+	int result = 0;
+
+	if (!loader.Load(text))
+	{
+		printf("line %d: %s\n", loader.GetErrorLine(), loader.GetError());
+		result = 1;
+	}
+	else if (!KnowledgeBaseImage::Compile(imageFile, loader.GetFirstRule(), loader.GetFirstFact()))
+	{
+		printf("cannot write %s\n", imageFile);
+		result = 1;
+	}
+	else
+	{
+		printf("compiled %d facts, %d rules\n", loader.GetFactCount(), loader.GetRuleCount());
+	}
+
+	delete[] facts;
+	delete[] rules;
+	free(text);
+
+	return result;
+}
+
+static int Query(const char *imageFile, char *queryText)
+{
+	KnowledgeBaseImage image;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool opened = image.Open(imageFile);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (!opened)
+	{
+		printf("cannot open %s\n", imageFile);
+		return 1;
+	}
+
+	printf("opened %u facts in %.3f ms\n", image.GetFactCount(), seconds * 1000.0);
+
+	Fact query;
+	KnowledgeBaseLoader parser;
+	if (!parser.ParseQuery(queryText, &query))
+	{
+		printf("invalid query: %s\n", parser.GetError());
+		return 1;
+	}
+
+	image.InternQuery(&query); // names of the image are canonical
+
+	HazeProlog prolog;
+	prolog.SetRuleFactDefinitions(image.GetFirstRule(), 0);
+	prolog.SetFactSource(&image);
+
+	if (!prolog.SolveQuery(&query, PrintSolution, &query))
+		printf("no results!\n");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc == 4) && (strcmp(argv[1], "compile") == 0))
+		return Compile(argv[2], argv[3]);
+
+	if ((argc == 4) && (strcmp(argv[1], "query") == 0))
+		return Query(argv[2], argv[3]);
+
+	printf("usage: kbimage compile <file.pl> <file.hkb>\n");
+	printf("       kbimage query <file.hkb> <query>\n");
+	return 1;
+}
@@ -0,0 +1,120 @@
+
+// loads a knowledge base from Prolog source text and reports load throughput.
+// usage: loader [file.pl] [query]
+// (generates a synthetic knowledge base if no file is given)
+
+//#define INTERNED_SYMBOLS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "../HazeProlog.h"
+
+static char* ReadTextFile(const char *fileName)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (!file)
+		return 0;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char *text = (char*)malloc(size + 1);
+	size_t readSize = fread(text, 1, size, file);
+	text[readSize] = 0;
+
+	fclose(file);
+	return text;
+}
+
+// parent(pN, pM) facts of a binary tree with a grandParent rule
+static char* GenerateText(int factCount)
+{
+	char *text = (char*)malloc(factCount * 40 + 256);
+	char *position = text;
+
+	for (int i = 1; i < factCount; ++i)
+		position += sprintf(position, "parent(p%d, p%d).\n", i, i / 2);
+
+	sprintf(position, "grandParent(X, GP) :- parent(X, P), parent(P, GP).\n");
+	return text;
+}
+
+static bool PrintSolution(const Fact *solution, void *userData)
+{
+	HazeProlog::PrintResultAccordingToQuery((const Fact*)userData, solution);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	char *text = (argc > 1) ? ReadTextFile(argv[1]) : GenerateText(100000);
+	if (!text)
+	{
+		printf("cannot read %s\n", argv[1]);
+		return 1;
+	}
+
+	int maxFacts, maxRules;
+	KnowledgeBaseLoader::CountClauses(text, &maxFacts, &maxRules);
+
+	Fact *facts = new Fact[maxFacts];
+	Rule *rules = new Rule[maxRules];
+
+	KnowledgeBaseLoader loader;
+	loader.SetStorage(facts, maxFacts, rules, maxRules);
+
+#ifdef INTERNED_SYMBOLS
+	unsigned int symbolCapacity = 64;
+	while (symbolCapacity < (unsigned int)(maxFacts + maxRules) * 8)
+		symbolCapacity *= 2;
+
+	const char **symbolNames = new const char*[symbolCapacity];
+	symbolid *symbolSlots = new symbolid[symbolCapacity];
+
+	SymbolTable symbols;
+	symbols.SetStorage(symbolNames, symbolSlots, symbolCapacity);
+	loader.SetSymbolTable(&symbols);
+#endif
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool loaded = loader.Load(text);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (!loaded)
+	{
+		printf("line %d: %s\n", loader.GetErrorLine(), loader.GetError());
+		return 1;
+	}
+
+	int clauseCount = loader.GetFactCount() + loader.GetRuleCount();
+	printf("loaded %d facts, %d rules in %.3f ms (%.0f clauses/sec)\n", loader.GetFactCount(), loader.GetRuleCount(),
+		seconds * 1000.0, (seconds > 0.0) ? (clauseCount / seconds) : 0.0);
+
+	if (argc > 2)
+	{
+		Fact query;
+		if (!loader.ParseQuery(argv[2], &query))
+		{
+			printf("invalid query: %s\n", loader.GetError());
+			return 1;
+		}
+
+		HazeProlog prolog;
+		prolog.SetRuleFactDefinitions(loader.GetFirstRule(), loader.GetFirstFact());
+
+		if (!prolog.SolveQuery(&query, PrintSolution, &query))
+			printf("no results!\n");
+	}
+
+#ifdef INTERNED_SYMBOLS
+	delete[] symbolNames;
+	delete[] symbolSlots;
+#endif
+	delete[] facts;
+	delete[] rules;
+	free(text);
+
+	return 0;
+}
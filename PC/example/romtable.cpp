@@ -0,0 +1,55 @@
+
+// facts compiled into constexpr ROM tables. (no runtime initialization)
+// build with -std=c++14
+
+#define ENABLE_ROM_TABLES
+
+#include <stdio.h>
+#include "../HazeProlog.h"
+
+constexpr RomFactDefinition factDefinitions[] = {
+	{ 2, "motherOf", "marry", "judy" },
+	{ 2, "motherOf", "ann", "marry" },
+	{ 2, "motherOf", "dick", "jane" },
+	{ 2, "fatherOf", "tom", "dick" },
+	{ 1, "fruit", "apple", "" },
+	{ 2, "likes", "john", "wine" },
+	{ 2, "likes", "ann", "wine" },
+	{ 2, "likes", "madona", "wine" },
+	{ 1, "female", "ann", "" },
+	{ 1, "female", "madona", "" },
+	{ 2, "understands", "madona", "tom" },
+	{ 2, "understands", "ann", "tom" }
+};
+
+ROM_FACT_TABLE(factTable, factDefinitions);
+
+Rule rule2{ { 2, "grandMotherOf", true, "X", true, "GM", 0 }, 2
+	, { 2, "fatherOf", true, "X", true, "F", 0 }, true
+	, { 2, "motherOf", true, "F", true, "GM", 0 }, 0 };
+
+Rule rule1{ { 2, "grandMotherOf", true, "X", true, "GM", 0 }, 2
+	, { 2, "motherOf", true, "X", true, "F", 0 }, true
+	, { 2, "motherOf", true, "F", true, "GM", 0 }, &rule2 };
+
+static bool PrintSolution(const Fact *solution, void *userData)
+{
+	HazeProlog::PrintResultAccordingToQuery((const Fact*)userData, solution);
+	return true;
+}
+
+int main()
+{
+	RomFactSource factSource(&factTable);
+
+	HazeProlog prolog;
+	prolog.SetRuleFactDefinitions(&rule1, 0);
+	prolog.SetFactSource(&factSource);
+
+	Fact query{ 2, "grandMotherOf", true, "X", true, "GM", 0 };
+
+	if (!prolog.SolveQuery(&query, PrintSolution, &query))
+		printf("no results!\n");
+
+	return 0;
+}
@@ -0,0 +1,1774 @@
+// regression tests of the knowledge base engine.
+// build: g++ -std=c++14 -Wall regression.cpp -o regression -lpthread
+// returns 0 if all checks pass. (ROM table checks are skipped before C++14)
+// also build with -mavx2 and with -DNO_SIMD_SCAN to check each scan kernel.
+
+#define ENABLE_KB_IMAGE
+#define ENABLE_BATCH_QUERIES
+#define ENABLE_PARALLEL_RULES
+
+#if __cplusplus >= 201402L
+#define ENABLE_ROM_TABLES
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <list>
+#include <set>
+#include "../HazeProlog.h"
+
+static int failureCount = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++failureCount; \
+		} \
+	} while (0)
+
+#define CHECK_RESULTS(actual, expected) \
+	do \
+	{ \
+		std::string actualText = (actual); \
+		if (actualText != (expected)) \
+		{ \
+			printf("%s:%d: expected \"%s\", got \"%s\"\n", __FILE__, __LINE__, (expected), actualText.c_str()); \
+			++failureCount; \
+		} \
+	} while (0)
+
+// fact of one or two terms. (term2Name is 0 for one term facts) names which start with a capital letter are variables.
+static Fact MakeFact(const char *predicateName, const char *term1Name, const char *term2Name)
+{
+	Fact fact{ (int8)(term2Name ? 2 : 1), predicateName, false, term1Name, false, term2Name ? term2Name : "", 0 };
+	HazeProlog::FixVariableFlags(&fact);
+	return fact;
+}
+
+// links facts in array order. returns the first fact.
+static Fact* LinkFacts(Fact *facts, int count)
+{
+	for (int i = 0; i < count; ++i)
+		facts[i].nextFact = (i + 1 < count) ? &facts[i + 1] : 0;
+
+	return facts;
+}
+
+// rule of one goal, or of two goals joined by AND. (fact2 is 0 for one goal rules)
+static Rule MakeRule(const Fact &head, const Fact &fact1, const Fact *fact2)
+{
+	Rule rule = Rule();
+	rule.head = head;
+	rule.factCountInBody = fact2 ? 2 : 1;
+	rule.fact1 = fact1;
+	rule.op1IsAnd = true;
+
+	if (fact2)
+		rule.fact2 = *fact2;
+
+	return rule;
+}
+
+// links rules in array order. returns the first rule.
+static Rule* LinkRules(Rule *rules, int count)
+{
+	for (int i = 0; i < count; ++i)
+		rules[i].nextRule = (i + 1 < count) ? &rules[i + 1] : 0;
+
+	return rules;
+}
+
+// values of query variables of a solution. ("a,b" or "true" for a ground query)
+static void AppendResult(std::string *output, const Fact *query, const Fact *result)
+{
+	int valueCount = HazeProlog::GetVariableCountOfQuery(query);
+
+	if (!output->empty())
+		*output += " ";
+
+	if (valueCount == 0)
+		*output += "true";
+
+	if (valueCount >= 1)
+		*output += result->term1Name;
+
+	if (valueCount == 2)
+	{
+		*output += ",";
+		*output += result->term2Name;
+	}
+}
+
+// results of the int8 query API. ("a,b c,d")
+static std::string SolveResults(HazeProlog *prolog, const Fact *query)
+{
+	Fact results[MAX_MATCHING_FACTS];
+	int8 resultCount = 0;
+	std::string output;
+
+	if (prolog->SolveQuery(query, &resultCount, results))
+	{
+		for (int i = 0; i < resultCount; ++i)
+			AppendResult(&output, query, &results[i]);
+	}
+
+	return output;
+}
+
+// solutions of a query and the query which the visitor starts for each solution
+struct VisitedQuery
+{
+	const Fact *query;
+	std::string output;
+	HazeProlog *prolog;
+	const Fact *innerQuery;
+};
+
+// values of query variables of each solution. (same format as SolveResults)
+static bool AppendVisitor(const Fact *solution, void *userData)
+{
+	VisitedQuery *visited = (VisitedQuery*)userData;
+	AppendResult(&visited->output, visited->query, solution);
+	return true;
+}
+
+// results of VisitSolutions. ("a,b c,d")
+static std::string VisitResults(HazeProlog *prolog, const Fact *query)
+{
+	VisitedQuery visited;
+	visited.query = query;
+	prolog->VisitSolutions(query, AppendVisitor, &visited);
+
+	return visited.output;
+}
+
+// knowledge base loaded from Prolog source text
+class TestBase
+{
+public:
+	char text[2048];
+	Fact facts[64];
+	Rule rules[32];
+	KnowledgeBaseLoader loader;
+	HazeProlog prolog;
+
+	explicit TestBase(const char *source)
+	{
+		strncpy(text, source, sizeof(text) - 1);
+		text[sizeof(text) - 1] = 0;
+
+		loader.SetStorage(facts, 64, rules, 32);
+		if (!loader.Load(text))
+			printf("line %d: %s\n", loader.GetErrorLine(), loader.GetError());
+
+		prolog.SetRuleFactDefinitions(loader.GetFirstRule(), loader.GetFirstFact());
+	}
+
+private:
+	TestBase(const TestBase&);
+	TestBase& operator=(const TestBase&);
+};
+
+class TestTable : public AnswerTable
+{
+public:
+	AnswerTableEntry entryStorage[128];
+	TableAnswer answerStorage[512];
+	int bucketStorage[2 * 256];
+
+	TestTable()
+	{
+		this->SetStorage(entryStorage, 128, answerStorage, 512, bucketStorage, 256);
+	}
+};
+
+class TestCache : public QueryCache
+{
+public:
+	QueryCacheEntry entryStorage[8];
+	Fact resultStorage[16];
+	int bucketStorage[16];
+	char nameStorage[256];
+
+	// maxResults <= 16
+	explicit TestCache(int maxResults)
+	{
+		this->SetStorage(entryStorage, 8, resultStorage, maxResults, bucketStorage, 16, nameStorage, sizeof(nameStorage));
+	}
+};
+
+// evaluator and store of the derived facts
+class TestDatalog
+{
+public:
+	DynamicFactEntry entryStorage[128];
+	int bucketStorage[6 * 32];
+	Fact delta[128];
+	Fact nextDelta[128];
+	Fact removed[128];
+	DynamicFactStore store;
+	DatalogEvaluator evaluator;
+
+	TestDatalog()
+	{
+		store.SetStorage(entryStorage, 128, bucketStorage, 32);
+		evaluator.SetStorage(delta, nextDelta, 128);
+		evaluator.SetRemovalStorage(removed, 128);
+	}
+
+private:
+	TestDatalog(const TestDatalog&);
+	TestDatalog& operator=(const TestDatalog&);
+};
+
+static bool CollectFactVisitor(const Fact *fact, void *userData)
+{
+	std::set<std::string> *facts = (std::set<std::string>*)userData;
+	facts->insert(std::string(fact->term1Name) + "," + fact->term2Name);
+	return true;
+}
+
+// sorted terms of the stored facts of a 2 term predicate. ("a,b b,b")
+static std::string DumpFacts(const DynamicFactStore *store, const char *predicateName)
+{
+	Fact pattern{ 2, predicateName, true, "X", true, "Y", 0 };
+	std::set<std::string> facts;
+	store->VisitPatternFacts(&pattern, CollectFactVisitor, &facts);
+
+	std::string output;
+	for (std::set<std::string>::const_iterator i = facts.begin(); i != facts.end(); ++i)
+		output += (output.empty() ? "" : " ") + *i;
+
+	return output;
+}
+
+// query text is copied, so names of the parsed query point into it
+struct TestQuery
+{
+	char text[128];
+	Fact query;
+	std::string output;
+	HazeProlog *prolog; // for queries of visitors
+	const char *innerText;
+};
+
+static bool ParseQuery(TestQuery *query, const char *text)
+{
+	KnowledgeBaseLoader loader;
+	strncpy(query->text, text, sizeof(query->text) - 1);
+	query->text[sizeof(query->text) - 1] = 0;
+	query->output.clear();
+
+	return loader.ParseQuery(query->text, &query->query);
+}
+
+// values of query variables of each solution. (same format as SolveResults)
+static bool CollectVisitor(const Fact *solution, void *userData)
+{
+	TestQuery *query = (TestQuery*)userData;
+	AppendResult(&query->output, &query->query, solution);
+	return true;
+}
+
+// results of a query parsed from text. ("a,b c,d")
+// parsed queries are kept until the test ends, since answer tables keep the names of their goals
+static std::string Solve(HazeProlog *prolog, const char *text)
+{
+	static std::list<TestQuery> queries;
+	queries.push_back(TestQuery());
+
+	TestQuery *query = &queries.back();
+	if (!ParseQuery(query, text))
+		return "invalid query";
+
+	prolog->VisitSolutions(&query->query, CollectVisitor, query);
+	return query->output;
+}
+
+static bool WriteFile(const char *fileName, const char *data, size_t size)
+{
+	FILE *file = fopen(fileName, "wb");
+	if (!file)
+		return false;
+
+	bool written = (fwrite(data, 1, size, file) == size);
+	fclose(file);
+
+	return written;
+}
+
+// names of a temporary query are replaced with canonical names without being added to the table
+static void TestInternQuery()
+{
+	const char *names[16];
+	symbolid slots[16];
+	SymbolTable symbols;
+	symbols.SetStorage(names, slots, 16);
+
+	Fact fact{ 2, "p", false, "a", false, "b", 0 };
+	CHECK(symbols.InternFact(&fact));
+	symbolid symbolCount = symbols.GetSymbolCount();
+
+	char text[] = "p a X X";
+	text[1] = text[3] = text[5] = 0;
+
+	Fact query{ 2, text, false, text + 2, true, text + 4, 0 };
+	CHECK(!symbols.InternQuery(&query)); // X is not in the table
+	CHECK(query.predicateName == fact.predicateName);
+	CHECK(query.term1Name == fact.term1Name);
+
+	Fact sameVariable{ 2, text, true, text + 4, true, text + 6, 0 };
+	CHECK(!symbols.InternQuery(&sameVariable));
+	CHECK(sameVariable.predicateName == fact.predicateName);
+	CHECK(sameVariable.term1Name == sameVariable.term2Name);
+	CHECK(symbols.GetSymbolCount() == symbolCount);
+}
+
+// term2 of one-term facts is not interned, so it can be null
+static void TestInternOneTermFacts()
+{
+	const char *names[16];
+	symbolid slots[16];
+	SymbolTable symbols;
+	symbols.SetStorage(names, slots, 16);
+
+	Fact facts[2] = { { 1, "man", false, "socrates", false, 0, 0 }, { 2, "p", false, "a", false, "b", 0 } };
+	facts[0].nextFact = &facts[1];
+
+	Fact output[2];
+	int factCount = 0;
+	CHECK(symbols.InternFacts(facts, output, 2, &factCount));
+	CHECK(factCount == 2);
+	CHECK(output[0].term2Name == 0);
+	CHECK(output[0].term1Name == names[symbols.Find("socrates")]);
+	CHECK(output[1].term2Name == names[symbols.Find("b")]);
+	CHECK(symbols.GetSymbolCount() == 5);
+}
+
+// indexed fact lookups give the facts of the linear scan in the same order. (2 buckets, so keys share chains)
+static void TestFactIndexOrder()
+{
+	Fact facts[] = { MakeFact("p", "a", "b"), MakeFact("q", "a", "b"), MakeFact("p", "b", "a"), MakeFact("p", "a", "c"),
+		MakeFact("r", "a", 0), MakeFact("p", "c", "c"), MakeFact("q", "b", "b"), MakeFact("r", "b", 0), MakeFact("p", "a", "b"),
+		MakeFact("s", "a", "a") };
+	const int factCount = (int)(sizeof(facts) / sizeof(facts[0]));
+	LinkFacts(facts, factCount);
+
+	Fact goal2 = MakeFact("q", "Z", "Y");
+	Rule rule = MakeRule(MakeFact("t", "X", "Y"), MakeFact("p", "X", "Z"), &goal2); // t(X, Y) :- p(X, Z), q(Z, Y).
+
+	HazeProlog linear;
+	linear.SetRuleFactDefinitions(&rule, facts);
+
+	FactIndexEntry entries[16];
+	int buckets[3 * 2];
+	FactIndex index;
+	index.SetStorage(entries, 16, buckets, 2);
+
+	HazeProlog indexed;
+	CHECK(indexed.SetRuleFactDefinitions(&rule, facts, &index));
+
+	Fact queries[] = { MakeFact("p", "a", "Y"), MakeFact("p", "X", "c"), MakeFact("p", "X", "Y"), MakeFact("q", "X", "b"),
+		MakeFact("r", "X", 0), MakeFact("r", "b", 0), MakeFact("p", "c", "c"), MakeFact("p", "c", "a"), MakeFact("s", "X", "a"),
+		MakeFact("s", "X", "X"), MakeFact("p", "X", "X"), MakeFact("t", "X", "Y"), MakeFact("t", "a", "Y"), MakeFact("u", "X", "Y") };
+
+	for (int i = 0; i < (int)(sizeof(queries) / sizeof(queries[0])); ++i)
+		CHECK_RESULTS(SolveResults(&indexed, &queries[i]), SolveResults(&linear, &queries[i]).c_str());
+
+	CHECK_RESULTS(SolveResults(&indexed, &queries[0]), "b c b");
+	CHECK_RESULTS(SolveResults(&indexed, &queries[10]), "c,c");
+
+	index.SetStorage(entries, factCount - 1, buckets, 2);
+	CHECK(!index.Build(facts));
+}
+
+// indexed rule lookups give the rules of the linear scan in the same order. (1 bucket, so predicates share the chain)
+static void TestRuleIndexOrder()
+{
+	Fact facts[] = { MakeFact("f", "a", "b"), MakeFact("g", "a", 0), MakeFact("h", "c", "a") };
+	LinkFacts(facts, 3);
+
+	Rule rules[] = {
+		MakeRule(MakeFact("r", "X", "Y"), MakeFact("f", "X", "Y"), 0),
+		MakeRule(MakeFact("r", "a", "Y"), MakeFact("h", "Y", "Q"), 0),
+		MakeRule(MakeFact("s", "X", 0), MakeFact("g", "X", 0), 0),
+		MakeRule(MakeFact("r", "X", "c"), MakeFact("g", "X", 0), 0),
+		MakeRule(MakeFact("r", "c", "a"), MakeFact("g", "a", 0), 0),
+		MakeRule(MakeFact("s", "b", 0), MakeFact("g", "a", 0), 0) };
+	const int ruleCount = (int)(sizeof(rules) / sizeof(rules[0]));
+	LinkRules(rules, ruleCount);
+
+	HazeProlog linear;
+	linear.SetRuleFactDefinitions(rules, facts);
+
+	RuleIndexEntry entries[8];
+	int buckets[1];
+	RuleIndex index;
+	index.SetStorage(entries, 8, buckets, 1);
+
+	HazeProlog indexed;
+	CHECK(indexed.SetRuleFactDefinitions(rules, facts, 0, &index));
+
+	Fact queries[] = { MakeFact("r", "X", "Y"), MakeFact("r", "a", "Y"), MakeFact("r", "b", "Y"), MakeFact("r", "c", "Y"),
+		MakeFact("r", "X", "c"), MakeFact("r", "X", "a"), MakeFact("r", "c", "a"), MakeFact("r", "a", "a"), MakeFact("r", "X", "X"),
+		MakeFact("s", "X", 0), MakeFact("s", "b", 0), MakeFact("s", "d", 0), MakeFact("f", "X", "Y"), MakeFact("q", "X", "Y") };
+
+	for (int i = 0; i < (int)(sizeof(queries) / sizeof(queries[0])); ++i)
+		CHECK_RESULTS(SolveResults(&indexed, &queries[i]), SolveResults(&linear, &queries[i]).c_str());
+
+	CHECK_RESULTS(SolveResults(&indexed, &queries[6]), "true");
+	CHECK_RESULTS(SolveResults(&indexed, &queries[7]), "");
+
+	index.SetStorage(entries, ruleCount - 1, buckets, 1);
+	CHECK(!index.Build(rules));
+}
+
+// callers of the embedded API keep their int8 counters
+static void TestInt8ResultCount()
+{
+	Fact facts[] = { MakeFact("p", "a", "b"), MakeFact("p", "c", "b"), MakeFact("p", "d", "e") };
+	HazeProlog prolog;
+	prolog.SetRuleFactDefinitions(0, LinkFacts(facts, 3));
+
+	Fact query = MakeFact("p", "X", "b");
+	Fact results[MAX_MATCHING_FACTS];
+	int8 resultCount = 0;
+	CHECK(prolog.SolveQuery(&query, &resultCount, results));
+	CHECK(resultCount == 2);
+	CHECK(strcmp(results[0].term1Name, "a") == 0);
+	CHECK(strcmp(results[1].term1Name, "c") == 0);
+}
+
+// results grow in the arena of the vector and stay after the query
+static void TestResultVectorArena()
+{
+	static char names[40][4];
+	Fact facts[40];
+	for (int i = 0; i < 40; ++i)
+	{
+		sprintf(names[i], "n%d", i);
+		facts[i] = MakeFact("p", names[i], "b");
+	}
+
+	HazeProlog prolog;
+	prolog.SetRuleFactDefinitions(0, LinkFacts(facts, 40));
+
+	char buffer[256];
+	QueryArena arena(buffer, sizeof(buffer));
+
+	ResultVector results;
+	results.SetQueryArena(&arena);
+
+	Fact query = MakeFact("p", "X", "b");
+	CHECK(prolog.SolveQuery(&query, &results) == SOLVE_OK);
+	CHECK(results.GetCount() == 40);
+	CHECK(arena.GetPeakUsage() >= sizeof(Fact) * 40);
+
+	for (int i = 0; i < results.GetCount(); ++i)
+		CHECK(strcmp(results.GetResult(i)->term1Name, names[i]) == 0);
+}
+
+static bool NestedArenaVisitor(const Fact *solution, void *userData)
+{
+	VisitedQuery *visited = (VisitedQuery*)userData;
+	AppendVisitor(solution, userData);
+
+	VisitResults(visited->prolog, visited->innerQuery);
+	return true;
+}
+
+// a query of a visitor keeps the arena frames of the outer query
+static void TestNestedQueryArena()
+{
+	Fact facts[] = { MakeFact("p", "a", "1"), MakeFact("p", "d", "1"), MakeFact("p", "a", "2"), MakeFact("p", "a", "3"),
+		MakeFact("p", "d", "3"), MakeFact("m", "1", "x"), MakeFact("m", "2", "y"), MakeFact("m", "3", "z"), MakeFact("n", "x", "1"),
+		MakeFact("n", "y", "2") };
+	LinkFacts(facts, (int)(sizeof(facts) / sizeof(facts[0])));
+
+	Fact goals[] = { MakeFact("k", "Z", "Y"), MakeFact("m", "C", "B") };
+	Rule rules[] = {
+		MakeRule(MakeFact("k", "Z", "Y"), MakeFact("m", "Z", "Y"), 0),
+		MakeRule(MakeFact("g", "X", "Y"), MakeFact("p", "X", "Z"), &goals[0]),
+		MakeRule(MakeFact("h", "A", "B"), MakeFact("n", "A", "C"), &goals[1]) };
+	LinkRules(rules, 3);
+
+	HazeProlog prolog;
+	prolog.SetRuleFactDefinitions(rules, facts);
+
+	void *buffer[1024];
+	QueryArena arena(buffer, sizeof(buffer));
+	prolog.SetQueryArena(&arena);
+
+	Fact query = MakeFact("g", "X", "Y");
+	Fact innerQuery = MakeFact("h", "A", "B");
+	std::string expected = VisitResults(&prolog, &query);
+	CHECK_RESULTS(expected, "a,x d,x a,y a,z d,z");
+
+	VisitedQuery visited;
+	visited.query = &query;
+	visited.prolog = &prolog;
+	visited.innerQuery = &innerQuery;
+
+	prolog.VisitSolutions(&query, NestedArenaVisitor, &visited);
+	CHECK_RESULTS(visited.output, expected.c_str());
+}
+
+// image is not opened if a symbol id or a chain link is out of its table
+static void TestDamagedImage()
+{
+	TestBase base("e(a, b). e(b, c). e(c, a).\n"
+		"t(X, Y) :- e(X, Y).\n");
+
+	const char *fileName = "regression.hkb";
+	CHECK(KnowledgeBaseImage::Compile(fileName, base.loader.GetFirstRule(), base.loader.GetFirstFact()));
+
+	FILE *file = fopen(fileName, "rb");
+	CHECK(file != 0);
+	if (!file)
+		return;
+
+	char image[4096];
+	size_t size = fread(image, 1, sizeof(image), file);
+	fclose(file);
+	CHECK(size < sizeof(image));
+
+	KnowledgeBaseImage opened;
+	CHECK(opened.Open(fileName));
+
+	HazeProlog prolog;
+	prolog.SetFactSource(&opened);
+	CHECK_RESULTS(Solve(&prolog, "e(a, Y)"), "b");
+	opened.Close();
+
+	KnowledgeBaseImageHeader header;
+	memcpy(&header, image, sizeof(header));
+
+	char damaged[4096];
+	uint32_t badSymbol = header.symbolCount + 1;
+	int32_t selfLink = 0;
+	int32_t badLink = (int32_t)header.factCount;
+
+	size_t offsets[] = {
+		header.facts + offsetof(KnowledgeBaseImageFact, term1), // fact symbol
+		header.factNext, // link of first fact to itself
+		header.factBuckets, // chain head
+		header.symbolSlots, // symbol slot
+		header.rules + offsetof(KnowledgeBaseImageRule, fact1) + offsetof(KnowledgeBaseImageFact, predicate) // rule symbol
+	};
+	const void *values[] = { &badSymbol, &selfLink, &badLink, &badSymbol, &badSymbol };
+
+	for (int i = 0; i < 5; ++i)
+	{
+		memcpy(damaged, image, size);
+		memcpy(damaged + offsets[i], values[i], 4);
+
+		KnowledgeBaseImage damagedImage;
+		CHECK(WriteFile(fileName, damaged, size));
+		CHECK(!damagedImage.Open(fileName));
+	}
+
+	remove(fileName);
+}
+
+#ifdef ENABLE_ROM_TABLES
+constexpr RomFactDefinition romDefinitions[] = {
+	{ 2, "likes", "john", "wine" },
+	{ 2, "likes", "ann", "wine" },
+	{ 2, "likes", "zed", "beer" },
+	{ 2, "likes", "bob", "bob" },
+	{ 1, "fruit", "pear", "" },
+	{ 2, "likes", "ann", "ann" },
+	{ 1, "fruit", "apple", "" },
+	{ 2, "likes", "ann", "beer" }
+};
+
+ROM_FACT_TABLE(romTable, romDefinitions);
+
+// binary search lookups give results sorted by the bound term, then by the other term
+static void TestRomFactTable()
+{
+	RomFactSource factSource(&romTable);
+
+	HazeProlog prolog;
+	prolog.SetFactSource(&factSource);
+
+	CHECK_RESULTS(Solve(&prolog, "likes(ann, Y)"), "ann beer wine");
+	CHECK_RESULTS(Solve(&prolog, "likes(X, wine)"), "ann john");
+	CHECK_RESULTS(Solve(&prolog, "likes(X, beer)"), "ann zed");
+	CHECK_RESULTS(Solve(&prolog, "likes(X, Y)"), "ann,beer ann,wine john,wine zed,beer"); // same terms only match pred(X, X)
+	CHECK_RESULTS(Solve(&prolog, "likes(X, X)"), "ann,ann bob,bob");
+	CHECK_RESULTS(Solve(&prolog, "likes(ann, wine)"), "true");
+	CHECK_RESULTS(Solve(&prolog, "likes(wine, ann)"), "");
+	CHECK_RESULTS(Solve(&prolog, "likes(kim, Y)"), "");
+	CHECK_RESULTS(Solve(&prolog, "fruit(X)"), "apple pear");
+	CHECK_RESULTS(Solve(&prolog, "fruit(pear)"), "true");
+}
+#endif
+
+// fact2 of a joined AND rule is not materialized if its predicate has rules, even if no rule matches the unbound goal
+static void TestHashJoinWithConstantHeadRule()
+{
+	TestBase base("p(a, b). s(b, c). u(a).\n"
+		"r(X, Y) :- p(X, Z), s(Z, Y).\n"
+		"s(b, b) :- u(Q).\n");
+
+	CHECK_RESULTS(Solve(&base.prolog, "r(a, Y)"), "a");
+}
+
+// AND rules give the head values of both goals in either goal order
+static void TestAndRuleShapes()
+{
+	TestBase base("f(ann). f(eve). l(ann, wine). l(tom, beer). l(eve, tea).\n"
+		"a(X) :- f(X), l(X, wine).\n"
+		"b(X, Y) :- l(X, Y), f(X).\n"
+		"c(X, Y) :- l(Z, Y), l(X, Z).\n");
+
+	CHECK_RESULTS(Solve(&base.prolog, "a(ann)"), "true");
+	CHECK_RESULTS(Solve(&base.prolog, "a(X)"), "ann");
+	CHECK_RESULTS(Solve(&base.prolog, "b(ann, Y)"), "wine");
+	CHECK_RESULTS(Solve(&base.prolog, "b(X, tea)"), "eve");
+	CHECK_RESULTS(Solve(&base.prolog, "b(X, Y)"), "ann,wine eve,tea");
+	CHECK_RESULTS(Solve(&base.prolog, "c(X, Y)"), "");
+}
+
+// the two variable goal is solved first if it has less matches. (results come in its order)
+static void TestPlanOneVariableWithTwoVariableGoal()
+{
+	TestBase base("n(a). n(b). n(c). n(d). n(e). n(f). e(f, x). e(b, y).\n"
+		"r(X, Y) :- n(X), e(X, Y).\n");
+
+	CHECK_RESULTS(Solve(&base.prolog, "r(X, Y)"), "b,y f,x");
+
+	PredicateStats entries[8];
+	unsigned int scratch[64];
+	PredicateStatistics statistics;
+	statistics.SetStorage(entries, 8);
+	CHECK(statistics.Build(base.loader.GetFirstFact(), scratch, 64));
+	base.prolog.SetPredicateStatistics(&statistics);
+
+	CHECK_RESULTS(Solve(&base.prolog, "r(X, Y)"), "f,x b,y");
+	CHECK_RESULTS(Solve(&base.prolog, "r(b, Y)"), "y");
+}
+
+// goals of predicates with rules or with equal term facts keep their order
+static void TestPlanKeepsGoalOrder()
+{
+	TestBase base("n(a). n(b). n(c). n(d). e(d, x). e(b, y). e(c, c). m(d, x). m(b, y). k(c, z).\n"
+		"r(X, Y) :- n(X), e(X, Y).\n"
+		"s(X, Y) :- n(X), m(X, Y).\n"
+		"m(X, Y) :- k(X, Y).\n");
+
+	PredicateStats entries[8];
+	unsigned int scratch[64];
+	PredicateStatistics statistics;
+	statistics.SetStorage(entries, 8);
+	CHECK(statistics.Build(base.loader.GetFirstFact(), scratch, 64));
+	base.prolog.SetPredicateStatistics(&statistics);
+
+	CHECK_RESULTS(Solve(&base.prolog, "r(X, Y)"), "b,y c,c d,x");
+	CHECK_RESULTS(Solve(&base.prolog, "s(X, Y)"), "b,y c,z d,x");
+}
+
+// ground query of a cycle terminates when the goals are tabled
+static void TestTabledCycle()
+{
+	TestBase base("e(a, b). e(b, c). e(c, a).\n"
+		"t(X, Y) :- e(X, Y).\n"
+		"t(X, Y) :- t(X, Z), t(Z, Y).\n");
+
+	TestTable table;
+	base.prolog.SetAnswerTable(&table);
+
+	CHECK_RESULTS(Solve(&base.prolog, "t(a, b)"), "true");
+	CHECK_RESULTS(Solve(&base.prolog, "t(a, a)"), "true");
+	CHECK_RESULTS(Solve(&base.prolog, "t(a, Y)"), "b c a");
+}
+
+// answers are unique by the values of the goal variables
+static void TestTabledAnswersAreUnique()
+{
+	TestBase base("e(a, d). e(b, a). e(a, b).\n"
+		"t(X, Y) :- e(X, Y).\n"
+		"t(X, Y) :- e(X, Z), t(Z, Y).\n");
+
+	std::string expected = Solve(&base.prolog, "t(a, Y)");
+
+	TestTable table;
+	base.prolog.SetAnswerTable(&table);
+
+	CHECK_RESULTS(Solve(&base.prolog, "t(X, d)"), "a b");
+	CHECK_RESULTS(Solve(&base.prolog, "t(a, d)"), "true");
+	CHECK_RESULTS(Solve(&base.prolog, "t(a, Y)"), expected.c_str());
+}
+
+static bool NestedTableVisitor(const Fact *solution, void *userData)
+{
+	TestQuery *query = (TestQuery*)userData;
+	CollectVisitor(solution, userData);
+
+	query->output += "[" + Solve(query->prolog, query->innerText) + "]";
+	return true;
+}
+
+// a query of a visitor does not clear the table of the outer query
+static void TestNestedTabledQuery()
+{
+	TestBase base("e(a, b). e(b, c). e(c, d).\n"
+		"t(X, Y) :- e(X, Y).\n"
+		"t(X, Y) :- e(X, Z), t(Z, Y).\n");
+
+	TestTable table;
+	base.prolog.SetAnswerTable(&table);
+
+	TestQuery query;
+	ParseQuery(&query, "t(a, Y)");
+	query.prolog = &base.prolog;
+	query.innerText = "t(c, Y)";
+
+	base.prolog.VisitSolutions(&query.query, NestedTableVisitor, &query);
+	CHECK_RESULTS(query.output, "b[d] c[d] d[d]");
+	CHECK_RESULTS(Solve(&base.prolog, "t(b, Y)"), "c d");
+}
+
+// a table without storage has nothing to clear. (benchmark clears its table before SetStorage)
+// table is constructed in dirty memory, so fields which the constructor does not set are not zero.
+static void TestTableWithoutStorage()
+{
+	void *memory[(sizeof(AnswerTable) + sizeof(void*) - 1) / sizeof(void*)];
+	memset(memory, 0x5a, sizeof(memory));
+
+	AnswerTable &table = *new (memory) AnswerTable();
+	table.Clear();
+	table.BeginQuery();
+	table.EndQuery();
+
+	AnswerTableEntry entries[4];
+	TableAnswer answers[4];
+	int buckets[2 * 4];
+	table.SetStorage(entries, 4, answers, 4, buckets, 4);
+
+	Fact goal = MakeFact("t", "a", "Y");
+	CHECK(table.FindGoal(&goal) == 0);
+	table.Clear();
+	CHECK(table.FindGoal(&goal) == 0); // entries are reused after Clear
+
+	table.~AnswerTable();
+}
+
+static bool NestedQueryVisitor(const Fact *solution, void *userData)
+{
+	TestQuery *query = (TestQuery*)userData;
+	CollectVisitor(solution, userData);
+
+	Solve(query->prolog, query->innerText);
+	return true;
+}
+
+// a query of a visitor does not reset the results which the cache collects for the outer query
+static void TestNestedCachedQuery()
+{
+	TestBase base("p(a, b). p(a, c). q(x, y). q(z, w).\n");
+
+	TestCache cache(16);
+	base.prolog.SetQueryCache(&cache);
+
+	TestQuery query;
+	ParseQuery(&query, "p(a, Y)");
+	query.prolog = &base.prolog;
+	query.innerText = "q(X, Y)";
+
+	base.prolog.VisitSolutions(&query.query, NestedQueryVisitor, &query);
+	CHECK_RESULTS(query.output, "b c");
+	CHECK_RESULTS(Solve(&base.prolog, "p(a, Y)"), "b c");
+	CHECK_RESULTS(Solve(&base.prolog, "q(X, Y)"), "x,y z,w");
+}
+
+// a query of a visitor does not evict the results which are being replayed
+static void TestNestedQueryOfReplay()
+{
+	TestBase base("p(a, b). p(a, c). p(a, d). q(x, y). q(z, w). q(u, v).\n");
+
+	TestCache cache(4);
+	base.prolog.SetQueryCache(&cache);
+
+	CHECK_RESULTS(Solve(&base.prolog, "p(a, Y)"), "b c d");
+
+	TestQuery query;
+	ParseQuery(&query, "p(a, Y)");
+	query.prolog = &base.prolog;
+	query.innerText = "q(X, Y)";
+
+	base.prolog.VisitSolutions(&query.query, NestedQueryVisitor, &query);
+	CHECK_RESULTS(query.output, "b c d");
+	CHECK_RESULTS(Solve(&base.prolog, "p(a, Y)"), "b c d");
+}
+
+// term2 of a one-term query is not copied into the cache, so it can be null
+static void TestCachedOneTermQuery()
+{
+	TestBase base("man(socrates). man(plato).\n");
+
+	TestCache cache(16);
+	base.prolog.SetQueryCache(&cache);
+
+	Fact query{ 1, "man", true, "X", false, 0, 0 };
+	CHECK_RESULTS(VisitResults(&base.prolog, &query), "socrates plato");
+	CHECK_RESULTS(VisitResults(&base.prolog, &query), "socrates plato");
+	CHECK(cache.GetHitCount() == 1);
+}
+
+// results in the format of CollectVisitor
+static std::string DumpResults(TestQuery *query, const ResultVector *results)
+{
+	query->output.clear();
+
+	for (int i = 0; i < results->GetCount(); ++i)
+		CollectVisitor(results->GetResult(i), query);
+
+	return query->output;
+}
+
+// results and statuses of a batch are the results of sequential queries. (rule queries at the end keep the last thread busy)
+static void TestBatchQueries()
+{
+	TestBase base("e(n0, n1). e(n1, n2). e(n2, n3). e(n3, n4). e(n4, n5). e(n5, n6). e(n6, n7). e(n7, n8).\n"
+		"e(n8, n9). e(n9, n10). e(n10, n11). e(n11, n12). e(n12, n13). e(n13, n14). e(n14, n15).\n"
+		"t(X, Y) :- e(X, Y).\n"
+		"t(X, Y) :- e(X, Z), t(Z, Y).\n");
+
+	enum { QUERY_COUNT = 64 };
+	static TestQuery queries[QUERY_COUNT];
+	Fact batch[QUERY_COUNT];
+
+	for (int i = 0; i < QUERY_COUNT; ++i)
+	{
+		char text[32];
+		if (i < 48)
+			sprintf(text, (i % 3) ? "e(n%d, Y)" : "e(X, n%d)", i % 17);
+		else
+			sprintf(text, (i % 2) ? "t(n%d, Y)" : "t(n%d, n15)", i % 16);
+
+		CHECK(ParseQuery(&queries[i], text));
+		batch[i] = queries[i].query;
+	}
+
+	ResultVector expected[QUERY_COUNT];
+	SolveStatus expectedStatuses[QUERY_COUNT];
+	for (int i = 0; i < QUERY_COUNT; ++i)
+		expectedStatuses[i] = base.prolog.SolveQuery(&batch[i], &expected[i]);
+
+	CHECK(expectedStatuses[0] == SOLVE_NO_RESULTS);
+	CHECK_RESULTS(DumpResults(&queries[1], &expected[1]), "n2");
+
+	// without Start
+	{
+		BatchQuerySolver solver;
+		ResultVector results[QUERY_COUNT];
+		SolveStatus statuses[QUERY_COUNT];
+		solver.Solve(&base.prolog, batch, QUERY_COUNT, results, statuses);
+		CHECK(solver.GetThreadCount() == 1);
+
+		for (int i = 0; i < QUERY_COUNT; ++i)
+		{
+			CHECK(statuses[i] == expectedStatuses[i]);
+			CHECK_RESULTS(DumpResults(&queries[i], &results[i]), DumpResults(&queries[i], &expected[i]).c_str());
+		}
+	}
+
+	BatchQuerySolver solver;
+	CHECK(solver.Start(4, QUERY_ARENA_SIZE));
+
+	for (int batchNumber = 0; (batchNumber < 100) && ((batchNumber < 2) || (solver.GetStealCount() == 0)); ++batchNumber)
+	{
+		ResultVector results[QUERY_COUNT];
+		SolveStatus statuses[QUERY_COUNT];
+		solver.Solve(&base.prolog, batch, QUERY_COUNT, results, statuses);
+
+		for (int i = 0; i < QUERY_COUNT; ++i)
+		{
+			CHECK(statuses[i] == expectedStatuses[i]);
+			CHECK_RESULTS(DumpResults(&queries[i], &results[i]), DumpResults(&queries[i], &expected[i]).c_str());
+		}
+	}
+
+	CHECK(solver.GetStealCount() > 0);
+}
+
+// visitor which stops after a number of solutions
+struct StopVisitorState
+{
+	int callCount;
+	int stopAt;
+};
+
+static bool StopVisitor(const Fact *solution, void *userData)
+{
+	(void)solution;
+	StopVisitorState *state = (StopVisitorState*)userData;
+	return (++state->callCount) < state->stopAt;
+}
+
+// parallel rules give results in the order of a sequential search, and stop when the visitor returns false
+static void TestParallelRuleOrder()
+{
+	TestBase base("b(b1). b(b2). b(b3). c(c1). c(c2). d(d1, b2). d(d2, c1).\n"
+		"r(X) :- a(X).\n"
+		"r(X) :- b(X).\n"
+		"r(X) :- c(X) ; b(X).\n"
+		"r(X) :- d(X, Y), c(Y).\n"
+		"r(X) :- c(X).\n");
+
+	const char *queries[] = { "r(X)", "r(b2)", "r(c1)", "r(d2)", "r(e1)" };
+	std::string expected[5];
+	for (int i = 0; i < 5; ++i)
+		expected[i] = Solve(&base.prolog, queries[i]);
+
+	CHECK_RESULTS(expected[0], "b1 b2 b3 c1 c2 b1 b2 b3 d2 c1 c2");
+
+	QueryTaskPool pool;
+	CHECK(pool.Start(3, QUERY_ARENA_SIZE));
+	base.prolog.SetParallelRules(&pool, 0);
+
+	for (int run = 0; run < 50; ++run)
+	{
+		for (int i = 0; i < 5; ++i)
+			CHECK_RESULTS(Solve(&base.prolog, queries[i]), expected[i].c_str());
+
+		for (int stopAt = 1; stopAt <= 11; ++stopAt)
+		{
+			StopVisitorState state = { 0, stopAt };
+			Fact query{ 1, "r", true, "X", false, "", 0 };
+			base.prolog.VisitSolutions(&query, StopVisitor, &state);
+			CHECK(state.callCount == stopAt);
+		}
+	}
+
+	CHECK(pool.GetStartCount() > 0);
+}
+
+// visitor which retracts the visited fact and the next fact
+struct RetractVisitorState
+{
+	DynamicFactStore *store;
+	const char *retractAt; // term2 of the fact
+	const char *nextTerm2;
+	std::string output;
+};
+
+static bool RetractVisitor(const Fact *fact, void *userData)
+{
+	RetractVisitorState *state = (RetractVisitorState*)userData;
+	state->output += (state->output.empty() ? "" : " ") + std::string(fact->term2Name);
+
+	if (strcmp(fact->term2Name, state->retractAt) == 0)
+	{
+		Fact current{ 2, "p", true, "X", false, state->retractAt, 0 };
+		Fact next{ 2, "p", true, "X", false, state->nextTerm2, 0 };
+		CHECK(state->store->Retract(&current));
+		CHECK(state->store->Retract(&next));
+	}
+
+	return true;
+}
+
+// searches continue after facts which are retracted by their visitor. entries are reused after ReclaimFacts.
+static void TestDynamicFactStore()
+{
+	static const char *terms[] = { "1", "2", "3", "4", "5" };
+	const char *queries[] = { "p(a, Y)", "p(X, Y)" }; // term1 and predicate chains
+
+	for (int i = 0; i < 2; ++i)
+	{
+		DynamicFactEntry entries[8];
+		int buckets[6 * 4];
+		DynamicFactStore store;
+		store.SetStorage(entries, 8, buckets, 4);
+
+		for (int j = 0; j < 5; ++j)
+		{
+			Fact fact{ 2, "p", false, "a", false, terms[j], 0 };
+			CHECK(store.Assert(&fact));
+		}
+
+		TestQuery query;
+		CHECK(ParseQuery(&query, queries[i]));
+
+		RetractVisitorState state{ &store, "2", "3", "" };
+		CHECK(store.VisitMatchingFacts(&query.query, RetractVisitor, &state));
+		CHECK_RESULTS(state.output, "1 2 4 5");
+		CHECK(store.GetFactCount() == 3);
+
+		// store is full until retracted entries are reclaimed
+		for (int j = 0; j < 3; ++j)
+		{
+			Fact fact{ 2, "q", false, "b", false, terms[j], 0 };
+			CHECK(store.Assert(&fact));
+		}
+
+		Fact extra{ 2, "q", false, "b", false, "9", 0 };
+		CHECK(!store.Assert(&extra));
+
+		store.ReclaimFacts();
+		CHECK(store.Assert(&extra));
+		CHECK(store.Assert(&extra));
+		CHECK(!store.Assert(&extra));
+		CHECK(store.GetFactCount() == 8);
+	}
+
+	// cached results are dropped when the store changes
+	DynamicFactEntry entries[8];
+	int buckets[6 * 4];
+	DynamicFactStore store;
+	store.SetStorage(entries, 8, buckets, 4);
+
+	for (int j = 0; j < 2; ++j)
+	{
+		Fact fact{ 2, "p", false, "a", false, terms[j], 0 };
+		CHECK(store.Assert(&fact));
+	}
+
+	HazeProlog prolog;
+	prolog.SetFactSource(&store);
+
+	TestCache cache(16);
+	prolog.SetQueryCache(&cache);
+
+	CHECK_RESULTS(Solve(&prolog, "p(a, Y)"), "1 2");
+	CHECK_RESULTS(Solve(&prolog, "p(a, Y)"), "1 2");
+	CHECK(cache.GetHitCount() == 1);
+
+	Fact asserted{ 2, "p", false, "a", false, terms[2], 0 };
+	CHECK(store.Assert(&asserted));
+	CHECK_RESULTS(Solve(&prolog, "p(a, Y)"), "1 2 3");
+	CHECK(cache.GetHitCount() == 1);
+
+	Fact retracted{ 2, "p", false, "a", false, terms[0], 0 };
+	CHECK(store.Retract(&retracted));
+	CHECK_RESULTS(Solve(&prolog, "p(a, Y)"), "2 3");
+	CHECK_RESULTS(Solve(&prolog, "p(a, Y)"), "2 3");
+	CHECK(cache.GetHitCount() == 2);
+}
+
+// facts of p(a..c, a..e) and q(a..g) in an interleaved chain. (rows of p are not contiguous in the chain)
+static Fact* BuildMixedFacts(Fact *facts, int count)
+{
+	static const char *names[] = { "a", "b", "c", "d", "e", "f", "g" };
+	Fact *first = 0;
+
+	for (int i = count - 1; i >= 0; --i)
+	{
+		if ((i % 3) == 2)
+			facts[i] = Fact{ 1, "q", false, names[i % 7], false, "", first };
+		else
+			facts[i] = Fact{ 2, "p", false, names[i % 3], false, names[(i * 7) % 5], first };
+
+		first = &facts[i];
+	}
+
+	return first;
+}
+
+// columnar scans give the facts of the fact chain in its order. (2 blocks of rows, last block is partial)
+static void TestColumnarFactStore()
+{
+	Fact facts[90]; // 60 rows of p, 30 rows of q
+	Fact *firstFact = BuildMixedFacts(facts, 90);
+
+	HazeProlog linear;
+	linear.SetRuleFactDefinitions(0, firstFact);
+
+	const char *names[32];
+	symbolid slots[32];
+	SymbolTable symbols;
+	symbols.SetStorage(names, slots, 32);
+
+	FactColumnTable tables[2];
+	symbolid term1Ids[90];
+	symbolid term2Ids[90];
+	ColumnarFactStore store;
+	store.SetStorage(tables, 2, term1Ids, term2Ids, 90);
+	CHECK(store.Build(firstFact, &symbols));
+	CHECK(store.GetTableCount() == 2);
+	CHECK(store.FindTable("p", 2)->rowCount == 60);
+
+	HazeProlog columnar;
+	columnar.SetFactSource(&store);
+
+	const char *queries[] = { "p(X, Y)", "p(X, X)", "p(a, Y)", "p(X, c)", "p(b, e)", "p(b, Y)", "p(d, Y)", "p(X, z)",
+		"q(X)", "q(g)", "q(h)", "r(X)" };
+
+	for (int i = 0; i < (int)(sizeof(queries) / sizeof(queries[0])); ++i)
+		CHECK_RESULTS(Solve(&columnar, queries[i]), Solve(&linear, queries[i]).c_str());
+
+	CHECK_RESULTS(Solve(&columnar, "p(X, X)"), "a,a b,b a,a b,b a,a b,b a,a b,b a,a b,b a,a b,b");
+
+	// storage is too small
+	store.SetStorage(tables, 2, term1Ids, term2Ids, 89);
+	CHECK(!store.Build(firstFact, &symbols));
+
+	store.SetStorage(tables, 1, term1Ids, term2Ids, 90);
+	CHECK(!store.Build(firstFact, &symbols));
+}
+
+class TestColumnarStore : public ColumnarFactStore
+{
+public:
+	using ColumnarFactStore::ScanRowsScalar;
+};
+
+// SIMD scan kernel gives the masks of the scalar scan for each filter.
+// (build with and without -mavx2, and with -DNO_SIMD_SCAN)
+static void TestScanRowsKernel()
+{
+	symbolid column1[32 + 7];
+	symbolid column2[32 + 7];
+	unsigned int seed = 4321;
+
+	for (int block = 0; block < 200; ++block)
+	{
+		for (int i = 0; i < (32 + 7); ++i)
+		{
+			seed = seed * 1103515245u + 12345u;
+			column1[i] = 1 + ((seed >> 16) % 4);
+			seed = seed * 1103515245u + 12345u;
+			column2[i] = 1 + ((seed >> 16) % 4);
+		}
+
+		int offset = block % 8; // unaligned columns
+
+		for (int filterNumber = 0; filterNumber < (5 * 5 * 4); ++filterNumber)
+		{
+			ColumnScanFilter filter;
+			filter.term1 = (symbolid)(filterNumber % 5); // 0 is a variable
+			filter.term2 = (symbolid)((filterNumber / 5) % 5);
+			filter.bothVariables = ((filterNumber / 25) & 1) != 0;
+			filter.sameVariables = ((filterNumber / 50) & 1) != 0;
+
+			unsigned long expected = TestColumnarStore::ScanRowsScalar(column1 + offset, column2 + offset, 32, &filter);
+			CHECK(ColumnarFactStore::ScanRows(column1 + offset, column2 + offset, 32, &filter) == expected);
+		}
+	}
+}
+
+// goals of derived predicates are unified by their variables. (t(X, Y) also matches t(a, a))
+static void TestDatalogSelfLoops()
+{
+	TestBase base("e(a, b). e(b, a).\n"
+		"t(X, Y) :- e(X, Y).\n"
+		"t(X, Y) :- e(X, Z), t(Z, Y).\n");
+
+	TestDatalog datalog;
+	CHECK(datalog.evaluator.Evaluate(base.loader.GetFirstRule(), base.loader.GetFirstFact(), &datalog.store));
+	CHECK_RESULTS(DumpFacts(&datalog.store, "t"), "a,a a,b b,a b,b");
+}
+
+// facts of the edges which are set in the mask. (edge i is e(node i / 4 , node i % 4))
+static Fact* BuildEdges(Fact *edges, unsigned int mask)
+{
+	static const char *nodes[] = { "a", "b", "c", "d" };
+	Fact *first = 0;
+
+	for (int i = 15; i >= 0; --i)
+	{
+		if (mask & (1u << i))
+		{
+			Fact edge{ 2, "e", false, nodes[i / 4], false, nodes[i % 4], first };
+			edges[i] = edge;
+			first = &edges[i];
+		}
+	}
+
+	return first;
+}
+
+// facts after AddFact and RemoveFact are the facts of a new evaluation. (graphs with self loops)
+static void TestDatalogIncremental()
+{
+	TestBase base("t(X, Y) :- e(X, Y).\n"
+		"t(X, Y) :- e(X, Z), t(Z, Y).\n"
+		"s(X) :- t(X, X).\n");
+
+	const Rule *rules = base.loader.GetFirstRule();
+
+	// e(d, b). e(b, d). e(d, d). then e(b, d) is removed
+	{
+		Fact edges[16];
+		TestDatalog datalog;
+		Fact removedEdge{ 2, "e", false, "b", false, "d", 0 };
+
+		CHECK(datalog.evaluator.Evaluate(rules, BuildEdges(edges, (1u << 13) | (1u << 7) | (1u << 15)), &datalog.store));
+		CHECK(datalog.evaluator.RemoveFact(&removedEdge));
+		CHECK_RESULTS(DumpFacts(&datalog.store, "t"), "d,b d,d");
+	}
+
+	TestDatalog datalog;
+	Fact edges[16];
+	unsigned int mask = 0;
+	unsigned int seed = 12345;
+	CHECK(datalog.evaluator.Evaluate(rules, 0, &datalog.store));
+
+	for (int step = 0; step < 200; ++step)
+	{
+		seed = seed * 1103515245u + 12345u;
+		int edge = (int)((seed >> 16) % 16);
+
+		Fact changed[16];
+		BuildEdges(changed, 0xFFFFu);
+
+		if (mask & (1u << edge))
+			CHECK(datalog.evaluator.RemoveFact(&changed[edge]));
+		else
+			CHECK(datalog.evaluator.AddFact(&changed[edge]));
+
+		mask ^= (1u << edge);
+		datalog.store.ReclaimFacts();
+
+		TestDatalog expected;
+		CHECK(expected.evaluator.Evaluate(rules, BuildEdges(edges, mask), &expected.store));
+
+		CHECK_RESULTS(DumpFacts(&datalog.store, "t"), DumpFacts(&expected.store, "t").c_str());
+		CHECK(datalog.store.GetFactCount() == expected.store.GetFactCount());
+	}
+}
+
+// clauses of any term and goal count parsed from text. ("e(a, b, 1)." or "h(X, Y) :- e(X, Z, W), e(Z, Y, W).")
+// names point into the copied text. variables are names which start with a capital letter.
+class TestClauses
+{
+public:
+	char text[4096];
+	Clause clauses[64];
+	ClauseGoal goals[128];
+	ClauseTerm terms[512];
+	int clauseCount;
+	int goalCount;
+	int termCount;
+	char *position;
+
+	explicit TestClauses(const char *source)
+	{
+		strncpy(text, source, sizeof(text) - 1);
+		text[sizeof(text) - 1] = 0;
+
+		clauseCount = 0;
+		goalCount = 0;
+		termCount = 0;
+		position = text;
+
+		for (this->SkipSpaces(); *position; this->SkipSpaces())
+		{
+			Clause *clause = this->ReadClause();
+			if (!clause)
+			{
+				printf("invalid clause: %s\n", position);
+				return;
+			}
+
+			if (clauseCount > 1)
+				clauses[clauseCount - 2].nextClause = clause;
+		}
+	}
+
+	const Clause* GetFirstClause() const
+	{
+		return clauseCount ? &clauses[0] : 0;
+	}
+
+	// parses a query clause into the storage. ("q(X, Y) :- anc(X, Y).")
+	const Clause* ParseQuery(const char *query)
+	{
+		char *start = position + 1; // after the terminator of the previous text
+		size_t room = sizeof(text) - (size_t)(start - text);
+
+		if (strlen(query) >= room)
+			return 0;
+
+		strcpy(start, query);
+		position = start;
+
+		Clause *clause = this->ReadClause();
+		if (clause)
+			clause->nextClause = 0;
+
+		return clause;
+	}
+
+private:
+	void SkipSpaces()
+	{
+		while ((*position == ' ') || (*position == '\n'))
+			++position;
+	}
+
+	// returns the delimiter after the name. (name is terminated in place)
+	char ReadName(const char **name)
+	{
+		this->SkipSpaces();
+		*name = position;
+
+		while (((*position >= 'a') && (*position <= 'z')) || ((*position >= 'A') && (*position <= 'Z'))
+			|| ((*position >= '0') && (*position <= '9')) || (*position == '_'))
+			++position;
+
+		char *end = position;
+		this->SkipSpaces();
+
+		char delimiter = *position;
+		if (delimiter)
+			++position;
+
+		*end = 0;
+		return delimiter;
+	}
+
+	bool ReadGoal(ClauseGoal *goal, Clause *clause)
+	{
+		if (this->ReadName(&goal->predicateName) != '(')
+			return false;
+
+		goal->termCount = 0;
+		goal->terms = &terms[termCount];
+
+		char delimiter;
+		do
+		{
+			ClauseTerm *term = &terms[termCount++];
+			delimiter = this->ReadName(&term->name);
+			term->slot = -1;
+			++goal->termCount;
+
+			if (!HazeProlog::IsVariable(term->name))
+				continue;
+
+			for (const ClauseTerm *other = clause->head.terms; other != term; ++other)
+			{
+				if ((other->slot != -1) && (strcmp(other->name, term->name) == 0))
+					term->slot = other->slot;
+			}
+
+			if (term->slot == -1)
+				term->slot = clause->slotCount++;
+		} while (delimiter == ',');
+
+		return (delimiter == ')');
+	}
+
+	Clause* ReadClause()
+	{
+		Clause *clause = &clauses[clauseCount++];
+		clause->goalCount = 0;
+		clause->body = &goals[goalCount];
+		clause->slotCount = 0;
+		clause->nextClause = 0;
+		clause->head.terms = &terms[termCount];
+
+		if (!this->ReadGoal(&clause->head, clause))
+			return 0;
+
+		this->SkipSpaces();
+		if (*position == '.')
+		{
+			++position;
+			return clause;
+		}
+
+		if ((position[0] != ':') || (position[1] != '-'))
+			return 0;
+
+		position += 2;
+
+		for (;;)
+		{
+			if (!this->ReadGoal(&goals[goalCount++], clause))
+				return 0;
+
+			++clause->goalCount;
+			this->SkipSpaces();
+
+			char op = *position++;
+			if (op == '.')
+				return clause;
+
+			if (op != ',')
+				return 0;
+		}
+	}
+
+	TestClauses(const TestClauses&);
+	TestClauses& operator=(const TestClauses&);
+};
+
+// answers of each solution. ("a,b c,d")
+static bool CollectAnswers(const ClauseSolver *solver, void *userData)
+{
+	std::string *output = (std::string*)userData;
+
+	if (!output->empty())
+		*output += " ";
+
+	for (int i = 0; i < solver->GetAnswerCount(); ++i)
+	{
+		const char *answer = solver->GetAnswer(i);
+		*output += (i ? "," : "") + std::string(answer ? answer : "_");
+	}
+
+	return true;
+}
+
+// answers of a query, followed by the status if it is not SOLVE_OK. ("a b [no results]")
+// (Solver is ClauseSolver or ClauseMachine)
+template <typename Solver>
+static std::string SolveClauses(Solver *solver, const Clause *query)
+{
+	static const char *statusNames[] = { " [no results]", "", " [buffer exhausted]", " [out of memory]" };
+
+	std::string output;
+	SolveStatus status = solver->VisitSolutions(query, CollectAnswers, &output);
+
+	return output + statusNames[status];
+}
+
+// goals of more than 2 terms and bodies of more than 2 goals
+static void TestClauseSolver()
+{
+	TestClauses program("e(a, b, 1). e(b, c, 2). e(c, d, 3). e(a, c, 9). e(d, a, 4).\n"
+		"hop3(X, Y, W) :- e(X, A, W), e(A, B, V), e(B, Y, U).\n"
+		"route(X, Y, W1, W2) :- e(X, Z, W1), e(Z, Y, W2).\n");
+
+	ClauseCell cells[64];
+	int trail[64];
+	ClauseSolver solver;
+	solver.SetStorage(cells, 64, trail, 64);
+	solver.SetClauses(program.GetFirstClause());
+
+	CHECK_RESULTS(SolveClauses(&solver, program.ParseQuery("q(X, Y, W) :- hop3(X, Y, W).")), "a,d,1 b,a,2 c,b,3 c,c,3 a,a,9 d,c,4 d,d,4");
+	CHECK_RESULTS(SolveClauses(&solver, program.ParseQuery("q(Y) :- hop3(a, Y, 9).")), "a");
+	CHECK_RESULTS(SolveClauses(&solver, program.ParseQuery("q(X, W1, W2) :- route(X, c, W1, W2).")), "a,1,2 d,4,9");
+	CHECK_RESULTS(SolveClauses(&solver, program.ParseQuery("q(X) :- e(X, Y, Z), e(Y, X, W).")), " [no results]");
+	CHECK_RESULTS(SolveClauses(&solver, program.ParseQuery("q(X) :- hop3(X, Y, 5).")), " [no results]");
+
+	// out of cells or trail
+	const Clause *query = program.ParseQuery("q(X, Y, W) :- hop3(X, Y, W).");
+
+	solver.SetStorage(cells, 2, trail, 64); // query has 3 slots
+	CHECK_RESULTS(SolveClauses(&solver, query), " [out of memory]");
+
+	solver.SetStorage(cells, 6, trail, 64); // hop3 needs 6 more cells
+	CHECK_RESULTS(SolveClauses(&solver, query), " [out of memory]");
+
+	solver.SetStorage(cells, 64, trail, 4);
+	CHECK_RESULTS(SolveClauses(&solver, query), " [out of memory]");
+}
+
+// Fact and Rule chains run on ClauseSolver. OR rules become two clauses, and pred(X, Y) also matches pred(a, a).
+static void TestClauseBuilder()
+{
+	TestBase base("p(a, a). p(a, b). p(c, c). s(b). s(c).\n"
+		"r(X) :- s(X) ; p(X, X).\n"
+		"t(X, Y) :- p(X, Y), s(Y).\n");
+
+	Clause clauses[16];
+	ClauseGoal goals[16];
+	ClauseTerm terms[32];
+	ClauseBuilder builder;
+	builder.SetStorage(clauses, 16, goals, 16, terms, 32);
+	CHECK(builder.AddFacts(base.loader.GetFirstFact()));
+	CHECK(builder.AddRules(base.loader.GetFirstRule()));
+	CHECK(builder.GetClauseCount() == 8);
+
+	ClauseCell cells[32];
+	int trail[32];
+	ClauseSolver solver;
+	solver.SetStorage(cells, 32, trail, 32);
+	solver.SetClauses(builder.GetFirstClause());
+
+	TestClauses queries("");
+	CHECK_RESULTS(SolveClauses(&solver, queries.ParseQuery("q(X) :- r(X).")), "b c a c");
+	CHECK_RESULTS(SolveClauses(&solver, queries.ParseQuery("q(X, Y) :- t(X, Y).")), "a,b c,c");
+
+	// HazeProlog only matches facts with different terms
+	CHECK_RESULTS(SolveClauses(&solver, queries.ParseQuery("q(X, Y) :- p(X, Y).")), "a,a a,b c,c");
+	CHECK_RESULTS(Solve(&base.prolog, "p(X, Y)"), "a,b");
+
+	// storage is full
+	builder.SetStorage(clauses, 16, goals, 16, terms, 12);
+	CHECK(builder.AddFacts(base.loader.GetFirstFact()));
+	CHECK(!builder.AddRules(base.loader.GetFirstRule()));
+}
+
+class TestCompiler : public ClauseCompiler
+{
+public:
+	unsigned char codeStorage[16384];
+	const char *constantStorage[1200];
+	ClausePredicate predicateStorage[16];
+	unsigned short clauseStorage[1200];
+
+	TestCompiler()
+	{
+		this->SetStorage(codeStorage, sizeof(codeStorage), constantStorage, 1200, predicateStorage, 16, clauseStorage, 1200);
+	}
+};
+
+// compiled clauses give the answers and statuses of ClauseSolver in the same order
+static void TestClauseMachine()
+{
+	TestClauses program("parent(n0, n1). parent(n1, n2). parent(n2, n3). parent(n3, n4). parent(n2, n7). parent(n4, n5).\n"
+		"anc(X, Y) :- parent(X, Y).\n"
+		"anc(X, Y) :- parent(X, Z), anc(Z, Y).\n"
+		"like(a, a). like(a, b). like(b, b). cool(ice). cool(sky).\n"
+		"color(red, warm). color(X, cold) :- cool(X). color(sky, blue) :- like(a, a).\n"
+		"warm(sun) :- color(red, warm).\n"
+		"pair(X, X, Y) :- like(X, Y).\n");
+
+	TestCompiler compiler;
+	CHECK(compiler.Compile(program.GetFirstClause()));
+
+	ClauseCell cells[128];
+	int trail[128];
+
+	ClauseSolver solver;
+	solver.SetStorage(cells, 128, trail, 128);
+	solver.SetClauses(program.GetFirstClause());
+
+	ClauseMachine machine;
+	machine.SetStorage(cells, 128, trail, 128);
+	machine.SetProgram(compiler.GetProgram());
+
+	const char *queries[] = { "q(Y) :- anc(n0, Y).", "q(X, Y) :- anc(X, Y).", "q(X) :- anc(X, n5).", "q(X) :- anc(X, X).",
+		"q(X) :- like(X, X).", "q(X, Y) :- like(X, Y).", "q(X, Y) :- color(X, Y).", "q(X) :- color(X, cold).",
+		"q(Y) :- color(sky, Y).", "q(X) :- warm(X).", "q(X, Y) :- anc(n2, X), like(Y, Y).", "q(X, Y) :- pair(X, Y, b).",
+		"q(X, Y, Z) :- pair(X, Y, Z).", "q(X) :- unknown(X).", "q(X) :- like(X, c)." };
+
+	for (int i = 0; i < (int)(sizeof(queries) / sizeof(queries[0])); ++i)
+	{
+		const Clause *query = program.ParseQuery(queries[i]);
+		CHECK_RESULTS(SolveClauses(&machine, query), SolveClauses(&solver, query).c_str());
+	}
+
+	CHECK_RESULTS(SolveClauses(&machine, program.ParseQuery("q(Y) :- anc(n0, Y).")), "n1 n2 n3 n7 n4 n5");
+	CHECK_RESULTS(SolveClauses(&machine, program.ParseQuery("q(X) :- anc(X, X).")), " [no results]");
+	CHECK_RESULTS(SolveClauses(&machine, program.ParseQuery("q(X) :- like(X, X).")), "a b");
+	CHECK_RESULTS(SolveClauses(&machine, program.ParseQuery("q(X, Y) :- color(X, Y).")), "red,warm ice,cold sky,cold sky,blue");
+
+	// out of cells. (machine also uses cells for call arguments, so it can stop after less answers)
+	const Clause *query = program.ParseQuery("q(Y) :- anc(n0, Y).");
+	solver.SetStorage(cells, 8, trail, 128);
+	machine.SetStorage(cells, 8, trail, 128);
+
+	std::string answers;
+	CHECK(solver.VisitSolutions(query, CollectAnswers, &answers) == SOLVE_OUT_OF_MEMORY);
+	CHECK(machine.VisitSolutions(query, CollectAnswers, &answers) == SOLVE_OUT_OF_MEMORY);
+}
+
+// recursion deeper than MAX_CLAUSE_DEPTH stops both solvers with SOLVE_OUT_OF_MEMORY
+static void TestClauseDepthLimit()
+{
+	enum { CHAIN_LENGTH = MAX_CLAUSE_DEPTH + 8 };
+	static char names[CHAIN_LENGTH + 1][8];
+	static Fact facts[CHAIN_LENGTH];
+
+	for (int i = 0; i <= CHAIN_LENGTH; ++i)
+		sprintf(names[i], "n%d", i);
+
+	for (int i = 0; i < CHAIN_LENGTH; ++i)
+		facts[i] = Fact{ 2, "parent", false, names[i], false, names[i + 1], ((i + 1) < CHAIN_LENGTH) ? &facts[i + 1] : 0 };
+
+	TestBase base("anc(X, Y) :- parent(X, Y).\n"
+		"anc(X, Y) :- parent(X, Z), anc(Z, Y).\n");
+
+	static Clause clauses[CHAIN_LENGTH + 2];
+	static ClauseGoal goals[8];
+	static ClauseTerm terms[(2 * CHAIN_LENGTH) + 16];
+	ClauseBuilder builder;
+	builder.SetStorage(clauses, CHAIN_LENGTH + 2, goals, 8, terms, (2 * CHAIN_LENGTH) + 16);
+	CHECK(builder.AddFacts(facts));
+	CHECK(builder.AddRules(base.loader.GetFirstRule()));
+
+	static TestCompiler compiler;
+	CHECK(compiler.Compile(builder.GetFirstClause()));
+
+	static ClauseCell cells[16 * CHAIN_LENGTH];
+	static int trail[16 * CHAIN_LENGTH];
+
+	ClauseSolver solver;
+	solver.SetStorage(cells, 16 * CHAIN_LENGTH, trail, 16 * CHAIN_LENGTH);
+	solver.SetClauses(builder.GetFirstClause());
+
+	ClauseMachine machine;
+	machine.SetStorage(cells, 16 * CHAIN_LENGTH, trail, 16 * CHAIN_LENGTH);
+	machine.SetProgram(compiler.GetProgram());
+
+	TestClauses queries("");
+	const Clause *query = queries.ParseQuery("q(Y) :- anc(n0, Y).");
+
+	std::string answers;
+	CHECK(solver.VisitSolutions(query, CollectAnswers, &answers) == SOLVE_OUT_OF_MEMORY);
+	CHECK(answers.compare(0, 6, "n1 n2 ") == 0);
+
+	std::string machineAnswers;
+	CHECK(machine.VisitSolutions(query, CollectAnswers, &machineAnswers) == SOLVE_OUT_OF_MEMORY);
+	CHECK(machineAnswers.compare(0, 6, "n1 n2 ") == 0);
+}
+
+static std::string ReadTextFile(const char *fileName)
+{
+	std::string text;
+	FILE *file = fopen(fileName, "r");
+	if (!file)
+		return text;
+
+	char buffer[256];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		text.append(buffer, size);
+
+	fclose(file);
+	return text;
+}
+
+// program is written as C++ tables. (names are escaped)
+static void TestClauseProgramSource()
+{
+	TestClauses program("p(a). q(X) :- p(X).");
+	program.terms[0].name = "say \"hi\" \\";
+
+	TestCompiler compiler;
+	CHECK(compiler.Compile(program.GetFirstClause()));
+	CHECK(compiler.GetCodeSize() == 17);
+
+	ClauseCell cells[8];
+	int trail[8];
+	ClauseMachine machine;
+	machine.SetStorage(cells, 8, trail, 8);
+	machine.SetProgram(compiler.GetProgram());
+	CHECK_RESULTS(SolveClauses(&machine, program.ParseQuery("r(X) :- q(X).")), "say \"hi\" \\");
+
+	const char *fileName = "regression_program.h";
+	CHECK(compiler.WriteSource(fileName, "test"));
+
+	const char *expected =
+		"static const unsigned char test_code[] CLAUSE_PROGRAM_TABLE = {\n"
+		"\t0, 0, 0, 0, 0, 7, 1, 1, 0, 0, 5, 0, 0, 6, 0, 0, 7\n"
+		"};\n"
+		"\n"
+		"static const char *const test_constants[] CLAUSE_PROGRAM_TABLE = {\n"
+		"\t\"say \\\"hi\\\" \\\\\"\n"
+		"};\n"
+		"\n"
+		"static const ClausePredicate test_predicates[] CLAUSE_PROGRAM_TABLE = {\n"
+		"\t{ \"p\", 1, 0, 1 },\n"
+		"\t{ \"q\", 1, 1, 1 }\n"
+		"};\n"
+		"\n"
+		"static const unsigned short test_clauses[] CLAUSE_PROGRAM_TABLE = {\n"
+		"\t0, 6\n"
+		"};\n"
+		"\n"
+		"static const ClauseProgram test = { test_code, test_constants, test_predicates, 2, test_clauses };\n";
+
+	CHECK_RESULTS(ReadTextFile(fileName), expected);
+	remove(fileName);
+}
+
+// rules found through term1 chains are the rules of the predicate chain in the same order.
+// (1 term1 bucket, so all constants share a chain and variable heads of both predicates share a chain)
+static void TestRuleTerm1Chains()
+{
+	TestBase base("f(a, x). f(b, y). f(c, z). g(x). g(y). h(a, a). h(b, a).\n"
+		"r(a, Y) :- f(a, Y).\n"
+		"r(X, Y) :- h(X, Y).\n"
+		"s(a, Y) :- g(Y).\n"
+		"r(b, Y) :- f(b, Y).\n"
+		"s(X, Y) :- f(X, Y).\n"
+		"r(a, Y) :- g(Y).\n"
+		"r(X, z) :- f(X, z).\n"
+		"r(c, x) :- g(x).\n"
+		"r(b, a) :- h(b, a).\n");
+
+	const char *queries[] = { "r(a, Y)", "r(b, Y)", "r(c, Y)", "r(d, Y)", "r(a, x)", "r(b, a)", "r(c, x)", "r(c, z)",
+		"s(a, Y)", "s(b, Y)", "s(a, y)", "r(X, Y)", "r(X, a)" };
+	int queryCount = (int)(sizeof(queries) / sizeof(queries[0]));
+
+	RuleIndexEntry entries[16];
+	int buckets[4];
+	RuleIndex index;
+	index.SetStorage(entries, 16, buckets, 4);
+
+	HazeProlog indexed;
+	CHECK(indexed.SetRuleFactDefinitions(base.loader.GetFirstRule(), base.loader.GetFirstFact(), 0, &index));
+
+	std::string expected[16];
+	for (int i = 0; i < queryCount; ++i)
+	{
+		expected[i] = Solve(&base.prolog, queries[i]);
+		CHECK_RESULTS(Solve(&indexed, queries[i]), expected[i].c_str());
+	}
+
+	int term1Buckets[2 * 1];
+	index.SetTerm1Storage(term1Buckets, 1);
+	CHECK(indexed.SetRuleFactDefinitions(base.loader.GetFirstRule(), base.loader.GetFirstFact(), 0, &index));
+
+	for (int i = 0; i < queryCount; ++i)
+		CHECK_RESULTS(Solve(&indexed, queries[i]), expected[i].c_str());
+
+	CHECK_RESULTS(Solve(&indexed, "r(a, x)"), "true true");
+	CHECK_RESULTS(Solve(&indexed, "r(b, a)"), "true true");
+	CHECK_RESULTS(Solve(&indexed, "r(c, z)"), "true");
+	CHECK_RESULTS(Solve(&indexed, "r(d, z)"), "");
+}
+
+int main()
+{
+	TestInternQuery();
+	TestInternOneTermFacts();
+	TestFactIndexOrder();
+	TestRuleIndexOrder();
+	TestInt8ResultCount();
+	TestResultVectorArena();
+	TestNestedQueryArena();
+	TestDamagedImage();
+#ifdef ENABLE_ROM_TABLES
+	TestRomFactTable();
+#endif
+	TestHashJoinWithConstantHeadRule();
+	TestAndRuleShapes();
+	TestPlanOneVariableWithTwoVariableGoal();
+	TestPlanKeepsGoalOrder();
+	TestTabledCycle();
+	TestTabledAnswersAreUnique();
+	TestNestedTabledQuery();
+	TestTableWithoutStorage();
+	TestNestedCachedQuery();
+	TestNestedQueryOfReplay();
+	TestCachedOneTermQuery();
+	TestParallelRuleOrder();
+	TestBatchQueries();
+	TestRuleTerm1Chains();
+	TestDynamicFactStore();
+	TestColumnarFactStore();
+	TestScanRowsKernel();
+	TestDatalogSelfLoops();
+	TestDatalogIncremental();
+	TestClauseSolver();
+	TestClauseBuilder();
+	TestClauseMachine();
+	TestClauseDepthLimit();
+	TestClauseProgramSource();
+
+	if (failureCount != 0)
+	{
+		printf("%d checks failed\n", failureCount);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}